@@ -1,7 +1,42 @@
-#include <iostream>         // cout, cerr
+#include <iostream>         // cout, cerr, streambuf
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>           // snprintf, rename
+#include <cstdint>          // uint32_t
+#include <cstddef>          // offsetof
+#include <cstring>          // memcmp
+#include <cmath>            // powf
+#include <vector>           // vector
+#include <algorithm>        // find, stable_sort
+#include <string>           // string
+#include <fstream>          // ofstream
+#include <chrono>           // steady_clock
+#include <atomic>           // atomic
+#include <cfloat>           // FLT_MAX
+#include <climits>          // INT_MIN, INT_MAX
+#include <cerrno>           // errno
+#include <numeric>          // iota
+#include <thread>           // thread
+#include <mutex>            // mutex, unique_lock
+#include <condition_variable> // condition_variable
+#include <deque>            // deque
+#include <memory>           // unique_ptr
+#include <functional>       // function
+#include <ctime>            // clock, strftime
+#include <unordered_map>    // unordered_map
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
+#include <sys/stat.h>       // stat
+#ifdef _WIN32
+#include <direct.h>         // _mkdir
+#else
+#include <sys/mman.h>       // mmap
+#include <fcntl.h>          // open
+#include <unistd.h>         // close
+#endif
+#ifdef __linux__
+#include <EGL/egl.h>        // Headless (offscreen) contexts for benchmark mode
+#include <EGL/eglext.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include <GLFW/stb_image.h>      // Image loading Utility functions
 
@@ -19,6 +54,11 @@ using namespace std; // Standard namespace
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
 
+/*Shader body Macro: no #version line, for sources specialized by a preamble of feature defines*/
+#ifndef GLSL_BODY
+#define GLSL_BODY(Source) #Source
+#endif
+
 // Unnamed namespace
 namespace
 {
@@ -28,1008 +68,8162 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
-    // Stores the GL data relative to a given mesh
-    struct GLMesh
+    // Number of post-transform vertex cache entries assumed by the mesh build stage
+    const GLuint VERTEX_CACHE_SIZE = 32;
+
+    // Kinds of GL objects owned through a GLHandle and tracked by the resource registry
+    enum GLResourceKind
     {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbo;         // Handle for the vertex buffer object
-        GLuint nVertices;    // Number of indices of the mesh
+        RESOURCE_BUFFER,
+        RESOURCE_TEXTURE,
+        RESOURCE_PROGRAM,
+        RESOURCE_VERTEX_ARRAY,
+        RESOURCE_FRAMEBUFFER,
+        RESOURCE_RENDERBUFFER,
+        RESOURCE_KIND_COUNT
     };
 
-    // Main GLFW window
-    GLFWwindow* gWindow = nullptr;
-    // Triangle mesh data
-    GLMesh gMesh;
-    // Texture
-    GLuint gTextureIdPink;
-    GLuint gTextureIdGranite;
-    glm::vec2 gUVScale(5.0f, 5.0f);
-    GLint gTexWrapMode = GL_REPEAT;
+    // Owning handle of one GL object. create() makes the object and registers it with the resource registry
+    // under a label; reset(), assigning another handle or destroying the handle deletes it. Handles move but
+    // never copy, and convert to the GL name for GL calls.
+    template <GLResourceKind Kind>
+    class GLHandle
+    {
+    public:
+        GLHandle() : name(0) {}
+        GLHandle(GLHandle&& other) : name(other.name) { other.name = 0; }
+        ~GLHandle() { reset(); }
+        GLHandle& operator=(GLHandle&& other);
+        GLHandle(const GLHandle&) = delete;
+        GLHandle& operator=(const GLHandle&) = delete;
+
+        void create(const string& label);   // Deletes the object held, if any
+        void reset();
+        operator GLuint() const { return name; }
+
+    private:
+        GLuint name;        // 0 for none
+    };
+    typedef GLHandle<RESOURCE_BUFFER> GLBuffer;
+    typedef GLHandle<RESOURCE_TEXTURE> GLTexture;
+    typedef GLHandle<RESOURCE_PROGRAM> GLProgram;
+    typedef GLHandle<RESOURCE_VERTEX_ARRAY> GLVertexArray;
+    typedef GLHandle<RESOURCE_FRAMEBUFFER> GLFramebuffer;
+    typedef GLHandle<RESOURCE_RENDERBUFFER> GLRenderbuffer;
+
+    // Live GL object of the resource registry
+    struct GLResource
+    {
+        GLResourceKind kind;
+        string label;
+        size_t bytes;       // Memory of the object's storage, as set by USetResourceSize (0 if it has none)
+    };
 
-    // Shader programs
-    GLuint gPyramidProgramId;
-    GLuint gLampProgramId;
-    GLuint gPlaneProgramId;
+    // Every live object created through a GLHandle, with the memory of each kind and its high-water mark.
+    // Only the thread holding the GL context uses it, like the objects themselves.
+    struct GLResourceRegistry
+    {
+        std::unordered_map<uint64_t, GLResource> objects;  // Keyed by UResourceKey
+        size_t count[RESOURCE_KIND_COUNT];
+        size_t bytes[RESOURCE_KIND_COUNT];
+        size_t peakBytes[RESOURCE_KIND_COUNT];
+        size_t totalBytes;
+        size_t peakTotalBytes;
+    };
 
-    // camera
-    Camera gCamera(glm::vec3(0.0f, 0.0f, 7.0f));
-    float gLastX = WINDOW_WIDTH / 2.0f;
-    float gLastY = WINDOW_HEIGHT / 2.0f;
-    bool gFirstMouse = true;
+    // Named range of a mesh's index buffer holding one object
+    struct GLSubMesh
+    {
+        string name;        // Object name
+        GLuint firstIndex;  // First index of the range
+        GLsizei indexCount; // Number of indices of the range
+        glm::vec3 boundsMin; // Object-space bounding box of the range's vertices
+        glm::vec3 boundsMax;
+        GLint material;     // Index into the mesh's materials, or -1 for none
+    };
 
-    // timing
-    float gDeltaTime = 0.0f; // time between current frame and last frame
-    float gLastFrame = 0.0f;
+    // Surface of a loaded model's objects
+    struct GLMaterial
+    {
+        string name;
+        glm::vec3 color;    // Base color, used when there is no texture
+        string texture;     // Base color image, relative to the model's directory ("" for none)
+        GLTexture textureId; // 0 if there is no texture or it failed to load
+    };
 
-    // Subject position and scale
-    glm::vec3 gPyramidPosition(0.0f, 0.0f, 0.0f);
-    glm::vec3 gPyramidScale(2.0f);
-    glm::vec3 gPlanePosition(0.0f, 0.0f, 0.0f);
-    glm::vec3 gPlaneScale(5.0f);
+    // Sub-meshes built by UCreateMesh, in the order of GLMesh::subMeshes
+    enum SubMeshId
+    {
+        SUBMESH_BOTTLE,     // Triangular prism (lotion bottle)
+        SUBMESH_CAP,        // Cylinder (lotion bottle cap)
+        SUBMESH_PLANE,      // Ground plane
+        SUBMESH_COUNT
+    };
 
-    // Pyramid and light color
-    //m::vec3 gObjectColor(0.6f, 0.5f, 0.75f);
-    glm::vec3 gObjectColor(1.f, 0.2f, 0.0f);
-    glm::vec3 gLightColor(1.0f, 1.0f, 1.0f);
+    // Stores the GL data relative to a given mesh
+    struct GLMesh
+    {
+        GLVertexArray vao;  // Handle for the vertex array object
+        GLBuffer vbo;       // Handle for the vertex buffer object
+        GLBuffer ebo;       // Handle for the element (index) buffer object
+        GLuint nVertices;   // Number of unique vertices of the mesh
+        GLsizei nIndices;   // Number of indices of the mesh
+        GLenum indexType;   // Type of the indices (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT)
+        bool packed;        // The vertex buffer holds PackedVertex entries instead of MESH_FLOATS_PER_VERTEX floats
+        glm::vec3 positionScale;  // Maps the vertex positions onto object space: scale 1 and offset 0 for float
+        glm::vec3 positionOffset; // vertices, the bounding box for packed ones
+        vector<GLSubMesh> subMeshes; // Index ranges of the objects sharing the buffers
+        vector<GLMaterial> materials; // Materials of a loaded model's objects
+    };
 
-    // Light position and scale
-    glm::vec3 gLightPosition(1.5f, 7.5f, 4.0f);
-    glm::vec3 gLightScale(0.3f);
+    // Floats per vertex of a mesh: position, normal and texture coordinate (see USetMeshVertexAttributes)
+    const GLuint MESH_FLOATS_PER_VERTEX = 8;
 
-    // Perspective to Orthographic View
-    bool gIsViewOrthographic = true;
-}
+    // Vertex of a mesh uploaded with --packed-vertices, half the size of the float vertex: the position
+    // quantized to 16 bits per axis within the mesh's bounding box, the normal octahedral-encoded (see
+    // UEncodeOctahedral) and the texture coordinate in half floats
+    struct PackedVertex
+    {
+        GLushort position[3];   // Unsigned normalized, 0 to 1 across the bounding box
+        GLushort padding;
+        GLshort normal[2];      // Signed normalized
+        GLushort uv[2];         // Half floats
+    };
+    static_assert(sizeof(PackedVertex) == 16, "PackedVertex must match the attribute layout of USetMeshVertexAttributes");
 
-/* User-defined Function prototypes to:
- * initialize the program, set the window size,
- * redraw graphics on the window when resized,
- * and render graphics on the screen
- */
-bool UInitialize(int, char* [], GLFWwindow** window);
-void UResizeWindow(GLFWwindow* window, int width, int height);
-void UProcessInput(GLFWwindow* window);
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
-void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-void UCreateMesh(GLMesh& mesh);
-void UDestroyMesh(GLMesh& mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
-void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+    // Largest error UPackVertices made in a mesh's vertices
+    struct VertexPackError
+    {
+        float position;     // Object-space distance
+        float normal;       // Angle, in degrees
+        float uv;           // Largest texture coordinate difference
+    };
 
-/* Plane Vertex Shader Source Code*/
-const GLchar* planeVertexShaderSource = GLSL(440,
+    // Geometry and materials of a model file, as the loaders produce them for the mesh build stage
+    struct ModelData
+    {
+        vector<GLfloat> vertices;       // MESH_FLOATS_PER_VERTEX floats each
+        vector<GLuint> indices;         // Triangle list
+        vector<bool> missingNormals;    // Per vertex: the file gave no normal, UGenerateNormals computes one
+        vector<GLSubMesh> subMeshes;    // Bounds are computed by the build stage
+        vector<GLMaterial> materials;
+        vector<string> dependencies;    // Other files the parser read (MTL libraries, glTF buffers), as opened
+    };
 
-    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
-layout(location = 1) in vec3 normal; // VAP position 1 for normals
-layout(location = 2) in vec2 textureCoordinate;
+    // OBJ face corner: numbers of its position, texture coordinate and normal (-1 for none)
+    struct ObjVertexKey
+    {
+        long position;
+        long uv;
+        long normal;
+        bool operator==(const ObjVertexKey& other) const { return position == other.position && uv == other.uv && normal == other.normal; }
+    };
 
-out vec3 vertexNormal; // For outgoing normals to fragment shader
-out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-out vec2 vertexTextureCoordinate;
+    struct ObjVertexKeyHash
+    {
+        size_t operator()(const ObjVertexKey& key) const
+        {
+            return size_t(key.position) * 73856093u ^ size_t(key.uv) * 19349663u ^ size_t(key.normal) * 83492791u;
+        }
+    };
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    // Parsed JSON value (numbers are doubles, booleans are numbers 0 and 1)
+    struct JsonValue
+    {
+        enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+        Type type;
+        double number;
+        string text;                // String value
+        vector<string> keys;        // Member names of an object, parallel to items
+        vector<JsonValue> items;    // Array elements, or object member values
+    };
 
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    // Deepest nesting accepted in JSON text and glTF node hierarchies
+    const int JSON_MAX_DEPTH = 64;
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    // glTF accessor resolved to its bytes in a loaded buffer
+    struct GltfAccessor
+    {
+        const unsigned char* data;  // First element, or nullptr for an accessor without a buffer view (all zeros)
+        size_t count;               // Number of elements
+        size_t stride;              // Bytes between elements
+        int componentType;          // GLTF_FLOAT, GLTF_UNSIGNED_SHORT, ...
+        int components;             // 1 (SCALAR) to 4 (VEC4)
+        bool normalized;            // Integer components map to [0, 1] or [-1, 1]
+    };
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-    vertexTextureCoordinate = textureCoordinate;
-}
-);
+    // glTF component types and primitive mode (the GL enumerant values)
+    const int GLTF_BYTE = 5120;
+    const int GLTF_UNSIGNED_BYTE = 5121;
+    const int GLTF_SHORT = 5122;
+    const int GLTF_UNSIGNED_SHORT = 5123;
+    const int GLTF_UNSIGNED_INT = 5125;
+    const int GLTF_FLOAT = 5126;
+    const int GLTF_TRIANGLES = 4;
+
+    // Chunk types of a binary glTF (.glb) file
+    const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+    const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+    // Per-instance data of an instanced draw, read by the instanced vertex shader (attribute locations 3 to 7)
+    struct InstanceData
+    {
+        glm::mat4 model;        // Model matrix (one attribute location per column)
+        glm::vec4 color;        // Tint applied to the textured color
+        glm::mat3 normalMatrix; // Inverse transpose of the model matrix's upper 3x3, for the normals
+    };
 
+    // VAO that combines a mesh's vertex and index buffers with instance attributes; the instances themselves
+    // are written to the dynamic ring every frame and bound at INSTANCE_VERTEX_BINDING
+    struct GLInstanceBuffer
+    {
+        GLVertexArray vao;  // Handle for the vertex array object (mesh attributes + instance attributes)
+        GLsizei nInstances; // Number of instances of the scene
+    };
 
-/* Plane Fragment Shader Source Code*/
-const GLchar* planeFragmentShaderSource = GLSL(440,
+    // Per-frame rendering counters
+    struct FrameStats
+    {
+        GLuint drawCalls;       // Draw calls submitted this frame
+        GLuint drawCommands;    // Draws recorded, merged into the draw calls by multi-draw
+        GLuint sceneObjects;    // Objects in the scene
+        GLuint visibleObjects;  // Objects that passed frustum culling (the rest were culled)
+        double cullMs;          // CPU time of the culling pass
+        GLuint stateChanges;    // Program, VAO and texture binds issued
+        GLuint redundantStateChanges; // Binds skipped by the state cache because the state was already set
+        GLuint lightAssignments; // Entries of the clustered light index list (light-froxel overlaps)
+        GLuint maxClusterLights; // Most point lights in one froxel
+        double lightBinMs;      // CPU time of binning the point lights into froxels
+        size_t uploadBytes;     // Bytes written to the dynamic ring
+        double fenceWaitMs;     // CPU time spent waiting for the GPU to release a dynamic ring region
+    };
 
-    in vec3 vertexNormal; // For incoming normals
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate;
+    // Offscreen framebuffer the benchmark renders into
+    struct GLRenderTarget
+    {
+        GLFramebuffer fbo;  // Handle for the framebuffer object
+        GLRenderbuffer color; // Handle for the color renderbuffer
+        GLRenderbuffer depth; // Handle for the depth renderbuffer
+    };
 
-out vec4 fragmentColor; // For outgoing pyramid color to the GPU
+    // Timings of one benchmark frame
+    struct BenchmarkFrame
+    {
+        double cpuMs;       // CPU time spent updating the camera and submitting URender's commands
+        double gpuMs;       // GPU time of URender's commands (GL_TIME_ELAPSED)
+        double frameMs;     // Wall time since the end of the previous frame
+        GLuint drawCalls;   // Draw calls submitted
+        GLuint visibleObjects; // Objects that passed frustum culling
+        double cullMs;      // CPU time of the culling pass
+        GLuint stateChanges; // Binds issued through the state cache
+        GLuint redundantStateChanges; // Binds the state cache skipped
+        GLuint lightAssignments; // Light-froxel overlaps binned
+        double lightBinMs;  // CPU time of the light binning pass
+        double uploadBytes; // Bytes written to the dynamic ring
+        double fenceWaitMs; // Time waited for a dynamic ring region
+    };
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture1; // Useful when working with multiple textures
-uniform vec2 uvScale;
+    // Result of one microbenchmark (--microbench): times per iteration over MICROBENCH_REPETITIONS runs
+    struct MicrobenchResult
+    {
+        string name;
+        uint64_t iterations;        // Per run, grown until a run takes MICROBENCH_MIN_TIME_NS
+        double realNs;              // Median wall time per iteration
+        double realMinNs;
+        double realMaxNs;
+        double cpuNs;               // Median process CPU time per iteration
+        double bytesPerSecond;      // At the median wall time; 0 for benchmarks that process no bytes
+    };
 
-void main()
-{
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+    // Fixed camera pose of the regression harness (--regression)
+    struct RegressionPose
+    {
+        const char* name;   // Names the pose's reference image and baseline entry
+        glm::vec3 position;
+        float yaw;          // Degrees, as Camera takes them
+        float pitch;
+    };
 
-    //Calculate Ambient lighting*/
-    float ambientStrength = 1.0f; // Set ambient or global lighting strength
-    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+    // Outcome of one regression pose: its frame against the reference image, its timings against the baseline
+    struct RegressionResult
+    {
+        string name;
+        bool imagePassed;
+        double maxDeltaE;           // Largest CIE76 color difference of a pixel
+        double meanDeltaE;
+        double differingFraction;   // Pixels over the tolerance, of all pixels
+        bool perfPassed;
+        double cpuMs;               // Median CPU time submitting a frame
+        double gpuMs;               // Median GPU time of a frame (GL_TIME_ELAPSED)
+        double baselineCpuMs;       // 0 if the baseline has no entry for the pose
+        double baselineGpuMs;
+    };
 
-    //Calculate Diffuse lighting*/
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+    // Kind of a scene object, which selects the pass and program that draw it
+    enum SceneObjectKind
+    {
+        SCENE_BOTTLE,       // Lotion bottle and its cap
+        SCENE_BOTTLE_COPY,  // Bottle copy of the instancing stress scene
+        SCENE_PLANE,        // Ground plane
+        SCENE_LAMP,         // Marker at the light position
+        SCENE_MODEL,        // Object of the model loaded with --model
+        SCENE_KIND_COUNT
+    };
 
-    //Calculate Specular lighting*/
-    float specularIntensity = 0.8f; // Set specular light strength
-    float highlightSize = 8.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-    vec3 specular = specularIntensity * specularComponent * lightColor;
+    // Object of the scene: what to draw, where, and its world-space bounding box for culling
+    struct SceneObject
+    {
+        SceneObjectKind kind;
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+        GLuint instance;        // Index into gInstances of a SCENE_BOTTLE_COPY
+        GLuint subMesh;         // Sub-mesh of gModelMesh drawn by a SCENE_MODEL
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
 
-    // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture1, vertexTextureCoordinate * uvScale);
+    // Node of the scene's bounding volume hierarchy. An interior node (objectCount 0) is followed by its
+    // left child and names its right child in first; a leaf lists objectCount entries of
+    // Scene::objectOrder starting at first.
+    struct BvhNode
+    {
+        glm::vec3 boundsMin;
+        GLuint first;
+        glm::vec3 boundsMax;
+        GLuint objectCount;
+    };
 
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+    // Scene objects and their bounding volume hierarchy, built once (the scene is static)
+    struct Scene
+    {
+        vector<SceneObject> objects;
+        vector<BvhNode> nodes;
+        vector<GLuint> objectOrder;                 // Object indices, grouped by BVH leaf
+        vector<GLuint> visible[SCENE_KIND_COUNT];   // Objects that passed culling this frame, by kind
+    };
 
-    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-}
-);
+    // Result of testing a bounding box against the view frustum
+    enum CullResult
+    {
+        CULL_OUTSIDE,
+        CULL_INTERSECTING,
+        CULL_INSIDE
+    };
 
+    // Most objects a BVH leaf holds
+    const GLuint BVH_LEAF_SIZE = 4;
 
-/* Pyramid Vertex Shader Source Code*/
-const GLchar* pyramidVertexShaderSource = GLSL(440,
+    // One timed interval recorded by the profiler
+    struct ProfileEvent
+    {
+        const char* name;   // Scope name (string literal)
+        int64_t startNs;    // Start time on the steady_clock timeline
+        int64_t durationNs; // Duration
+        uint32_t track;     // Thread number for CPU scopes, PROFILE_GPU_TRACK for GPU scopes
+    };
 
-    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
-layout(location = 1) in vec3 normal; // VAP position 1 for normals
-layout(location = 2) in vec2 textureCoordinate;
+    // Slot of the profiler's ring buffer. Any thread records while the render thread may be writing the
+    // trace, so the fields are atomic and sequence publishes them (position + 1 once written, 0 while being
+    // rewritten), like a LogRecord's sequence
+    struct ProfileSlot
+    {
+        std::atomic<uint64_t> sequence;
+        std::atomic<const char*> name;
+        std::atomic<int64_t> startNs;
+        std::atomic<int64_t> durationNs;
+        std::atomic<uint32_t> track;
+    };
 
-out vec3 vertexNormal; // For outgoing normals to fragment shader
-out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-out vec2 vertexTextureCoordinate;
+    // Start of a profiled scope, returned by UProfileBegin and closed by UProfileEnd
+    struct ProfileMark
+    {
+        const char* name;   // Scope name (string literal)
+        int64_t startNs;    // CPU start time
+        int gpuScope;       // Index of the scope's timestamp query pair, or -1 for CPU-only scopes
+    };
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    // Number of profile events kept in the ring buffer (a power of two)
+    const size_t PROFILE_RING_SIZE = 1 << 16;
+    // GPU scopes per frame and the track number they are recorded under
+    const int PROFILE_MAX_GPU_SCOPES = 16;
+    const uint32_t PROFILE_GPU_TRACK = 1000;
 
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    // GPU timestamp queries issued during one frame
+    struct GpuProfileFrame
+    {
+        GLuint queries[PROFILE_MAX_GPU_SCOPES * 2];       // Begin and end timestamp of each scope
+        const char* names[PROFILE_MAX_GPU_SCOPES];        // Scope names
+        int nScopes;                                      // Scopes issued this frame
+    };
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    // Severity of a log message; messages below gLogLevel are dropped before they are formatted
+    enum LogLevel
+    {
+        LOG_DEBUG,
+        LOG_INFO,
+        LOG_WARNING,        // Printed to stderr, like LOG_ERROR
+        LOG_ERROR
+    };
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-    vertexTextureCoordinate = textureCoordinate;
-}
-);
+    // Longest log message in bytes (longer ones are cut off), and number of messages the log queue holds (a power of two)
+    const size_t LOG_MESSAGE_SIZE = 2048;
+    const size_t LOG_QUEUE_SIZE = 512;
+    // Shortest interval between two messages of a rate-limited call site
+    const int64_t LOG_RATE_LIMIT_NS = 250000000;
+    // How long the log thread sleeps when the queue is empty
+    const int LOG_DRAIN_INTERVAL_MS = 5;
+
+    // Slot of the log queue. Messages are formatted straight into their slot; sequence tells the writers and
+    // the log thread whose turn the slot is (bounded lock-free queue after Dmitry Vyukov)
+    struct LogRecord
+    {
+        std::atomic<uint64_t> sequence;
+        LogLevel level;
+        uint32_t suppressed;        // Messages the call site's rate limit dropped since the previous one
+        size_t length;
+        char text[LOG_MESSAGE_SIZE];
+    };
 
+    // Lock-free log queue, written by any thread and drained by a background thread, so logging never
+    // waits on the terminal
+    struct Logger
+    {
+        LogRecord records[LOG_QUEUE_SIZE];
+        std::atomic<uint64_t> head;     // Next slot a writer claims
+        uint64_t tail;                  // Next slot the log thread prints (log thread only)
+        std::atomic<uint64_t> dropped;  // Messages lost because the queue was full, not yet reported
+        std::atomic<bool> running;
+        std::thread thread;
+    };
 
-/* Pyramid Fragment Shader Source Code*/
-const GLchar* pyramidFragmentShaderSource = GLSL(440,
+    // Rate limit of one log call site (a static next to it): lets one message through per LOG_RATE_LIMIT_NS
+    // and counts the others, which the next message that gets through reports
+    struct LogRateLimit
+    {
+        std::atomic<int64_t> nextNs;
+        std::atomic<uint32_t> suppressed;
+    };
 
-    in vec3 vertexNormal; // For incoming normals
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate;
+    // Stream buffer over the text of a claimed log record; output past its end is dropped
+    struct LogStreamBuffer : public std::streambuf
+    {
+        void reset(char* begin, size_t size) { setp(begin, begin + size); }
+        size_t length() const { return size_t(pptr() - pbase()); }
+    };
 
-out vec4 fragmentColor; // For outgoing pyramid color to the GPU
+    // One log message, written with << into a queue slot and published when the temporary is destroyed:
+    //     LogMessage(LOG_INFO) << "Scene: " << count << " objects";
+    class LogMessage
+    {
+    public:
+        LogMessage(LogLevel level, LogRateLimit* limit = nullptr);
+        ~LogMessage();
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
+        template <typename T>
+        LogMessage& operator<<(const T& value)
+        {
+            if (record)
+                stream << value;
+            return *this;
+        }
 
-void main()
-{
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+    private:
+        LogStreamBuffer buffer;
+        std::ostream stream;
+        LogRecord* record;          // Claimed slot, or nullptr if the message is filtered, rate-limited or dropped
+        uint64_t position;          // Queue position of the slot
+    };
 
-    //Calculate Ambient lighting*/
-    float ambientStrength = 1.0f; // Set ambient or global lighting strength
-    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+    // Load state of a texture loaded in the background
+    enum TextureLoadState
+    {
+        TEXTURE_QUEUED,     // Waiting for a worker thread
+        TEXTURE_DECODING,   // Being decoded by a worker thread
+        TEXTURE_UPLOADING,  // Decoded, waiting for the GL upload on the main thread
+        TEXTURE_RESIDENT,   // Uploaded: the texture shows the image
+        TEXTURE_FAILED      // Could not be decoded: the texture keeps showing the placeholder
+    };
 
-    //Calculate Diffuse lighting*/
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+    // One mip level of a block-compressed texture, relative to the start of its level data
+    struct TextureLevel
+    {
+        GLsizei width;
+        GLsizei height;
+        uint64_t offset;
+        uint64_t size;
+    };
+    static_assert(sizeof(TextureLevel) == 24, "TextureLevel is stored in texture cache files");
 
-    //Calculate Specular lighting*/
-    float specularIntensity = 0.8f; // Set specular light strength
-    float highlightSize = 8.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-    vec3 specular = specularIntensity * specularComponent * lightColor;
+    // Header of a texture cache file, followed by levelCount TextureLevel entries and the level data.
+    // The image is flipped for OpenGL and block-compressed, with its full mip chain.
+    struct TextureCacheHeader
+    {
+        char magic[8];              // TEXTURE_CACHE_MAGIC
+        uint32_t version;           // TEXTURE_CACHE_VERSION
+        uint32_t format;            // GL compressed internal format
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;          // Channels of the source image
+        uint32_t levelCount;
+        uint64_t sourceSize;        // Size and modification time of the source image the cache was baked from
+        int64_t sourceTime;
+    };
+    static_assert(sizeof(TextureCacheHeader) == 48, "TextureCacheHeader is stored in texture cache files");
 
-    // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    // Read-only view of a whole file: memory-mapped where available, read into memory otherwise
+    struct MappedFile
+    {
+        const unsigned char* data;
+        size_t size;
+        vector<unsigned char> buffer;   // Holds the contents where the file cannot be mapped
+    };
 
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+    // Texture whose image is decoded in the background; the GL texture shows a placeholder until then
+    struct TextureLoad
+    {
+        string filename;
+        GLuint textureId;
+        std::atomic<int> state;     // TextureLoadState
+        int width, height, channels;
+        bool staged;                // Pixels are in the staging buffer at stagingOffset (otherwise in pixels/compressed)
+        size_t stagingOffset;
+        unsigned char* pixels;      // Decoded pixels of images too large for the staging buffer
+        GLenum compressedFormat;    // Block-compressed format of the levels, or 0 for an uncompressed image
+        vector<TextureLevel> levels; // Mip levels of a compressed image
+        vector<unsigned char> compressed; // Compressed levels of images too large for the staging buffer
+        bool cacheHit;              // Compressed levels came from an up-to-date cache file
+    };
 
-    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-}
-);
+    // Range of the staging buffer holding one image, retired once the GPU has consumed it
+    struct StagingRegion
+    {
+        size_t begin;
+        size_t end;
+        GLsync fence;               // Signaled when the upload has read the region (0 until it is issued)
+    };
 
+    // Background texture loader: a pool of decode threads writing into a persistently mapped pixel unpack
+    // buffer (used as a ring), from which the main thread uploads
+    struct TextureLoader
+    {
+        vector<std::thread> workers;
+        std::mutex mutex;                       // Guards everything below except the mapped memory itself
+        std::condition_variable jobAdded;       // Wakes workers: job queued or shutting down
+        std::condition_variable stagingFreed;   // Wakes workers: staging space was retired
+        std::deque<TextureLoad*> queued;        // Waiting to be decoded
+        std::deque<TextureLoad*> decoded;       // Waiting for the upload on the main thread
+        std::deque<StagingRegion> regions;      // Staging regions in use, in allocation order
+        vector<std::unique_ptr<TextureLoad>> loads; // Every load, for state queries
+        GLBuffer pbo;                           // Handle for the staging pixel unpack buffer
+        unsigned char* mapped;                  // Persistent mapping of the staging buffer
+        size_t capacity;                        // Size of the staging buffer
+        bool stopping;
+    };
 
-/* Lamp Shader Source Code*/
-const GLchar* lampVertexShaderSource = GLSL(440,
+    // Size of the texture staging buffer; larger images are uploaded from client memory
+    const size_t TEXTURE_STAGING_SIZE = 32 << 20;
 
-    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+    // Texture cache files are written next to the source image, with this suffix
+    const char* const TEXTURE_CACHE_EXTENSION = ".texcache";
+    const char TEXTURE_CACHE_MAGIC[8] = { 'M', 'Y', '3', 'D', 'T', 'E', 'X', '\0' };
+    const uint32_t TEXTURE_CACHE_VERSION = 1;
 
-        //Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    // Header of a shader program cache file, followed by the driver's program binary
+    struct ProgramCacheHeader
+    {
+        char magic[8];              // PROGRAM_CACHE_MAGIC
+        uint32_t version;           // PROGRAM_CACHE_VERSION
+        uint32_t binaryFormat;      // Driver-specific format returned by glGetProgramBinary
+        uint64_t key;               // Hash of the sources and the driver strings, checked against the file name
+        uint64_t binarySize;
+    };
+    static_assert(sizeof(ProgramCacheHeader) == 32, "ProgramCacheHeader is stored in shader cache files");
 
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-}
-);
+    // Linked program binaries are stored in this directory, one file per hash of sources and driver
+    const char* const PROGRAM_CACHE_DIRECTORY = "shadercache";
+    const char PROGRAM_CACHE_MAGIC[8] = { 'M', 'Y', '3', 'D', 'P', 'R', 'O', 'G' };
+    const uint32_t PROGRAM_CACHE_VERSION = 1;
 
+    // Header of a mesh cache file, followed by dependencyCount MeshCacheDependency, subMeshCount MeshCacheSubMesh
+    // and materialCount MeshCacheMaterial entries, the vertices (MESH_FLOATS_PER_VERTEX floats each) and the indices (of indexType), all ready
+    // to be uploaded as they are
+    struct MeshCacheHeader
+    {
+        char magic[8];              // MESH_CACHE_MAGIC
+        uint32_t version;           // MESH_CACHE_VERSION
+        uint32_t indexType;         // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        uint64_t sourceSize;        // Size and modification time of the source model the cache was built from
+        int64_t sourceTime;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t subMeshCount;
+        uint32_t materialCount;
+        uint32_t dependencyCount;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(MeshCacheHeader) == 56, "MeshCacheHeader is stored in mesh cache files");
 
-/* Fragment Shader Source Code*/
-const GLchar* lampFragmentShaderSource = GLSL(440,
+    // Other file the model was parsed from, checked like the model itself. A path that does not fit is
+    // recorded with a size no file has, so such a model is parsed every run.
+    struct MeshCacheDependency
+    {
+        char path[256];             // As the parser opened it, zero-terminated
+        uint64_t size;              // As UFileStamp returns them
+        int64_t time;
+    };
+    static_assert(sizeof(MeshCacheDependency) == 272, "MeshCacheDependency is stored in mesh cache files");
 
-    out vec4 fragmentColor; // For outgoing lamp color (smaller shape) to the GPU
+    struct MeshCacheSubMesh
+    {
+        char name[64];              // Zero-terminated, truncated
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t material;           // -1 for none
+        float boundsMin[3];
+        float boundsMax[3];
+        uint32_t reserved;
+    };
+    static_assert(sizeof(MeshCacheSubMesh) == 104, "MeshCacheSubMesh is stored in mesh cache files");
 
-void main()
-{
-    fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
-}
-);
+    struct MeshCacheMaterial
+    {
+        char name[64];              // Zero-terminated, truncated
+        float color[4];
+        char texture[256];          // Relative to the model's directory, zero-terminated
+    };
+    static_assert(sizeof(MeshCacheMaterial) == 336, "MeshCacheMaterial is stored in mesh cache files");
 
+    // Mesh cache files are written next to the source model, with this suffix
+    const char* const MESH_CACHE_EXTENSION = ".meshcache";
+    const char MESH_CACHE_MAGIC[8] = { 'M', 'Y', '3', 'D', 'M', 'E', 'S', 'H' };
+    const uint32_t MESH_CACHE_VERSION = 2;
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
+    // Header of an input recording (--record-input), followed by its records: each is the number of simulation
+    // steps since the previous record (7 bits per byte, low bits first, high bit set on all but the last byte),
+    // an InputRecordType byte and the type's payload (INPUT_RECORD_PAYLOAD bytes)
+    struct InputFileHeader
     {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
+        char magic[8];              // INPUT_FILE_MAGIC
+        uint32_t version;           // INPUT_FILE_VERSION
+        int32_t width;              // Framebuffer size when the recording started
+        int32_t height;
+        uint32_t reserved;
+        int64_t stepNs;             // Simulation step the recording was made with
+    };
+    static_assert(sizeof(InputFileHeader) == 32, "InputFileHeader is stored in input recordings");
 
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
-
-
-int main(int argc, char* argv[])
-{
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
-
-    // Create the mesh
-    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
-
-    // Create the shader programs
-    if (!UCreateShaderProgram(planeVertexShaderSource, planeFragmentShaderSource, gPlaneProgramId))
-        return EXIT_FAILURE;
-
-    if (!UCreateShaderProgram(pyramidVertexShaderSource, pyramidFragmentShaderSource, gPyramidProgramId))
-        return EXIT_FAILURE;
-
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
-        return EXIT_FAILURE;
+    const char INPUT_FILE_MAGIC[8] = { 'M', 'Y', '3', 'D', 'I', 'N', 'P', 'T' };
+    const uint32_t INPUT_FILE_VERSION = 1;
 
-    // Load texture
-    const char* texFilename = "resources/textures/NeonPinkPlastic.jpg";
-    if (!UCreateTexture(texFilename, gTextureIdPink))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    texFilename = "resources/textures/granite.jpg";
-    if (!UCreateTexture(texFilename, gTextureIdGranite))
+    // Kinds of input record, and what their x and y hold
+    enum InputRecordType
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPyramidProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPyramidProgramId, "uTexture"), 0);
-    glUseProgram(gPlaneProgramId);
-    glUniform1i(glGetUniformLocation(gPyramidProgramId, "uTexture1"), 1);
+        INPUT_RECORD_KEYS,          // Key state (bits in RECORDED_KEYS order) from this step on: uint32
+        INPUT_RECORD_CURSOR,        // Cursor position: two doubles
+        INPUT_RECORD_SCROLL,        // Vertical scroll offset (y): float
+        INPUT_RECORD_RESIZE,        // Framebuffer size: two int32
+        INPUT_RECORD_FRAME,         // A frame was published, interpolated x of the way into the next step: float
+        INPUT_RECORD_END,           // The recording stopped
+        INPUT_RECORD_TYPE_COUNT
+    };
+    const size_t INPUT_RECORD_PAYLOAD[INPUT_RECORD_TYPE_COUNT] = { 4, 16, 4, 8, 4, 0 };
 
-    // Sets the background color of the window to black (it will be implicitely used by glClear)
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    // Keys UProcessInput reads, in the bit order of the recorded key state
+    const int RECORDED_KEYS[] = { GLFW_KEY_ESCAPE, GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E,
+        GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3, GLFW_KEY_4, GLFW_KEY_RIGHT_BRACKET, GLFW_KEY_LEFT_BRACKET, GLFW_KEY_F12 };
 
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    struct InputRecord
     {
-        // per-frame timing
-        // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
+        InputRecordType type;
+        uint64_t step;              // Simulation steps taken when the input arrived
+        double x;
+        double y;
+    };
 
-        // input
-        // -----
-        UProcessInput(gWindow);
+    // Input recording being written: records go straight to the (buffered) file
+    struct InputRecorder
+    {
+        std::ofstream file;         // Open while recording
+        string path;
+        uint64_t lastStep;          // Step of the previous record
+        uint64_t records;
+    };
 
-        // Render this frame
-        URender();
+    // Input recording being replayed
+    struct InputReplay
+    {
+        bool active;
+        vector<InputRecord> records;
+        size_t next;                // First record not replayed yet
+        uint64_t frames;            // Frames published so far
+        int64_t startNs;
+    };
 
-        glfwPollEvents();
-    }
+    // Largest dimension of the loaded model once placed in the scene
+    const float MODEL_FIT_SIZE = 2.0f;
+
+    // Benchmark frames rendered before measuring, so shader compilation and caches settle
+    const int BENCHMARK_WARMUP_FRAMES = 10;
+    // Fixed time step of the scripted camera path, so every run sees the same poses
+    const int BENCHMARK_FRAME_RATE = 60;
+    const float BENCHMARK_FRAME_TIME = 1.0f / BENCHMARK_FRAME_RATE;
+
+    // Shortest run a microbenchmark's iteration count is grown to, and how many runs of it are timed
+    const int64_t MICROBENCH_MIN_TIME_NS = 100000000;
+    const int MICROBENCH_REPETITIONS = 5;
+    // Objects whose data the upload microbenchmarks send per iteration, about as many as the scene draws
+    const int MICROBENCH_UPLOAD_OBJECTS = 64;
+
+    // Regression harness poses: the interactive mode's initial pose, then views from above, both sides, close up
+    // and straight down. Frames are half the window size (same aspect) to keep the reference images small.
+    const RegressionPose REGRESSION_POSES[] = {
+        { "front", glm::vec3(0.0f, 0.0f, 7.0f), -90.0f, 0.0f },
+        { "above", glm::vec3(0.0f, 4.0f, 6.0f), -90.0f, -33.0f },
+        { "left", glm::vec3(-6.0f, 1.5f, 3.0f), -27.0f, -12.0f },
+        { "right", glm::vec3(6.0f, 1.5f, 3.0f), -153.0f, -12.0f },
+        { "close", glm::vec3(0.5f, 0.8f, 2.0f), -100.0f, -15.0f },
+        { "top", glm::vec3(0.0f, 9.0f, 0.1f), -90.0f, -89.0f }
+    };
+    const int REGRESSION_POSE_COUNT = int(sizeof(REGRESSION_POSES) / sizeof(REGRESSION_POSES[0]));
+    const int REGRESSION_WIDTH = WINDOW_WIDTH / 2;
+    const int REGRESSION_HEIGHT = WINDOW_HEIGHT / 2;
+    // Frames timed per pose (after BENCHMARK_WARMUP_FRAMES), and the animation time every pose is drawn at
+    const int REGRESSION_TIMED_FRAMES = 31;
+    const int64_t REGRESSION_ANIMATION_NS = 1000000000;
+    // Pixel pack buffers the frames are read back through: a pose's pixels are mapped this many poses later
+    const int REGRESSION_READBACK_BUFFERS = 2;
+    // Share of a frame's pixels allowed over the color tolerance, for rasterization differences along edges
+    const double REGRESSION_MAX_DIFFERING_FRACTION = 0.001;
+    // Frame time baseline, next to the reference images (<pose>.ppm) in the --regression directory
+    const char* const REGRESSION_BASELINE_FILE = "baseline.json";
+
+    // Uniform locations of a shader program, resolved once when the program is linked
+    struct GLUniformLocations
+    {
+        GLint uvScale;      // Texture coordinate scale
+    };
 
-    // Release mesh data
-    UDestroyMesh(gMesh);
+    // Features of the material shader, selected at compile time; a combination names a variant
+    enum MaterialFeature
+    {
+        MATERIAL_TEXTURED = 1 << 0,     // Base color from the draw's texture slot (otherwise its object color)
+        MATERIAL_SPECULAR = 1 << 1,     // Adds the specular highlight
+        MATERIAL_INSTANCED = 1 << 2,    // Model matrix, normal matrix and tint come from instance attributes
+        MATERIAL_VARIANT_COUNT = 1 << 3
+    };
 
-    // Release texture
-    UDestroyTexture(gTextureIdPink);
-    UDestroyTexture(gTextureIdGranite);
+    // Specialized variant of the material shader, compiled on first use
+    struct GLMaterialProgram
+    {
+        GLProgram programId;        // 0 until built, or if the variant failed to compile
+        GLUniformLocations uniforms;
+        bool built;                 // Compilation was attempted
+    };
 
-    // Release shader programs
-    UDestroyShaderProgram(gPlaneProgramId);
-    UDestroyShaderProgram(gPyramidProgramId);
-    UDestroyShaderProgram(gLampProgramId);
+    // Frames the CPU may write ahead of the GPU, each in its own region of the dynamic ring
+    const GLuint DYNAMIC_RING_REGIONS = 3;
+    // Initial size of one region; a frame needing more grows the ring
+    const size_t DYNAMIC_RING_REGION_SIZE = 1 << 20;
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
-}
+    // Range of the dynamic ring's buffer holding one block of this frame's data. The offset is relative to the
+    // frame's region (growing the ring moves the region); UDynamicOffset gives the offset in the buffer.
+    struct DynamicRange
+    {
+        GLintptr offset;
+        GLsizeiptr size;
+    };
 
+    // Persistently mapped buffer for everything rewritten each frame (FrameData, object transforms, visible
+    // instances, light lists). Each frame writes its own region, fenced after the frame's draws, so the CPU
+    // never overwrites data the GPU may still read and the driver never has to copy or rename the buffer.
+    struct DynamicRing
+    {
+        GLBuffer buffer;
+        unsigned char* mapped;                  // Persistent, coherent write mapping of the whole buffer
+        size_t regionSize;
+        GLsync fences[DYNAMIC_RING_REGIONS];    // Signaled when the GPU is done with a region's frame (0 for none)
+        GLuint region;                          // Region of the current frame
+        size_t used;                            // Bytes of the region used so far this frame
+        size_t uniformAlignment;                // Offset alignment of uniform buffer ranges
+        size_t storageAlignment;                // Offset alignment of shader storage buffer ranges
+    };
 
-// Initialize GLFW, GLEW, and create a window
-bool UInitialize(int argc, char* argv[], GLFWwindow** window)
-{
-    // GLFW: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // Render passes, in the order they are drawn (the top bits of a render key)
+    enum RenderPass
+    {
+        RENDER_PASS_LIT,        // Objects drawn with a material program
+        RENDER_PASS_UNLIT       // Light source markers
+    };
 
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
+    // One recorded draw: the state it needs and what it draws
+    struct RenderCommand
+    {
+        uint64_t key;                       // Sort key, see URenderKey
+        GLuint program;
+        const GLUniformLocations* uniforms;
+        bool material;                      // The program takes the material uniforms (object color, texture scale)
+        glm::vec3 color;                    // Object color of a material program; tints the texture of a textured one
+        GLuint texture;                     // Sampled through its texture table slot (0 for none)
+        GLuint vao;
+        const GLMesh* mesh;                 // Mesh whose index buffer the VAO uses
+        GLuint firstIndex;                  // Index range of the mesh
+        GLsizei indexCount;
+        GLsizei instanceCount;              // Instances of an instanced draw, 0 for a single draw
+        const SceneObject* object;          // Model and normal matrices of a single draw
+        GLintptr dynamicOffset;             // Instances of an instanced draw in the dynamic ring (region-relative)
+    };
 
-    // GLFW: window creation
-    // ---------------------
-    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-    if (*window == NULL)
+    // Indirect draw command of glMultiDrawElementsIndirect (layout fixed by the GL)
+    struct DrawElementsIndirectCommand
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return false;
-    }
-    glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-    glfwSetCursorPosCallback(*window, UMousePositionCallback);
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
-    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
 
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // Sort entry of the render queue: a command's key and its position in the command list
+    struct RenderSortEntry
+    {
+        uint64_t key;
+        GLuint command;
+    };
 
-    // GLEW: initialize
-    // ----------------
-    // Note: if using GLEW version 1.13 or earlier
-    glewExperimental = GL_TRUE;
-    GLenum GlewInitResult = glewInit();
+    // Draws recorded for one frame, executed in key order
+    struct RenderQueue
+    {
+        vector<RenderCommand> commands;
+        vector<RenderSortEntry> entries;
+        vector<RenderSortEntry> scratch;    // Radix sort buffer
+        DynamicRange objectData;            // This frame's per-draw data in the dynamic ring (see UWriteRenderQueueData)
+        DynamicRange drawIndices;
+        DynamicRange drawCommands;
+    };
 
-    if (GLEW_OK != GlewInitResult)
+    // GL state last set through the state cache, so binds of the state already set can be skipped
+    struct GLStateCache
     {
-        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
-        return false;
-    }
+        GLuint program;
+        GLuint vao;
+        GLuint stateChanges;                // Binds issued this frame
+        GLuint redundantStateChanges;       // Binds skipped this frame
+    };
 
-    // Displays GPU OpenGL version
-    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    // Sentinel of a state cache entry whose GL state is unknown
+    const GLuint STATE_UNKNOWN = ~0u;
 
-    return true;
-}
+    // Per-frame camera, light and projection data shared by every shader program.
+    // Mirrors the std140 layout of the FrameData uniform block in the shaders.
+    struct FrameData
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec3 viewPosition; float pad0; // std140 pads each vec3 to 16 bytes
+        glm::vec3 lightPos;     float pad1;
+        glm::vec3 lightColor;   float pad2;
+        GLuint clusterGrid[4];  // Froxels along x, y and z, and the number of point lights
+        glm::vec4 clusterParams; // Viewport width and height in pixels, depth slice scale and bias (see UClusterSlice)
+    };
+    static_assert(sizeof(FrameData) == 208, "FrameData must match the std140 block layout");
 
+    // Uniform buffer binding point of the FrameData block
+    const GLuint FRAME_DATA_BINDING = 0;
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-void UProcessInput(GLFWwindow* window)
-{
-    static const float cameraSpeed = 2.5f;
+    // Per-draw data, as the shaders' objects array reads it (std430: mat3 columns take a vec4 each)
+    struct ObjectData
+    {
+        glm::mat4 model;
+        glm::vec4 normalMatrix[3];  // Inverse transpose of the model matrix's upper 3x3, one column per vec4
+        glm::vec4 color;            // Object color of an untextured material, tint of a textured one (rgb)
+        glm::vec3 positionScale;    // Vertex position decoding of the draw's mesh (GLMesh::positionScale and positionOffset)
+        GLuint textureSlot;         // Texture table slot of a textured material
+        glm::vec3 positionOffset;
+        GLuint padding;
+    };
+    static_assert(sizeof(ObjectData) == 160, "ObjectData must match the std430 layout of the shaders' ObjectData");
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+    // Shader storage binding points of the per-draw data and the texture table (the lights use 0 to 2)
+    const GLuint OBJECT_BUFFER_BINDING = 3;
+    const GLuint TEXTURE_SLOT_BUFFER_BINDING = 4;
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime);
+    // Vertex buffer bindings of the instance attributes and of the draw index (the mesh attributes use
+    // bindings 0 to 2)
+    const GLuint INSTANCE_VERTEX_BINDING = 3;
+    const GLuint DRAW_INDEX_VERTEX_BINDING = 4;
 
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && gTexWrapMode != GL_REPEAT)
+    // Texture sampled through the texture table, by its slot index
+    struct TextureSlot
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureIdPink);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        gTexWrapMode = GL_REPEAT;
+        GLuint textureId;
+        GLint wrapMode;         // Applied by the shaders: array layers and bindless textures share their sampler state
+        GLuint64 handle;        // Bindless handle, the placeholder's until the image is resident
+    };
 
-        cout << "Current Texture Wrapping Mode: REPEAT" << endl;
-    }
-    else if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS && gTexWrapMode != GL_MIRRORED_REPEAT)
+    // Slot as the shaders' TextureSlots block reads it (std430)
+    struct TextureSlotData
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureIdPink);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        gTexWrapMode = GL_MIRRORED_REPEAT;
+        GLuint64 handle;        // A uvec2 in the shaders
+        GLuint layer;           // Layer of the texture array
+        GLint wrapMode;
+    };
+    static_assert(sizeof(TextureSlotData) == 16, "TextureSlotData must match the std430 layout of the shaders' TextureSlot");
 
-        cout << "Current Texture Wrapping Mode: MIRRORED REPEAT" << endl;
-    }
-    else if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_EDGE)
+    // Every texture a draw may sample, so draws with different textures need no rebinding in between and can
+    // share one multi-draw call. Slots are bindless handles, or layers of one texture array resampled to
+    // TEXTURE_ARRAY_SIZE where ARB_bindless_texture is not available.
+    struct TextureTable
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureIdPink);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        bool bindless;
+        vector<TextureSlot> slots;
+        std::unordered_map<GLuint, GLuint> slotOfTexture;
+        GLTexture arrayTexture;     // GL_TEXTURE_2D_ARRAY with a layer per slot
+        GLsizei arrayLayers;
+        GLTexture placeholder;      // Grey texture of the bindless slots whose image is not resident yet
+        GLuint64 placeholderHandle;
+        GLProgram copyProgram;      // Draws a texture into an array layer
+        GLVertexArray copyVao;      // Empty VAO for the copy's full-screen triangle
+        GLFramebuffer copyFramebuffer;
+        DynamicRange slotData;      // This frame's slot table in the dynamic ring
+    };
 
-        gTexWrapMode = GL_CLAMP_TO_EDGE;
+    // Width and height of the texture array's layers, and their mipmap levels (down to 1x1)
+    const GLsizei TEXTURE_ARRAY_SIZE = 1024;
+    const GLsizei TEXTURE_ARRAY_LEVELS = 11;    // 1 + log2(TEXTURE_ARRAY_SIZE)
 
-        cout << "Current Texture Wrapping Mode: CLAMP TO EDGE" << endl;
-    }
-    else if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_BORDER)
+    // Point light of the clustered lighting path, as the shaders read it (std430)
+    struct PointLight
     {
-        float color[] = { 1.0f, 0.0f, 1.0f, 1.0f };
-        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, color);
-
-        glBindTexture(GL_TEXTURE_2D, gTextureIdPink);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        gTexWrapMode = GL_CLAMP_TO_BORDER;
-
-        cout << "Current Texture Wrapping Mode: CLAMP TO BORDER" << endl;
-    }
+        glm::vec3 position; float radius;   // World-space position; the light has no effect beyond radius
+        glm::vec3 color;    float intensity;
+    };
+    static_assert(sizeof(PointLight) == 32, "PointLight must match the std430 layout of the shaders' PointLight");
 
-    if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
+    // Point light of the light stress test, circling a fixed center
+    struct LightOrbit
     {
-        gUVScale += 0.1f;
-        cout << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")" << endl;
-    }
-    else if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)
-    {
-        gUVScale -= 0.1f;
-        cout << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")" << endl;
-    }
+        PointLight light;   // Color, radius and intensity (the position is animated)
+        glm::vec3 center;
+        float orbitRadius;
+        float speed;        // Radians per second
+        float phase;
+    };
 
-    // Change perspective view to orthographic
-    static bool isPKeyDown = false;
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && !gIsViewOrthographic) 
-    {
-        gIsViewOrthographic = true;
-        //orthogonal view
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        glOrtho(-5.0f, 5.0f, -5.0f, 5.0f, -5.0f, 5.0f);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-    }
-    else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && gIsViewOrthographic)
+    // Lights of one cluster: their first entry in the light index list, and how many there are (a uvec2 in the shaders)
+    struct ClusterRange
     {
-        gIsViewOrthographic = false;
-        glMatrixMode(GL_PROJECTION); // keep it like this
-        glLoadIdentity();
-        gluPerspective(45.0, (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-    }
-
-}
-
-
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-void UResizeWindow(GLFWwindow* window, int width, int height)
-{
-    glViewport(0, 0, width, height);
-}
+        GLuint offset;
+        GLuint count;
+    };
 
+    // Box of froxels a light overlaps this frame (inclusive, per axis)
+    struct ClusterBounds
+    {
+        GLuint first[3];
+        GLuint last[3];
+        bool visible;       // The light overlaps the view frustum at all
+    };
 
-// glfw: whenever the mouse moves, this callback is called
-// -------------------------------------------------------
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
-{
-    if (gFirstMouse)
+    // Clustered forward lighting: the view frustum is divided into a grid of froxels (screen tiles times
+    // depth slices), and every froxel lists the point lights that can reach it. The material shader only
+    // loops over the list of its fragment's froxel.
+    struct LightClusters
     {
-        gLastX = xpos;
-        gLastY = ypos;
-        gFirstMouse = false;
-    }
+        vector<PointLight> lights;
+        vector<ClusterRange> ranges;        // One per cluster, x fastest, then y, then z
+        vector<GLuint> indices;             // Light indices, grouped by cluster
+        vector<ClusterBounds> bounds;       // Per light, from the counting pass to the filling pass
+        GLuint maxClusterLights;            // Most lights in one cluster this frame
+        DynamicRange lightData;             // This frame's copies of the lists in the dynamic ring
+        DynamicRange rangeData;
+        DynamicRange indexData;
+    };
 
-    float xoffset = xpos - gLastX;
-    float yoffset = gLastY - ypos; // reversed since y-coordinates go from bottom to top
+    // Froxel grid: screen tiles along x and y, exponential depth slices along z
+    const GLuint CLUSTER_GRID_X = 16;
+    const GLuint CLUSTER_GRID_Y = 9;
+    const GLuint CLUSTER_GRID_Z = 24;
+    const GLuint CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
 
-    gLastX = xpos;
-    gLastY = ypos;
+    // Shader storage binding points of the clustered lighting buffers
+    const GLuint LIGHT_BUFFER_BINDING = 0;
+    const GLuint CLUSTER_RANGE_BUFFER_BINDING = 1;
+    const GLuint LIGHT_INDEX_BUFFER_BINDING = 2;
 
-    gCamera.ProcessMouseMovement(xoffset, yoffset);
-}
+    // Near and far planes of the perspective projection, which the depth slices span
+    const float CAMERA_NEAR = 0.1f;
+    const float CAMERA_FAR = 100.0f;
 
+    // Everything URender needs from the simulation for one frame. The main thread builds it and never
+    // changes it once published, so the render thread can draw it while the next one is being built.
+    struct FrameSnapshot
+    {
+        uint64_t frame;             // Number of the snapshot, counted by the main thread
+        int64_t inputNs;            // When the input it shows was sampled (profiler timeline)
+        glm::mat4 view;
+        glm::vec3 cameraPosition;
+        float cameraZoom;           // Vertical field of view in degrees
+        glm::vec2 uvScale;
+        GLint texWrapMode;          // Wrap mode of the pink texture
+        int64_t animationNs;        // Simulated time the point light orbits are drawn at
+        int viewportWidth;
+        int viewportHeight;
+        bool writeTrace;            // F12 was pressed: write the profiler trace after this frame
+    };
 
-// glfw: whenever the mouse scroll wheel scrolls, this callback is called
-// ----------------------------------------------------------------------
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
-{
-    gCamera.ProcessMouseScroll(yoffset);
-}
+    // Triple-buffered mailbox handing snapshots from the main thread to the render thread. Each thread owns
+    // one buffer and swaps it with latest: the render thread always gets the newest snapshot, and the main
+    // thread never waits, replacing a snapshot the render thread has not taken yet.
+    struct SnapshotMailbox
+    {
+        FrameSnapshot buffers[3];
+        std::atomic<uint32_t> latest;       // Buffer last published, or'ed with SNAPSHOT_NEW until it is taken
+        uint32_t writing;                   // Buffer the main thread fills (main thread only)
+        uint32_t reading;                   // Buffer the render thread draws (render thread only)
+        std::atomic<bool> stopping;         // The render thread should exit
+        std::atomic<uint64_t> replaced;     // Snapshots replaced before the render thread took them
+        std::mutex mutex;                   // Only lets the render thread sleep; the hand-off itself takes no lock
+        std::condition_variable published;  // Snapshot published, or stopping
+        std::condition_variable taken;      // Snapshot taken by the render thread (waited for by input replay)
+    };
+    const uint32_t SNAPSHOT_NEW = 4;
 
-// glfw: handle mouse button events
-// --------------------------------
-void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
-{
-    switch (button)
+    // Threads whose busy time is tracked by UMarkThreadBusy
+    enum PipelineThread
     {
-    case GLFW_MOUSE_BUTTON_LEFT:
+        PIPELINE_MAIN_THREAD,       // Input and simulation
+        PIPELINE_RENDER_THREAD,     // GL submission and present
+        PIPELINE_THREAD_COUNT
+    };
+
+    // Swap interval of the window (--vsync)
+    enum VsyncMode
     {
-        if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
-    }
-    break;
+        VSYNC_OFF,                  // Present at once, tearing
+        VSYNC_ON,                   // Wait for the vertical blank
+        VSYNC_ADAPTIVE              // Wait for the vertical blank, unless the frame missed it (EXT_swap_control_tear)
+    };
 
-    case GLFW_MOUSE_BUTTON_MIDDLE:
+    // Fixed-timestep clock of the main thread's simulation. Integer nanoseconds on the profiler's timeline
+    // keep full resolution however long the program runs; floating-point seconds lose it after days.
+    struct SimulationClock
     {
-        if (action == GLFW_PRESS)
-            cout << "Middle mouse button pressed" << endl;
-        else
-            cout << "Middle mouse button released" << endl;
-    }
-    break;
+        int64_t stepNs;             // Length of a simulation step
+        int64_t lastNs;             // When the clock last advanced
+        int64_t accumulatorNs;      // Time elapsed but not simulated yet: less than a step once the steps ran
+        int64_t timeNs;             // Simulated time, a whole number of steps
+        int64_t droppedNs;          // Time skipped because the simulation fell too far behind
+    };
 
-    case GLFW_MOUSE_BUTTON_RIGHT:
+    // Durations of the last FRAME_HISTORY_SIZE frames presented by the render thread
+    const size_t FRAME_HISTORY_SIZE = 1024;
+    struct FrameTimeHistory
     {
-        if (action == GLFW_PRESS)
-            cout << "Right mouse button pressed" << endl;
-        else
-            cout << "Right mouse button released" << endl;
-    }
-    break;
+        int64_t frameNs[FRAME_HISTORY_SIZE];
+        size_t count;               // Frames recorded so far; the newest is at (count - 1) % FRAME_HISTORY_SIZE
+    };
 
-    default:
-        cout << "Unhandled mouse button event" << endl;
-        break;
-    }
-}
+    // Busy time of the main and render threads, and how much of it overlapped
+    struct ThreadOverlap
+    {
+        std::mutex mutex;
+        int busyThreads;                            // Threads busy right now
+        bool busy[PIPELINE_THREAD_COUNT];
+        int64_t changedNs;                          // Last time busyThreads changed
+        int64_t startNs[PIPELINE_THREAD_COUNT];     // Start of each busy thread's current interval
+        int64_t busyNs[PIPELINE_THREAD_COUNT];      // Busy time since the last report
+        int64_t overlapNs;                          // Time both threads were busy since the last report
+    };
 
+    // Length of a simulation step: input and animation advance by exactly this much per step, however often
+    // frames are drawn, so motion does not depend on the frame rate
+    const int64_t SIMULATION_STEP_NS = 4000000;
+    // Most steps simulated at once; after a longer stall the rest of the time is dropped instead of caught up
+    const int MAX_SIMULATION_STEPS = 25;
 
-// Functioned called to render a frame
-void URender()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    // Longest the main thread waits for input before it steps the simulation anyway (seconds), so held keys
+    // keep moving the camera smoothly
+    const double SIMULATION_INTERVAL = SIMULATION_STEP_NS / 1.0e9;
 
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Longest the main thread sleeps while nothing changes (seconds). Input, and the render thread asking for
+    // another frame, wake it earlier.
+    const double IDLE_WAIT_INTERVAL = 0.5;
 
-    // Activate the cube VAO (used by cube and lamp)
-    glBindVertexArray(gMesh.vao);
+    // Live GL objects and their memory. Declared before every global holding a GLHandle, so it outlives them.
+    GLResourceRegistry gResources;
 
-    // Pyramid: draw pyramid
-    //----------------
-    // Set the shader to be used
-    glUseProgram(gPyramidProgramId);
-
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = glm::translate(gPyramidPosition) * glm::scale(gPyramidScale);
-
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gPyramidProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gPyramidProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gPyramidProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Reference matrix uniforms from the Pyramid Shader program for the pyramid color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gPyramidProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gPyramidProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gPyramidProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gPyramidProgramId, "viewPosition");
-
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    // Main GLFW window
+    GLFWwindow* gWindow = nullptr;
+    // Triangle mesh data
+    GLMesh gMesh;
+    // Model loaded with --model (no VAO if none) and where it stands
+    string gModelPath;
+    GLMesh gModelMesh;
+    glm::vec3 gModelPosition(-2.5f, 0.0f, 0.0f);
+    bool gUseMeshCache = true;              // Load models from (and save them to) binary mesh cache files
+    bool gPackVertices = false;             // Upload the meshes' vertices as PackedVertex
+    // Texture
+    GLTexture gTextureIdPink;
+    GLTexture gTextureIdGranite;
+    TextureTable gTextureTable;
+    bool gUseBindless = true;               // Sample through bindless handles where ARB_bindless_texture is available
+    glm::vec2 gUVScale(5.0f, 5.0f);
+    GLint gTexWrapMode = GL_REPEAT;
 
-    GLint UVScaleLoc = glGetUniformLocation(gPyramidProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    // Shader programs
+    GLMaterialProgram gMaterialPrograms[MATERIAL_VARIANT_COUNT]; // Indexed by MaterialFeature flags
+    GLProgram gLampProgramId;
+    GLUniformLocations gLampUniforms;
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdPink);
+    // Persistently mapped buffer of the data rewritten every frame
+    DynamicRing gDynamicRing;
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+    // camera
+    Camera gCamera(glm::vec3(0.0f, 0.0f, 7.0f));
+    float gLastX = WINDOW_WIDTH / 2.0f;
+    float gLastY = WINDOW_HEIGHT / 2.0f;
+    bool gFirstMouse = true;
 
-    // Plane: draw plane
-//----------------
-// Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+    // timing
+    SimulationClock gClock = { SIMULATION_STEP_NS, 0, 0, 0, 0 };
+    float gDeltaTime = SIMULATION_STEP_NS / 1.0e9f; // Length of a simulation step in seconds, for the Camera calls
+    glm::vec3 gPreviousCameraPosition(0.0f, 0.0f, 7.0f); // Camera position before the last step, to interpolate from
 
-    // Model matrix: transformations are applied right-to-left order
-    model = glm::translate(gPlanePosition) * glm::scale(gPlaneScale);
+    // Input recording and replay: the key state UProcessInput reads, polled (and recorded) or replayed per step
+    uint32_t gInputKeys = 0;
+    string gRecordInputPath;
+    string gReplayInputPath;
+    InputRecorder gInputRecorder;
+    InputReplay gInputReplay;
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+    // Subject position and scale
+    glm::vec3 gPyramidPosition(0.0f, 0.0f, 0.0f);
+    glm::vec3 gPyramidScale(2.0f);
+    glm::vec3 gPlanePosition(0.0f, 0.0f, 0.0f);
+    glm::vec3 gPlaneScale(5.0f);
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    // Pyramid and light color
+    //m::vec3 gObjectColor(0.6f, 0.5f, 0.75f);
+    glm::vec3 gObjectColor(1.f, 0.2f, 0.0f);
+    glm::vec3 gLightColor(1.0f, 1.0f, 1.0f);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gPlaneProgramId, "model");
-    viewLoc = glGetUniformLocation(gPlaneProgramId, "view");
-    projLoc = glGetUniformLocation(gPlaneProgramId, "projection");
+    // Light position and scale
+    glm::vec3 gLightPosition(1.5f, 7.5f, 4.0f);
+    glm::vec3 gLightScale(0.3f);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Size of the framebuffer area being rendered, which the froxel grid's screen tiles divide
+    int gViewportWidth = WINDOW_WIDTH;
+    int gViewportHeight = WINDOW_HEIGHT;
+
+    // Clustered point lights: number of lights of the light stress test, their orbits and the froxel grid
+    GLsizei gLightCount = 0;
+    vector<LightOrbit> gLightOrbits;
+    LightClusters gLightClusters;
+
+    // Main/render thread split: snapshots go from the main thread (input, simulation) to the render thread,
+    // which owns the GL context while the window is open
+    SnapshotMailbox gSnapshots;
+    std::thread gRenderThread;
+    ThreadOverlap gThreadOverlap;
+    bool gWriteTraceRequested = false;      // Set by F12 on the main thread, carried over by the next snapshot
+
+    // On-demand rendering: the main thread publishes a snapshot only when the frame is dirty (input changed
+    // the camera or the scene) or something animates, and otherwise sleeps until input arrives
+    bool gFrameDirty = true;                // The first frame is always drawn
+    std::atomic<bool> gRedrawRequested(false); // Set by the render thread while texture loads still need frames
+    bool gContinuousRendering = false;      // Publish every simulation step, changed or not
+    int gFpsCap = 0;                        // Most frames presented per second (0: no cap)
+    VsyncMode gVsyncMode = VSYNC_ON;
+
+    // Instancing stress scene: number of bottle copies (0 draws the single bottle) and how they are drawn
+    GLsizei gInstanceCount = 0;
+    bool gUseInstancing = true;
+    vector<InstanceData> gInstances;
+    GLInstanceBuffer gInstanceBuffer;
+    vector<InstanceData> gVisibleInstances; // Instances that passed culling, uploaded each frame
+
+    // Scene drawn by URender
+    Scene gScene;
+    RenderQueue gRenderQueue;
+    GLStateCache gStateCache;
+
+    // Rendering counters of the current frame
+    FrameStats gFrameStats;
+
+    // Headless benchmark mode: number of measured frames and output file prefix (.csv and .json are appended)
+    bool gBenchmarkMode = false;
+    int gBenchmarkFrames = 600;
+    string gBenchmarkOutput = "benchmark";
+    bool gMicrobenchMode = false;           // Headless too: times the CPU-side hot paths instead of frames
+
+    // Regression harness (headless too): reference directory, and how far the results may drift from it
+    bool gRegressionMode = false;
+    string gRegressionDirectory;
+    bool gUpdateReferences = false;         // Write the reference images and the baseline instead of checking them
+    double gImageTolerance = 2.3;           // Largest color difference (CIE76 delta E) of a matching pixel; 2.3 is just noticeable
+    double gPerfThreshold = 10.0;           // Percent a median frame time may exceed its baseline by
+
+    // Profiler: rolling ring buffer of CPU and GPU scopes, dumped as a Chrome trace (chrome://tracing)
+    vector<ProfileSlot> gProfileEvents(PROFILE_RING_SIZE);
+    std::atomic<uint64_t> gProfileEventCount(0);
+    std::atomic<uint32_t> gProfileThreadCount(0);
+    GpuProfileFrame gGpuProfileFrames[2];   // Double-buffered: one frame is recorded while the previous one completes
+    uint32_t gProfileFrame = 0;
+    int64_t gGpuClockOffsetNs = 0;          // steady_clock time minus GL_TIMESTAMP time
+    GLuint gGpuProfileFramesDropped = 0;    // Frames whose GPU results were not ready in time and were skipped
+    string gTraceOutput = "trace.json";
+
+    // Asynchronous logging (see LogMessage)
+    Logger gLogger;
+    LogLevel gLogLevel = LOG_INFO;
+
+    // Background texture loading and startup timing
+    TextureLoader gTextureLoader;
+    int64_t gStartTimeNs = 0;               // Profiler time at the start of main
+    bool gTexturesPending = false;          // Some texture is not resident (or failed) yet
+    bool gUseTextureCache = true;           // Load textures from (and bake) block-compressed cache files
+
+    // Shader program binary cache
+    bool gUseProgramCache = true;           // Load linked programs from (and save them to) the shader cache
+    GLuint gProgramCacheHits = 0;
+    GLuint gProgramCacheMisses = 0;
+
+#ifdef __linux__
+    // EGL objects of the headless context
+    EGLDisplay gEglDisplay = EGL_NO_DISPLAY;
+    EGLContext gEglContext = EGL_NO_CONTEXT;
+    EGLSurface gEglSurface = EGL_NO_SURFACE;
+#endif
+}
+
+/* User-defined Function prototypes to:
+ * initialize the program, set the window size,
+ * redraw graphics on the window when resized,
+ * and render graphics on the screen
+ */
+bool UParseCommandLine(int argc, char* argv[]);
+bool UInitialize(int, char* [], GLFWwindow** window);
+bool UInitializeHeadless();
+void UDestroyHeadless();
+bool URunBenchmark();
+void UBenchmarkCameraStep(int frame);
+bool UWriteBenchmarkResults(const vector<BenchmarkFrame>& frames, const string& prefix);
+string UJsonEscape(const string& text);
+bool URunMicrobenchmarks();
+void UMicrobench(vector<MicrobenchResult>& results, const string& name, double bytesPerIteration, const std::function<void(uint64_t)>& body);
+bool UWriteMicrobenchResults(const vector<MicrobenchResult>& results, const string& path);
+bool URunRegression();
+glm::vec3 USrgbToLab(const unsigned char* rgb);
+void UCheckRegressionImage(const vector<unsigned char>& pixels, RegressionResult& result);
+void UCheckRegressionTimes(const JsonValue& baseline, RegressionResult& result);
+bool UWritePpm(const string& path, const unsigned char* pixels, int width, int height);
+bool UWriteRegressionBaseline(const vector<RegressionResult>& results, const string& path);
+bool UWriteRegressionResults(const vector<RegressionResult>& results, const string& path);
+void UCreateRenderTarget(GLsizei width, GLsizei height, GLRenderTarget& target);
+void ULogStart();
+void ULogStop();
+bool ULogDrain();
+bool UParseLogLevel(const string& name, LogLevel& level);
+bool UParseVsyncMode(const string& name, VsyncMode& mode);
+bool UParseInt(const string& text, int& value);
+bool UParseDouble(const string& text, double& value);
+int64_t UProfileNow();
+void UCreateProfiler();
+void UDestroyProfiler();
+void UProfileBeginFrame();
+ProfileMark UProfileBegin(const char* name, bool gpu);
+void UProfileEnd(const ProfileMark& mark);
+bool UWriteChromeTrace(const string& path);
+void UDestroyRenderTarget(GLRenderTarget& target);
+uint64_t UResourceKey(GLResourceKind kind, GLuint name);
+GLuint UCreateResource(GLResourceKind kind, const string& label);
+void UDeleteResource(GLResourceKind kind, GLuint name);
+void USetResourceSize(GLResourceKind kind, GLuint name, size_t bytes);
+const char* UResourceKindName(GLResourceKind kind);
+void ULogResources(LogLevel level);
+size_t UReportLiveResources();
+void UResizeWindow(GLFWwindow* window, int width, int height);
+void UProcessInput(GLFWwindow* window);
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UWindowRefreshCallback(GLFWwindow* window);
+void UCreateMesh(GLMesh& mesh);
+void UDestroyMesh(GLMesh& mesh);
+void UWeldVertices(const GLfloat* verts, GLuint vertexCount, GLuint floatsPerVertex, vector<GLfloat>& uniqueVerts, vector<GLuint>& indices);
+void UOptimizeVertexCache(GLuint* indices, size_t indexCount, GLuint vertexCount);
+void UOptimizeOverdraw(GLuint* indices, size_t indexCount, const vector<GLfloat>& verts, GLuint floatsPerVertex);
+void UOptimizeVertexFetch(vector<GLuint>& indices, vector<GLfloat>& verts, GLuint floatsPerVertex);
+size_t UCountVertexShaderInvocations(const GLuint* indices, size_t indexCount);
+const void* UIndexOffset(const GLMesh& mesh, GLuint firstIndex);
+void USetMeshVertexAttributes(const GLMesh& mesh);
+void UOptimizeMesh(GLMesh& mesh, vector<GLfloat>& vertices, vector<GLuint>& indices, GLuint floatsPerVertex, size_t& unoptimizedInvocations, size_t& optimizedInvocations);
+void UComputeSubMeshBounds(GLMesh& mesh, const vector<GLfloat>& vertices, const vector<GLuint>& indices, GLuint floatsPerVertex);
+void UPackIndices(const vector<GLuint>& indices, GLuint vertexCount, vector<unsigned char>& packed, GLenum& indexType);
+void UUploadMesh(GLMesh& mesh, const void* vertices, const void* indices, const string& name);
+void UPackVertices(const GLfloat* vertices, GLuint vertexCount, vector<PackedVertex>& packed, glm::vec3& positionScale, glm::vec3& positionOffset, VertexPackError& error);
+void UEncodeOctahedral(const glm::vec3& normal, GLshort encoded[2]);
+glm::vec3 UDecodeOctahedral(const GLshort encoded[2]);
+GLushort UFloatToHalf(float value);
+float UHalfToFloat(GLushort half);
+bool ULoadModel(const string& path, GLMesh& mesh);
+bool UReadFile(const string& path, string& contents);
+string UDirectoryOf(const string& path);
+bool UParseObj(const string& path, ModelData& model);
+bool UParseGltf(const string& path, ModelData& model);
+bool UParseJsonValue(const char*& cursor, JsonValue& value, int depth);
+const JsonValue* UJsonMember(const JsonValue* value, const char* key);
+double UJsonNumber(const JsonValue* value, double fallback);
+void UFileStamp(const string& path, uint64_t& size, int64_t& time);
+bool UUploadMeshCache(const unsigned char* data, size_t size, uint64_t sourceSize, int64_t sourceTime, GLMesh& mesh, const string& name);
+float UPlaneExtent();
+void UCreateStressInstances(GLsizei count, vector<InstanceData>& instances);
+void UCreateInstanceBuffer(const GLMesh& mesh, const vector<InstanceData>& instances, GLInstanceBuffer& instanceBuffer);
+void UDestroyInstanceBuffer(GLInstanceBuffer& instanceBuffer);
+void UCreateScene(const GLMesh& mesh, const GLMesh& model, const vector<InstanceData>& instances, Scene& scene);
+void UCullScene(Scene& scene, const glm::mat4& viewProjection);
+uint64_t URenderKey(RenderPass pass, GLuint program, GLuint vao, float depth);
+void USortRenderQueue(RenderQueue& queue);
+void UWriteRenderQueueData(RenderQueue& queue, const TextureTable& table, DynamicRing& ring);
+void UExecuteRenderQueue(const RenderQueue& queue, const FrameSnapshot& snapshot, GLStateCache& cache);
+void UResetStateCache(GLStateCache& cache);
+bool UCreateTexture(const char* filename, GLTexture& texture);
+void UDestroyTexture(GLTexture& texture);
+void UCreateTextureLoader();
+void UDestroyTextureLoader();
+void UPumpTextureLoads();
+void UWaitForTextureLoads();
+TextureLoadState UGetTextureLoadState(GLuint textureId);
+bool UCreateTextureTable(TextureTable& table);
+void UDestroyTextureTable(TextureTable& table);
+GLuint UAddTextureSlot(TextureTable& table, GLuint textureId);
+GLuint UTextureSlot(const TextureTable& table, GLuint textureId);
+void UUpdateTextureSlot(TextureTable& table, GLuint textureId);
+void UReserveTextureArray(TextureTable& table);
+void UCopyToTextureArray(const TextureTable& table, GLuint textureId, GLuint layer);
+void UUploadTextureTable(TextureTable& table, DynamicRing& ring);
+void UBindTextureTable(const TextureTable& table, const DynamicRing& ring);
+bool UMapFile(const string& path, MappedFile& file);
+void UUnmapFile(MappedFile& file);
+bool UBakeTextureCache(const string& filename, uint64_t sourceSize, int64_t sourceTime, vector<unsigned char>& file);
+bool UParseTextureCache(const unsigned char* data, size_t size, uint64_t sourceSize, int64_t sourceTime, TextureLoad& load, size_t& levelDataOffset);
+void URender(const FrameSnapshot& snapshot);
+void UBuildSnapshot(FrameSnapshot& snapshot, int64_t inputNs, float alpha);
+void UPublishSnapshot(SnapshotMailbox& mailbox);
+const FrameSnapshot* UTakeSnapshot(SnapshotMailbox& mailbox);
+void UApplySnapshotState(const FrameSnapshot& snapshot);
+void URenderThread();
+void UMarkThreadBusy(PipelineThread thread, bool busy);
+void UTakeThreadOverlap(int64_t busyNs[PIPELINE_THREAD_COUNT], int64_t& overlapNs);
+void UResetClock(SimulationClock& clock, int64_t nowNs);
+int UAdvanceClock(SimulationClock& clock, int64_t nowNs);
+float UClockAlpha(const SimulationClock& clock);
+void URecordFrameTime(FrameTimeHistory& history, int64_t frameNs);
+void ULogFrameTimes(const FrameTimeHistory& history, LogLevel level);
+void UWaitForSnapshotTaken(SnapshotMailbox& mailbox);
+void USimulationStep();
+bool UKeyDown(int key);
+void UPollInputKeys(GLFWwindow* window);
+bool UStartInputRecording(const string& path);
+void URecordInput(InputRecordType type, double x = 0.0, double y = 0.0);
+void UFinishInputRecording();
+bool UStartInputReplay(const string& path);
+bool UReplayInput();
+void UFinishInputReplay();
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program, GLUniformLocations& uniforms, const string& label, const char* preamble = "");
+void UDestroyShaderProgram(GLProgram& program);
+bool UCompileShaderProgram(const char* preamble, const char* vtxShaderSource, const char* fragShaderSource, GLuint programId);
+uint64_t UProgramCacheKey(const char* preamble, const char* vtxShaderSource, const char* fragShaderSource);
+const GLMaterialProgram* UGetMaterialProgram(unsigned int features);
+glm::mat3 UNormalMatrix(const glm::mat4& model);
+bool ULoadProgramBinary(uint64_t key, GLuint programId);
+void USaveProgramBinary(uint64_t key, GLuint programId);
+bool UCreateDynamicRing(DynamicRing& ring, size_t regionSize);
+void UDestroyDynamicRing(DynamicRing& ring);
+void UBeginDynamicFrame(DynamicRing& ring);
+void UEndDynamicFrame(DynamicRing& ring);
+void UGrowDynamicRing(DynamicRing& ring, size_t minimumRegionSize);
+DynamicRange UAllocateDynamic(DynamicRing& ring, size_t size, size_t alignment);
+DynamicRange UWriteDynamic(DynamicRing& ring, const void* data, size_t size, size_t alignment);
+GLintptr UDynamicOffset(const DynamicRing& ring, GLintptr offset);
+void UCreateStressLights(GLsizei count, vector<LightOrbit>& orbits);
+void UAnimateLights(const vector<LightOrbit>& orbits, int64_t timeNs, vector<PointLight>& lights);
+void UCreateLightClusters(LightClusters& clusters);
+GLuint UClusterSlice(float depth);
+void UBinLights(LightClusters& clusters, const glm::mat4& view, const glm::mat4& projection);
+void UUploadLightClusters(LightClusters& clusters, DynamicRing& ring);
+void UBindLightClusters(const LightClusters& clusters, const DynamicRing& ring);
+
+/* Material Vertex Shader Source Code*/
+// Specialized by the TEXTURED, SPECULAR, INSTANCED and PACKED_VERTICES defines (true or false) prepended by UGetMaterialProgram
+const GLchar* materialVertexShaderSource = GLSL_BODY(
+
+    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 1) in vec3 normal; // VAP position 1 for normals
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (VAP positions 3 to 6)
+layout(location = 7) in vec4 instanceColor; // Per-instance tint
+layout(location = 8) in mat3 instanceNormalMatrix; // Per-instance normal matrix (VAP positions 8 to 10)
+layout(location = 11) in uint drawIndex; // Entry of the draw in objects (set through the base instance of the indirect draw)
+
+out vec3 vertexNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+out vec2 vertexTextureCoordinate;
+out vec4 vertexColor; // For outgoing instance tint to fragment shader
+flat out vec3 vertexObjectColor; // For the draw's object color and texture slot to fragment shader
+flat out uint vertexTextureSlot;
+
+// Camera, light and projection data shared by every program, written once per frame
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+    vec3 lightPos;
+    vec3 lightColor;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+};
+
+// Per-draw data of the frame's draws, written to the dynamic ring
+struct ObjectData
+{
+    mat4 model;
+    mat3 normalMatrix; // Computed on the CPU once per object
+    vec4 color;
+    vec3 positionScale; // Maps the mesh's positions onto object space (packed ones are 0 to 1 across its bounds)
+    uint textureSlot;
+    vec3 positionOffset;
+};
+
+layout(std430) readonly buffer Objects
+{
+    ObjectData objects[];
+};
+
+// Inverse of the octahedral encoding of packed normals (UEncodeOctahedral): unfolds the lower half of the octahedron
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -fold : fold;
+    n.y += n.y >= 0.0f ? -fold : fold;
+    return normalize(n);
+}
+
+void main()
+{
+    // The feature defines are constants, so the compiler drops the unused side of each selection
+    mat4 world = INSTANCED ? instanceModel : objects[drawIndex].model;
+    mat3 worldNormal = INSTANCED ? instanceNormalMatrix : objects[drawIndex].normalMatrix;
+
+    // A packed normal has two components (z comes in as 0)
+    vec3 objectPosition = position * objects[drawIndex].positionScale + objects[drawIndex].positionOffset;
+    vec3 objectNormal = PACKED_VERTICES ? decodeOctahedral(normal.xy) : normal;
+
+    gl_Position = projection * view * world * vec4(objectPosition, 1.0f); // Transforms vertices into clip coordinates
+
+    vertexFragmentPos = vec3(world * vec4(objectPosition, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+
+    vertexNormal = worldNormal * objectNormal; // get normal vectors in world space only and exclude normal translation properties
+    vertexTextureCoordinate = textureCoordinate;
+    vertexColor = INSTANCED ? instanceColor : vec4(1.0f);
+    vertexObjectColor = objects[drawIndex].color.rgb;
+    vertexTextureSlot = objects[drawIndex].textureSlot;
+}
+);
+
+
+/* Material Fragment Shader Source Code*/
+const GLchar* materialFragmentShaderSource = GLSL_BODY(
+
+    in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in vec2 vertexTextureCoordinate;
+in vec4 vertexColor; // For incoming instance tint
+flat in vec3 vertexObjectColor; // For the incoming object color and texture slot of the draw
+flat in uint vertexTextureSlot;
+
+out vec4 fragmentColor; // For outgoing material color to the GPU
+
+// Camera, light and projection data shared by every program, written once per frame
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+    vec3 lightPos;
+    vec3 lightColor;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+};
+
+// Point lights, and the lights of each froxel of the view (clustered forward shading), binned on the CPU each frame
+struct PointLight
+{
+    vec4 positionRadius;    // World-space position, and the distance at which the light fades out
+    vec4 colorIntensity;
+};
+
+layout(std430) readonly buffer PointLights
+{
+    PointLight lights[];
+};
+
+layout(std430) readonly buffer LightClusters
+{
+    uvec2 clusterRanges[]; // First entry in lightIndices and count, per froxel (x fastest, then y, then z)
+};
+
+layout(std430) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+
+// Texture table: every texture a draw may sample, as a layer of uTextureArray or a bindless handle.
+// UGetMaterialProgram defines SAMPLE_TEXTURE and TEXTURE_SIZE for the one in use.
+struct TextureSlot
+{
+    uvec2 handle;
+    uint layer;
+    int wrapMode;
+};
+
+layout(std430) readonly buffer TextureSlots
+{
+    TextureSlot textureSlots[];
+};
+
+uniform sampler2DArray uTextureArray;
+uniform vec2 uvScale;
+
+// Wrap modes (GL enums) of the texture slots, applied here: the textures' own sampler state always repeats
+const int WRAP_MIRRORED_REPEAT = 0x8370;
+const int WRAP_CLAMP_TO_EDGE = 0x812F;
+const int WRAP_CLAMP_TO_BORDER = 0x812D;
+
+vec4 sampleTexture(uint slot, vec2 uv)
+{
+    int wrapMode = textureSlots[slot].wrapMode;
+    if (wrapMode == WRAP_MIRRORED_REPEAT)
+        uv = 1.0f - abs(mod(uv, 2.0f) - 1.0f);
+    else if (wrapMode == WRAP_CLAMP_TO_EDGE)
+        uv = clamp(uv, 0.5f / vec2(TEXTURE_SIZE(slot)), 1.0f - 0.5f / vec2(TEXTURE_SIZE(slot)));
+    else if (wrapMode == WRAP_CLAMP_TO_BORDER && (any(lessThan(uv, vec2(0.0f))) || any(greaterThan(uv, vec2(1.0f)))))
+        return vec4(1.0f, 0.0f, 1.0f, 1.0f); // Border color
+    return SAMPLE_TEXTURE(slot, uv);
+}
+
+void main()
+{
+    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+
+    //Calculate Ambient lighting*/
+    float ambientStrength = 1.0f; // Set ambient or global lighting strength
+    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+
+    //Calculate Diffuse lighting*/
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
+    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+
+    //Calculate Specular lighting*/
+    vec3 specular = vec3(0.0f);
+    float specularIntensity = 0.8f; // Set specular light strength
+    float highlightSize = 8.0f; // Set specular highlight size
+    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+    if (SPECULAR)
+    {
+        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
+        //Calculate specular component
+        float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+        specular = specularIntensity * specularComponent * lightColor;
+    }
+
+    // Point lights: only those binned into this fragment's froxel, so the cost does not grow with the light count
+    float viewDepth = -(view * vec4(vertexFragmentPos, 1.0f)).z;
+    uvec3 cell = uvec3(uvec2(gl_FragCoord.xy / clusterParams.xy * vec2(clusterGrid.xy)), uint(max(log(viewDepth) * clusterParams.z + clusterParams.w, 0.0f)));
+    cell = min(cell, clusterGrid.xyz - 1u);
+    uvec2 range = clusterRanges[(cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x];
+    vec3 pointLighting = vec3(0.0f);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        PointLight light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.positionRadius.xyz - vertexFragmentPos;
+        float distance = length(toLight);
+        vec3 direction = toLight / max(distance, 0.0001f);
+
+        // Inverse-square falloff, windowed to reach zero at the light's radius
+        float window = clamp(1.0f - pow(distance / light.positionRadius.w, 4.0f), 0.0f, 1.0f);
+        vec3 radiance = light.colorIntensity.rgb * light.colorIntensity.w * window * window / (distance * distance + 1.0f);
+
+        pointLighting += max(dot(norm, direction), 0.0f) * radiance;
+        if (SPECULAR)
+            pointLighting += specularIntensity * pow(max(dot(viewDir, reflect(-direction, norm)), 0.0f), highlightSize) * radiance;
+    }
+
+    // Texture (tinted by the object color) or the object color holds the color to be used for all three components,
+    // tinted per instance
+    vec3 baseColor = TEXTURED ? sampleTexture(vertexTextureSlot, vertexTextureCoordinate * uvScale).xyz * vertexObjectColor : vertexObjectColor;
+
+    // Calculate phong result
+    vec3 phong = (ambient + diffuse + specular + pointLighting) * baseColor * vertexColor.rgb;
+
+    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+}
+);
+
+
+/* Lamp Shader Source Code*/
+const GLchar* lampVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 11) in uint drawIndex; // Entry of the draw in objects
+
+// Camera, light and projection data shared by every program, written once per frame
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+    vec3 lightPos;
+    vec3 lightColor;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+};
+
+// Per-draw data of the frame's draws, written to the dynamic ring
+struct ObjectData
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec4 color;
+    vec3 positionScale;
+    uint textureSlot;
+    vec3 positionOffset;
+};
+
+layout(std430) readonly buffer Objects
+{
+    ObjectData objects[];
+};
+
+void main()
+{
+    vec3 objectPosition = position * objects[drawIndex].positionScale + objects[drawIndex].positionOffset;
+    gl_Position = projection * view * objects[drawIndex].model * vec4(objectPosition, 1.0f); // Transforms vertices into clip coordinates
+}
+);
+
+
+/* Fragment Shader Source Code*/
+const GLchar* lampFragmentShaderSource = GLSL(440,
+
+    out vec4 fragmentColor; // For outgoing lamp color (smaller shape) to the GPU
+
+void main()
+{
+    fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
+}
+);
+
+
+/* Texture Copy Shader Source Code*/
+// One triangle covering the viewport, with texture coordinates 0 to 1 across it
+const GLchar* textureCopyVertexShaderSource = GLSL(440,
+
+    out vec2 vertexTextureCoordinate;
+
+void main()
+{
+    vec2 corner = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)); // (0, 0), (4, 0) and (0, 4)
+    vertexTextureCoordinate = corner * 0.5f;
+    gl_Position = vec4(corner - 1.0f, 0.0f, 1.0f);
+}
+);
+
+
+// Resamples uSource into the bound texture array layer
+const GLchar* textureCopyFragmentShaderSource = GLSL(440,
+
+    in vec2 vertexTextureCoordinate;
+
+out vec4 fragmentColor;
+
+uniform sampler2D uSource;
+
+void main()
+{
+    fragmentColor = vec4(texture(uSource, vertexTextureCoordinate).rgb, 1.0f);
+}
+);
+
+
+// Program of the glUniform upload microbenchmark: plain uniforms, as the shaders had before the FrameData block
+const GLchar* microbenchVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+}
+);
+
+
+const GLchar* microbenchFragmentShaderSource = GLSL(440,
+
+    out vec4 fragmentColor;
+
+uniform vec3 objectColor;
+
+void main()
+{
+    fragmentColor = vec4(objectColor, 1.0f);
+}
+);
+
+
+// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
+void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+    for (int j = 0; j < height / 2; ++j)
+    {
+        int index1 = j * width * channels;
+        int index2 = (height - 1 - j) * width * channels;
+
+        for (int i = width * channels; i > 0; --i)
+        {
+            unsigned char tmp = image[index1];
+            image[index1] = image[index2];
+            image[index2] = tmp;
+            ++index1;
+            ++index2;
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    gStartTimeNs = UProfileNow();
+    ULogStart();
+
+    if (!UParseCommandLine(argc, argv))
+        return EXIT_FAILURE;
+
+    if (gBenchmarkMode ? !UInitializeHeadless() : !UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
+
+    // Create the mesh
+    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+
+    // Load the model given on the command line
+    if (!gModelPath.empty() && !ULoadModel(gModelPath, gModelMesh))
+        return EXIT_FAILURE;
+
+    // Create the bottle copies of the instancing stress scene
+    if (gInstanceCount > 0)
+    {
+        UCreateStressInstances(gInstanceCount, gInstances);
+        UCreateInstanceBuffer(gMesh, gInstances, gInstanceBuffer);
+    }
+
+    // Place the objects in the scene and build its bounding volume hierarchy for culling
+    UCreateScene(gMesh, gModelMesh, gInstances, gScene);
+
+    // Create the shader programs
+    GLint programBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &programBinaryFormats);
+    if (gUseProgramCache && programBinaryFormats == 0)
+    {
+        LogMessage(LOG_WARNING) << "The driver supports no program binary formats; shader cache disabled";
+        gUseProgramCache = false;
+    }
+
+    const int64_t shaderStartNs = UProfileNow();
+    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId, gLampUniforms, "lamp program"))
+        return EXIT_FAILURE;
+
+    // The material variants sample through the texture table: choose bindless handles or the texture array first
+    if (!UCreateTextureTable(gTextureTable))
+        return EXIT_FAILURE;
+
+    // Build the material variants the scene uses up front, so a broken shader still fails at startup
+    if (!UGetMaterialProgram(MATERIAL_TEXTURED | MATERIAL_SPECULAR))
+        return EXIT_FAILURE;
+
+    if (gInstanceCount > 0 && gUseInstancing && !UGetMaterialProgram(MATERIAL_TEXTURED | MATERIAL_SPECULAR | MATERIAL_INSTANCED))
+        return EXIT_FAILURE;
+
+    if (gModelMesh.vao && !UGetMaterialProgram(MATERIAL_SPECULAR))
+        return EXIT_FAILURE;
+
+    LogMessage(LOG_INFO) << "Shader programs ready in " << (UProfileNow() - shaderStartNs) / 1.0e6 << " ms (" << gProgramCacheHits << " cache hits, "
+        << gProgramCacheMisses << " misses)";
+
+    // Create the persistently mapped buffer for the per-frame data
+    if (!UCreateDynamicRing(gDynamicRing, DYNAMIC_RING_REGION_SIZE))
+        return EXIT_FAILURE;
+
+    // Size the froxel grid, and create the point lights of the light stress test
+    UCreateLightClusters(gLightClusters);
+    if (gLightCount > 0)
+        UCreateStressLights(gLightCount, gLightOrbits);
+
+    // Create the GPU queries of the frame profiler
+    UCreateProfiler();
+
+    // Load texture: the images are decoded in the background and replace a placeholder once uploaded
+    UCreateTextureLoader();
+    const char* texFilename = "resources/textures/NeonPinkPlastic.jpg";
+    if (!UCreateTexture(texFilename, gTextureIdPink))
+    {
+        LogMessage(LOG_ERROR) << "Failed to load texture " << texFilename;
+        return EXIT_FAILURE;
+    }
+    texFilename = "resources/textures/granite.jpg";
+    if (!UCreateTexture(texFilename, gTextureIdGranite))
+    {
+        LogMessage(LOG_ERROR) << "Failed to load texture " << texFilename;
+        return EXIT_FAILURE;
+    }
+
+    // Model textures: an image that cannot be read leaves its objects untextured
+    for (GLMaterial& material : gModelMesh.materials)
+    {
+        const string modelTexture = UDirectoryOf(gModelPath) + material.texture;
+        if (!material.texture.empty() && !UCreateTexture(modelTexture.c_str(), material.textureId))
+        {
+            LogMessage(LOG_WARNING) << "Failed to load texture " << modelTexture << "; its objects are drawn untextured";
+        }
+    }
+
+    // Sets the background color of the window to black (it will be implicitely used by glClear)
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Enable z-depth (nothing turns it off again)
+    glEnable(GL_DEPTH_TEST);
+
+    // Headless benchmark: render the scripted camera path offscreen (or time the CPU-side hot paths, or check
+    // the regression poses) instead of running the interactive loop
+    bool benchmarkPassed = true;
+    if (gBenchmarkMode)
+        benchmarkPassed = gMicrobenchMode ? URunMicrobenchmarks() : gRegressionMode ? URunRegression() : URunBenchmark();
+
+    // Record the session's input, or replay a recording in place of the window's input
+    if (!gRecordInputPath.empty() && !UStartInputRecording(gRecordInputPath))
+        return EXIT_FAILURE;
+    if (!gReplayInputPath.empty() && !UStartInputReplay(gReplayInputPath))
+        return EXIT_FAILURE;
+
+    // Hand the GL context to the render thread; the main thread keeps the window, input and simulation
+    if (!gBenchmarkMode)
+    {
+        gSnapshots.writing = 0;
+        gSnapshots.latest = 1;
+        gSnapshots.reading = 2;
+        glfwMakeContextCurrent(NULL);
+        gRenderThread = std::thread(URenderThread);
+    }
+
+    // Frame scheduler statistics, reported once per second
+    int64_t schedulerStartNs = UProfileNow();
+    GLuint schedulerSteps = 0;
+    GLuint schedulerFrames = 0;
+    int64_t schedulerIdleNs = 0;
+    bool idle = false;                      // The last iteration published nothing
+    glm::vec3 publishedCameraPosition = gCamera.Position;
+    UResetClock(gClock, schedulerStartNs);
+
+    // simulation loop
+    // ---------------
+    while (!gBenchmarkMode && !glfwWindowShouldClose(gWindow))
+    {
+        // Replay: the recorded input goes through the same handlers at the same steps, and every recorded frame
+        // is drawn, as fast as the render thread draws them
+        if (gInputReplay.active)
+        {
+            glfwPollEvents();
+            UWaitForSnapshotTaken(gSnapshots);
+            UMarkThreadBusy(PIPELINE_MAIN_THREAD, true);
+            if (!UReplayInput())
+                glfwSetWindowShouldClose(gWindow, true);
+            UMarkThreadBusy(PIPELINE_MAIN_THREAD, false);
+            continue;
+        }
+
+        // Sleep until input arrives (keys pressed/released, mouse moved etc.): at most SIMULATION_INTERVAL while
+        // frames are being published, so held keys keep moving the camera smoothly, IDLE_WAIT_INTERVAL otherwise
+        const int64_t waitStartNs = UProfileNow();
+        glfwWaitEventsTimeout(idle ? IDLE_WAIT_INTERVAL : SIMULATION_INTERVAL);
+        const int64_t inputNs = UProfileNow();
+        UMarkThreadBusy(PIPELINE_MAIN_THREAD, true);
+        ProfileMark simulationMark = UProfileBegin("Simulation", false);
+
+        // Nothing was simulated while idle: a key press ending the wait gets one step at once, not the whole wait's
+        if (idle)
+        {
+            schedulerIdleNs += inputNs - waitStartNs;
+            UResetClock(gClock, inputNs - gClock.stepNs);
+        }
+
+        // fixed-timestep simulation
+        // -------------------------
+        const int steps = UAdvanceClock(gClock, inputNs);
+        for (int step = 0; step < steps; ++step)
+        {
+            UPollInputKeys(gWindow);
+            USimulationStep();
+        }
+        schedulerSteps += steps;
+
+        // Frames show the state between the last two steps, so motion is smooth at any frame rate. Drawing
+        // goes on until the interpolated camera has caught up with the last step.
+        const float alpha = UClockAlpha(gClock);
+        const glm::vec3 cameraPosition = glm::mix(gPreviousCameraPosition, gCamera.Position, alpha);
+        if (cameraPosition != publishedCameraPosition)
+            gFrameDirty = true;
+
+        // Hand this state over to the render thread, unless it would draw the same frame again
+        if (gRedrawRequested.exchange(false))
+            gFrameDirty = true;
+        const bool animating = gLightCount > 0;
+        idle = !gFrameDirty && !animating && !gContinuousRendering;
+        if (!idle)
+        {
+            UBuildSnapshot(gSnapshots.buffers[gSnapshots.writing], inputNs, alpha);
+            UPublishSnapshot(gSnapshots);
+            gFrameDirty = false;
+            publishedCameraPosition = cameraPosition;
+            ++schedulerFrames;
+            URecordInput(INPUT_RECORD_FRAME, alpha);
+        }
+
+        // How many simulation steps became frames, and how long the main thread slept with nothing to draw
+        if (inputNs - schedulerStartNs >= 1000000000)
+        {
+            LogMessage(LOG_DEBUG) << "Frame scheduler (" << (gContinuousRendering ? "continuous" : "on demand") << "): "
+                << schedulerFrames << " frames for " << schedulerSteps << " simulation steps, idle "
+                << 100.0 * schedulerIdleNs / (inputNs - schedulerStartNs) << "% of the time, "
+                << gClock.droppedNs / 1.0e6 << " ms dropped behind";
+            schedulerStartNs = inputNs;
+            schedulerSteps = 0;
+            schedulerFrames = 0;
+            schedulerIdleNs = 0;
+        }
+
+        UProfileEnd(simulationMark);
+        UMarkThreadBusy(PIPELINE_MAIN_THREAD, false);
+    }
+
+    UFinishInputRecording();
+    UFinishInputReplay();
+
+    // Stop the render thread and take the GL context back to release the GL objects
+    if (!gBenchmarkMode)
+    {
+        {
+            std::lock_guard<std::mutex> lock(gSnapshots.mutex);
+            gSnapshots.stopping = true;
+        }
+        gSnapshots.published.notify_one();
+        gRenderThread.join();
+        glfwMakeContextCurrent(gWindow);
+    }
+
+    // Release mesh data
+    UDestroyMesh(gMesh);
+    if (gModelMesh.vao)
+        UDestroyMesh(gModelMesh);
+    if (gInstanceCount > 0)
+        UDestroyInstanceBuffer(gInstanceBuffer);
+
+    // Release texture (the bindless handles first: a resident handle keeps its texture alive)
+    UDestroyTextureLoader();
+    UDestroyTextureTable(gTextureTable);
+    UDestroyTexture(gTextureIdPink);
+    UDestroyTexture(gTextureIdGranite);
+    for (GLMaterial& material : gModelMesh.materials)
+        UDestroyTexture(material.textureId);
+
+    // Release shader programs
+    for (GLMaterialProgram& variant : gMaterialPrograms)
+        UDestroyShaderProgram(variant.programId);
+    UDestroyShaderProgram(gLampProgramId);
+
+    // Release the per-frame data buffer
+    UDestroyDynamicRing(gDynamicRing);
+
+    // Release the profiler queries
+    UDestroyProfiler();
+
+    // Everything is released now: whatever the registry still lists has leaked
+    UReportLiveResources();
+
+    if (gBenchmarkMode)
+    {
+        UDestroyHeadless();
+        exit(benchmarkPassed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS); // Terminates the program successfully
+}
+
+
+// Render thread: owns the GL context while the window is open. Draws the newest snapshot, presents it and
+// reports the rendering statistics; it only sleeps when the main thread has published nothing new, or to
+// keep to --fps-cap.
+void URenderThread()
+{
+    glfwMakeContextCurrent(gWindow);
+
+    // The swap interval belongs to the context, so it is set by the thread presenting
+    int swapInterval = gVsyncMode == VSYNC_OFF ? 0 : 1;
+    if (gVsyncMode == VSYNC_ADAPTIVE)
+    {
+        if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+            swapInterval = -1;
+        else
+            LogMessage(LOG_WARNING) << "Adaptive vsync needs EXT_swap_control_tear; using --vsync on";
+    }
+    glfwSwapInterval(swapInterval);
+
+    // Stress scene and pipeline statistics, reported once per second
+    int64_t statsStartNs = UProfileNow();
+    GLuint statsFrames = 0;
+    int64_t latencySumNs = 0;
+    int64_t latencyMaxNs = 0;
+    uint64_t statsReplaced = 0;
+    double statsUploadBytes = 0.0;
+    double statsFenceWaitMs = 0.0;
+    bool firstFrame = true;
+    static FrameTimeHistory frameTimes;     // Too large for the stack
+
+    // render loop
+    // -----------
+    while (const FrameSnapshot* snapshot = UTakeSnapshot(gSnapshots))
+    {
+        const int64_t frameStartNs = UProfileNow();
+        UMarkThreadBusy(PIPELINE_RENDER_THREAD, true);
+        UProfileBeginFrame();
+        ProfileMark frameMark = UProfileBegin("Frame", false);
+
+        // Upload the textures that finished decoding
+        UPumpTextureLoads();
+
+        // Render this frame
+        UApplySnapshotState(*snapshot);
+        URender(*snapshot);
+
+        // glfw: swap buffers
+        ProfileMark swapMark = UProfileBegin("glfwSwapBuffers", false);
+        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+        UProfileEnd(swapMark);
+
+        // Input-to-present latency: from sampling the input to handing the frame showing it to the display
+        const int64_t latencyNs = UProfileNow() - snapshot->inputNs;
+        latencySumNs += latencyNs;
+        latencyMaxNs = std::max(latencyMaxNs, latencyNs);
+
+        if (snapshot->writeTrace)
+            UWriteChromeTrace(gTraceOutput);
+
+        UProfileEnd(frameMark);
+        UMarkThreadBusy(PIPELINE_RENDER_THREAD, false);
+        URecordFrameTime(frameTimes, UProfileNow() - frameStartNs);
+
+        // Textures still loading are only uploaded by frames: ask the (maybe idle) main thread for another one
+        if (gTexturesPending)
+        {
+            gRedrawRequested = true;
+            glfwPostEmptyEvent();
+        }
+        statsUploadBytes += double(gFrameStats.uploadBytes);
+        statsFenceWaitMs += gFrameStats.fenceWaitMs;
+
+        if (statsFrames == 0 && firstFrame)
+        {
+            LogMessage(LOG_INFO) << "Time to first frame: " << (UProfileNow() - gStartTimeNs) / 1.0e6 << " ms";
+            firstFrame = false;
+        }
+
+        // Report draw calls (and light binning) against frame time so the stress scenes can be charted
+        ++statsFrames;
+        const int64_t statsNowNs = UProfileNow();
+        if (statsNowNs - statsStartNs >= 1000000000)
+        {
+            // Frame time is the render thread's busy time per frame: with on-demand rendering the interval also
+            // holds the time it slept with nothing to draw
+            int64_t busyNs[PIPELINE_THREAD_COUNT];
+            int64_t overlapNs = 0;
+            UTakeThreadOverlap(busyNs, overlapNs);
+            const double frameMs = busyNs[PIPELINE_RENDER_THREAD] / 1.0e6 / statsFrames;
+
+            if (gInstanceCount > 0)
+                LogMessage(LOG_INFO) << gInstanceCount << " instances (" << (gUseInstancing ? "instanced" : "one draw per copy")
+                    << "), draw calls: " << gFrameStats.drawCalls << " (" << gFrameStats.drawCommands << " draws merged), state changes: " << gFrameStats.stateChanges
+                    << " (" << gFrameStats.redundantStateChanges << " redundant skipped), visible objects: " << gFrameStats.visibleObjects
+                    << " of " << gFrameStats.sceneObjects << " (culling " << gFrameStats.cullMs << " ms)"
+                    << ", frame time: " << frameMs << " ms";
+            if (gLightCount > 0)
+                LogMessage(LOG_INFO) << gLightCount << " point lights, light-froxel overlaps: " << gFrameStats.lightAssignments
+                    << " (at most " << gFrameStats.maxClusterLights << " lights per froxel), binning " << gFrameStats.lightBinMs
+                    << " ms, frame time: " << frameMs << " ms";
+
+            // How long input takes to reach the display, and how much the two threads ran in parallel
+            const double intervalNs = double(statsNowNs - statsStartNs);
+            const uint64_t replaced = gSnapshots.replaced.load(std::memory_order_relaxed);
+            LogMessage(gInstanceCount > 0 || gLightCount > 0 ? LOG_INFO : LOG_DEBUG) << "Pipeline: " << statsFrames
+                << " frames, input-to-present latency " << latencySumNs / 1.0e6 / statsFrames << " ms (max " << latencyMaxNs / 1.0e6
+                << " ms), busy: main thread " << 100.0 * busyNs[PIPELINE_MAIN_THREAD] / intervalNs << "%, render thread "
+                << 100.0 * busyNs[PIPELINE_RENDER_THREAD] / intervalNs << "%, both " << 100.0 * overlapNs / intervalNs
+                << "%, snapshots replaced unseen: " << replaced - statsReplaced;
+
+            // Live GPU objects and memory: stays flat unless something is created every frame without being released
+            ULogResources(gInstanceCount > 0 || gLightCount > 0 ? LOG_INFO : LOG_DEBUG);
+            LogMessage(gInstanceCount > 0 || gLightCount > 0 ? LOG_INFO : LOG_DEBUG) << "Dynamic data: "
+                << statsUploadBytes / 1.0e6 / (intervalNs / 1.0e9) << " MB/s written to the persistently mapped ring ("
+                << statsUploadBytes / 1024.0 / statsFrames << " KB per frame), fence waits " << statsFenceWaitMs << " ms";
+            ULogFrameTimes(frameTimes, gInstanceCount > 0 || gLightCount > 0 ? LOG_INFO : LOG_DEBUG);
+
+            statsStartNs = statsNowNs;
+            statsFrames = 0;
+            latencySumNs = 0;
+            latencyMaxNs = 0;
+            statsReplaced = replaced;
+            statsUploadBytes = 0.0;
+            statsFenceWaitMs = 0.0;
+        }
+
+        // Hold the next frame back until its slot under the cap. A late frame does not make the next ones hurry.
+        if (gFpsCap > 0)
+        {
+            const int64_t remainingNs = frameStartNs + 1000000000 / gFpsCap - UProfileNow();
+            if (remainingNs > 0)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(remainingNs));
+        }
+    }
+
+    // Hand the context back to the main thread for the cleanup
+    glfwMakeContextCurrent(NULL);
+}
+
+
+// Captures the state URender needs, as the main thread's input and simulation left it. Stepped state is
+// interpolated alpha of the way from the previous step to the last one.
+void UBuildSnapshot(FrameSnapshot& snapshot, int64_t inputNs, float alpha)
+{
+    static uint64_t frame = 0;
+
+    Camera camera = gCamera;
+    camera.Position = glm::mix(gPreviousCameraPosition, gCamera.Position, alpha);
+
+    snapshot.frame = frame++;
+    snapshot.inputNs = inputNs;
+    snapshot.view = camera.GetViewMatrix();
+    snapshot.cameraPosition = camera.Position;
+    snapshot.cameraZoom = gCamera.Zoom;
+    snapshot.uvScale = gUVScale;
+    snapshot.texWrapMode = gTexWrapMode;
+    snapshot.animationNs = gClock.timeNs - gClock.stepNs + int64_t(alpha * gClock.stepNs);
+    snapshot.viewportWidth = gViewportWidth;
+    snapshot.viewportHeight = gViewportHeight;
+    snapshot.writeTrace = gWriteTraceRequested;
+    gWriteTraceRequested = false;
+}
+
+
+// Publishes the snapshot in the main thread's buffer and takes the previous latest buffer to fill next.
+// If the render thread never took that one, it is dropped (and counted): only the newest state matters.
+void UPublishSnapshot(SnapshotMailbox& mailbox)
+{
+    uint32_t previous = mailbox.latest.exchange(mailbox.writing | SNAPSHOT_NEW, std::memory_order_acq_rel);
+    if (previous & SNAPSHOT_NEW)
+    {
+        mailbox.replaced.fetch_add(1, std::memory_order_relaxed);
+        // The previous snapshot is thrown away; a trace request it carried moves on to the next one
+        if (mailbox.buffers[previous & ~SNAPSHOT_NEW].writeTrace)
+            gWriteTraceRequested = true;
+    }
+    mailbox.writing = previous & ~SNAPSHOT_NEW;
+
+    // Lock (and release) the mutex so the render thread cannot miss the wake-up between its check and its wait
+    {
+        std::lock_guard<std::mutex> lock(mailbox.mutex);
+    }
+    mailbox.published.notify_one();
+}
+
+
+// Waits for a snapshot newer than the last one taken and returns it, or nullptr once the render thread
+// should stop. The snapshot stays valid until the next call.
+const FrameSnapshot* UTakeSnapshot(SnapshotMailbox& mailbox)
+{
+    {
+        std::unique_lock<std::mutex> lock(mailbox.mutex);
+        mailbox.published.wait(lock, [&mailbox]()
+        {
+            return (mailbox.latest.load(std::memory_order_acquire) & SNAPSHOT_NEW) || mailbox.stopping.load();
+        });
+    }
+    if (mailbox.stopping.load())
+        return nullptr;
+
+    mailbox.reading = mailbox.latest.exchange(mailbox.reading, std::memory_order_acq_rel) & ~SNAPSHOT_NEW;
+    {
+        std::lock_guard<std::mutex> lock(mailbox.mutex);
+    }
+    mailbox.taken.notify_one();
+    return &mailbox.buffers[mailbox.reading];
+}
+
+
+// Applies the GL state the main thread changed through the snapshot (it must not make GL calls itself)
+void UApplySnapshotState(const FrameSnapshot& snapshot)
+{
+    static int viewportWidth = 0;
+    static int viewportHeight = 0;
+    if (snapshot.viewportWidth != viewportWidth || snapshot.viewportHeight != viewportHeight)
+    {
+        glViewport(0, 0, snapshot.viewportWidth, snapshot.viewportHeight);
+        viewportWidth = snapshot.viewportWidth;
+        viewportHeight = snapshot.viewportHeight;
+    }
+
+    // The shaders apply the wrap mode (with a magenta border color), so it is only stored in the pink texture's slot
+    gTextureTable.slots[UTextureSlot(gTextureTable, gTextureIdPink)].wrapMode = snapshot.texWrapMode;
+}
+
+
+// Starts or ends a busy interval of a pipeline thread, accumulating busy time and the time both threads were busy
+void UMarkThreadBusy(PipelineThread thread, bool busy)
+{
+    std::lock_guard<std::mutex> lock(gThreadOverlap.mutex);
+    const int64_t now = UProfileNow();
+    if (gThreadOverlap.busyThreads == PIPELINE_THREAD_COUNT)
+        gThreadOverlap.overlapNs += now - gThreadOverlap.changedNs;
+    gThreadOverlap.changedNs = now;
+
+    gThreadOverlap.busy[thread] = busy;
+    if (busy)
+    {
+        ++gThreadOverlap.busyThreads;
+        gThreadOverlap.startNs[thread] = now;
+    }
+    else
+    {
+        --gThreadOverlap.busyThreads;
+        gThreadOverlap.busyNs[thread] += now - gThreadOverlap.startNs[thread];
+    }
+}
+
+
+// Returns the busy and overlapping time since the previous call, and starts counting again
+void UTakeThreadOverlap(int64_t busyNs[PIPELINE_THREAD_COUNT], int64_t& overlapNs)
+{
+    std::lock_guard<std::mutex> lock(gThreadOverlap.mutex);
+    const int64_t now = UProfileNow();
+
+    // Count the intervals still running up to now
+    if (gThreadOverlap.busyThreads == PIPELINE_THREAD_COUNT)
+        gThreadOverlap.overlapNs += now - gThreadOverlap.changedNs;
+    gThreadOverlap.changedNs = now;
+
+    for (int thread = 0; thread < PIPELINE_THREAD_COUNT; ++thread)
+    {
+        if (gThreadOverlap.busy[thread])
+        {
+            gThreadOverlap.busyNs[thread] += now - gThreadOverlap.startNs[thread];
+            gThreadOverlap.startNs[thread] = now;
+        }
+        busyNs[thread] = gThreadOverlap.busyNs[thread];
+        gThreadOverlap.busyNs[thread] = 0;
+    }
+    overlapNs = gThreadOverlap.overlapNs;
+    gThreadOverlap.overlapNs = 0;
+}
+
+
+// Restarts the clock at nowNs without simulating the time since it last advanced (the simulated time stays)
+void UResetClock(SimulationClock& clock, int64_t nowNs)
+{
+    clock.lastNs = nowNs;
+    clock.accumulatorNs = 0;
+}
+
+
+// Adds the time elapsed up to nowNs and returns how many whole steps are due; the caller runs them and
+// advances timeNs by stepNs for each. What is left over is the next steps' share, and UClockAlpha's.
+int UAdvanceClock(SimulationClock& clock, int64_t nowNs)
+{
+    clock.accumulatorNs += nowNs - clock.lastNs;
+    clock.lastNs = nowNs;
+
+    int64_t steps = clock.accumulatorNs / clock.stepNs;
+    if (steps > MAX_SIMULATION_STEPS)
+    {
+        clock.droppedNs += (steps - MAX_SIMULATION_STEPS) * clock.stepNs;
+        steps = MAX_SIMULATION_STEPS;
+    }
+    clock.accumulatorNs -= (clock.accumulatorNs / clock.stepNs) * clock.stepNs;
+    return int(steps);
+}
+
+
+// How far the time not simulated yet is into the next step, from 0 to 1
+float UClockAlpha(const SimulationClock& clock)
+{
+    return float(clock.accumulatorNs) / float(clock.stepNs);
+}
+
+
+void URecordFrameTime(FrameTimeHistory& history, int64_t frameNs)
+{
+    history.frameNs[history.count % FRAME_HISTORY_SIZE] = frameNs;
+    ++history.count;
+}
+
+
+// Logs the average, percentiles, worst and standard deviation of the frame times in the history
+void ULogFrameTimes(const FrameTimeHistory& history, LogLevel level)
+{
+    const size_t count = std::min(history.count, FRAME_HISTORY_SIZE);
+    if (count == 0)
+        return;
+
+    vector<int64_t> values(history.frameNs, history.frameNs + count);
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    for (int64_t value : values)
+        sum += double(value);
+    const double average = sum / count;
+    double variance = 0.0;
+    for (int64_t value : values)
+        variance += (value - average) * (value - average);
+
+    auto percentile = [&values](double p) { return values[size_t(ceil(p * values.size())) - 1] / 1.0e6; };
+
+    LogMessage(level) << "Frame times (last " << count << " frames): avg " << average / 1.0e6 << " ms, p50 " << percentile(0.5)
+        << " ms, p95 " << percentile(0.95) << " ms, p99 " << percentile(0.99) << " ms, max " << values.back() / 1.0e6
+        << " ms, std dev " << sqrt(variance / count) / 1.0e6 << " ms";
+}
+
+
+// Waits until the render thread has taken the last published snapshot (or is stopping), so the next one
+// cannot replace it unseen
+void UWaitForSnapshotTaken(SnapshotMailbox& mailbox)
+{
+    std::unique_lock<std::mutex> lock(mailbox.mutex);
+    mailbox.taken.wait(lock, [&mailbox]()
+    {
+        return !(mailbox.latest.load(std::memory_order_acquire) & SNAPSHOT_NEW) || mailbox.stopping.load();
+    });
+}
+
+
+// Runs one fixed simulation step with the current key state
+void USimulationStep()
+{
+    gPreviousCameraPosition = gCamera.Position;
+    UProcessInput(gWindow);
+    gClock.timeNs += gClock.stepNs;
+}
+
+
+// Whether a key of RECORDED_KEYS is down in the current key state
+bool UKeyDown(int key)
+{
+    for (size_t i = 0; i < sizeof(RECORDED_KEYS) / sizeof(RECORDED_KEYS[0]); ++i)
+        if (RECORDED_KEYS[i] == key)
+            return (gInputKeys & (1u << i)) != 0;
+    return false;
+}
+
+
+// Polls the key state of the next step from the window, recording it when it changed
+void UPollInputKeys(GLFWwindow* window)
+{
+    uint32_t keys = 0;
+    for (size_t i = 0; i < sizeof(RECORDED_KEYS) / sizeof(RECORDED_KEYS[0]); ++i)
+        if (glfwGetKey(window, RECORDED_KEYS[i]) == GLFW_PRESS)
+            keys |= 1u << i;
+
+    if (keys != gInputKeys)
+    {
+        gInputKeys = keys;
+        URecordInput(INPUT_RECORD_KEYS, keys);
+    }
+}
+
+
+bool UStartInputRecording(const string& path)
+{
+    InputRecorder& recorder = gInputRecorder;
+    recorder.file.open(path, std::ios::binary);
+    if (!recorder.file)
+    {
+        LogMessage(LOG_ERROR) << "Failed to create input recording " << path;
+        return false;
+    }
+
+    InputFileHeader header = {};
+    memcpy(header.magic, INPUT_FILE_MAGIC, sizeof(header.magic));
+    header.version = INPUT_FILE_VERSION;
+    header.width = gViewportWidth;
+    header.height = gViewportHeight;
+    header.stepNs = gClock.stepNs;
+    recorder.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    recorder.path = path;
+    recorder.lastStep = 0;
+    recorder.records = 0;
+
+    LogMessage(LOG_INFO) << "Recording input to " << path;
+    return true;
+}
+
+
+// Appends a record at the current simulation step, if recording (see InputRecordType for x and y)
+void URecordInput(InputRecordType type, double x, double y)
+{
+    InputRecorder& recorder = gInputRecorder;
+    if (!recorder.file.is_open())
+        return;
+
+    unsigned char record[32];
+    size_t size = 0;
+    const uint64_t step = uint64_t(gClock.timeNs / gClock.stepNs);
+    uint64_t delta = step - recorder.lastStep;
+    for (; delta >= 0x80; delta >>= 7)
+        record[size++] = (unsigned char)(delta & 0x7f) | 0x80;
+    record[size++] = (unsigned char)delta;
+    record[size++] = (unsigned char)type;
+    recorder.lastStep = step;
+
+    auto append = [&record, &size](const void* data, size_t bytes)
+    {
+        memcpy(record + size, data, bytes);
+        size += bytes;
+    };
+    if (type == INPUT_RECORD_KEYS)
+    {
+        const uint32_t keys = uint32_t(x);
+        append(&keys, sizeof(keys));
+    }
+    else if (type == INPUT_RECORD_CURSOR)
+    {
+        append(&x, sizeof(x));
+        append(&y, sizeof(y));
+    }
+    else if (type == INPUT_RECORD_SCROLL)
+    {
+        const float offset = float(y);
+        append(&offset, sizeof(offset));
+    }
+    else if (type == INPUT_RECORD_RESIZE)
+    {
+        const int32_t framebufferSize[2] = { int32_t(x), int32_t(y) };
+        append(framebufferSize, sizeof(framebufferSize));
+    }
+    else if (type == INPUT_RECORD_FRAME)
+    {
+        const float alpha = float(x);
+        append(&alpha, sizeof(alpha));
+    }
+
+    recorder.file.write(reinterpret_cast<const char*>(record), std::streamsize(size));
+    ++recorder.records;
+}
+
+
+// Ends the recording with an INPUT_RECORD_END at the last step, so a replay runs the same number of steps
+void UFinishInputRecording()
+{
+    InputRecorder& recorder = gInputRecorder;
+    if (!recorder.file.is_open())
+        return;
+
+    URecordInput(INPUT_RECORD_END);
+    const std::streamoff size = recorder.file.tellp();
+    recorder.file.close();
+    if (!recorder.file)
+        LogMessage(LOG_ERROR) << "Failed to write input recording " << recorder.path;
+    else
+        LogMessage(LOG_INFO) << "Recorded " << recorder.records << " input records over " << recorder.lastStep
+            << " simulation steps to " << recorder.path << " (" << size / 1024.0 << " KB)";
+}
+
+
+// Loads a recording and puts it in charge of the input: the window's input callbacks are removed, and the
+// viewport takes the recorded framebuffer size. Textures are loaded first, so the replayed frames do not
+// depend on how fast they load.
+bool UStartInputReplay(const string& path)
+{
+    string contents;
+    if (!UReadFile(path, contents))
+    {
+        LogMessage(LOG_ERROR) << "Failed to read input recording " << path;
+        return false;
+    }
+
+    InputFileHeader header = {};
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(contents.data());
+    const size_t size = contents.size();
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, INPUT_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != INPUT_FILE_VERSION)
+    {
+        LogMessage(LOG_ERROR) << path << " is not an input recording (or was made by another version)";
+        return false;
+    }
+    if (header.stepNs != gClock.stepNs)
+    {
+        LogMessage(LOG_ERROR) << path << " was recorded with " << header.stepNs << " ns simulation steps, not " << gClock.stepNs;
+        return false;
+    }
+
+    InputReplay& replay = gInputReplay;
+    replay.records.clear();
+    uint64_t step = 0;
+    size_t offset = sizeof(header);
+    bool ended = false;
+    while (offset < size && !ended)
+    {
+        uint64_t delta = 0;
+        int shift = 0;
+        while (offset < size && shift < 64 && (data[offset] & 0x80))
+        {
+            delta |= uint64_t(data[offset++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (offset + 2 > size || shift >= 64)
+            break;
+        delta |= uint64_t(data[offset++]) << shift;
+        const unsigned type = data[offset++];
+        if (type >= INPUT_RECORD_TYPE_COUNT || offset + INPUT_RECORD_PAYLOAD[type] > size)
+            break;
+
+        InputRecord record = { InputRecordType(type), step += delta, 0.0, 0.0 };
+        const unsigned char* payload = data + offset;
+        offset += INPUT_RECORD_PAYLOAD[type];
+        if (type == INPUT_RECORD_KEYS)
+        {
+            uint32_t keys;
+            memcpy(&keys, payload, sizeof(keys));
+            record.x = keys;
+        }
+        else if (type == INPUT_RECORD_CURSOR)
+        {
+            memcpy(&record.x, payload, sizeof(record.x));
+            memcpy(&record.y, payload + sizeof(record.x), sizeof(record.y));
+        }
+        else if (type == INPUT_RECORD_SCROLL || type == INPUT_RECORD_FRAME)
+        {
+            float value;
+            memcpy(&value, payload, sizeof(value));
+            (type == INPUT_RECORD_SCROLL ? record.y : record.x) = value;
+        }
+        else if (type == INPUT_RECORD_RESIZE)
+        {
+            int32_t framebufferSize[2];
+            memcpy(framebufferSize, payload, sizeof(framebufferSize));
+            record.x = framebufferSize[0];
+            record.y = framebufferSize[1];
+        }
+        ended = type == INPUT_RECORD_END;
+        replay.records.push_back(record);
+    }
+    if (!ended)
+    {
+        LogMessage(LOG_ERROR) << "Input recording " << path << " is truncated or damaged after " << replay.records.size() << " records";
+        return false;
+    }
+
+    // From here on only the recording moves the camera or resizes the viewport
+    glfwSetFramebufferSizeCallback(gWindow, NULL);
+    glfwSetCursorPosCallback(gWindow, NULL);
+    glfwSetScrollCallback(gWindow, NULL);
+    int width = 0;
+    int height = 0;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    if (width != header.width || height != header.height)
+        LogMessage(LOG_WARNING) << "Replaying a " << header.width << "x" << header.height << " recording in a "
+            << width << "x" << height << " framebuffer";
+    UResizeWindow(gWindow, header.width, header.height);
+
+    UWaitForTextureLoads();
+
+    replay.active = true;
+    replay.next = 0;
+    replay.frames = 0;
+    replay.startNs = UProfileNow();
+    LogMessage(LOG_INFO) << "Replaying " << replay.records.size() << " input records over " << step << " simulation steps from " << path;
+    return true;
+}
+
+
+// Feeds the recording through the input handlers and runs the simulation steps up to its next frame, which
+// it publishes. Returns false once the recording ended.
+bool UReplayInput()
+{
+    InputReplay& replay = gInputReplay;
+    while (replay.next < replay.records.size())
+    {
+        const InputRecord& record = replay.records[replay.next];
+        if (record.step > uint64_t(gClock.timeNs / gClock.stepNs))
+        {
+            USimulationStep();
+            continue;
+        }
+
+        ++replay.next;
+        switch (record.type)
+        {
+        case INPUT_RECORD_KEYS:
+            gInputKeys = uint32_t(record.x);
+            break;
+        case INPUT_RECORD_CURSOR:
+            UMousePositionCallback(gWindow, record.x, record.y);
+            break;
+        case INPUT_RECORD_SCROLL:
+            UMouseScrollCallback(gWindow, 0.0, record.y);
+            break;
+        case INPUT_RECORD_RESIZE:
+            UResizeWindow(gWindow, int(record.x), int(record.y));
+            break;
+        case INPUT_RECORD_FRAME:
+            UBuildSnapshot(gSnapshots.buffers[gSnapshots.writing], UProfileNow(), float(record.x));
+            UPublishSnapshot(gSnapshots);
+            ++replay.frames;
+            return true;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+
+// Reports how fast the replay ran, if one did (it may have been stopped early, or replayed Escape)
+void UFinishInputReplay()
+{
+    InputReplay& replay = gInputReplay;
+    if (!replay.active)
+        return;
+
+    const double seconds = (UProfileNow() - replay.startNs) / 1.0e9;
+    LogMessage(LOG_INFO) << "Replay " << (replay.next == replay.records.size() ? "finished" : "stopped") << ": " << replay.frames
+        << " frames over " << gClock.timeNs / 1.0e9 << " s of simulation in " << seconds << " s ("
+        << replay.frames / seconds << " frames per second)";
+    replay.active = false;
+}
+
+
+// Parses the command line options; returns false (after printing the usage) on invalid input
+bool UParseCommandLine(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--instances" && i + 1 < argc && UParseInt(argv[i + 1], gInstanceCount))
+        {
+            ++i;
+        }
+        else if (arg == "--no-instancing")
+        {
+            gUseInstancing = false;
+        }
+        else if (arg == "--lights" && i + 1 < argc && UParseInt(argv[i + 1], gLightCount))
+        {
+            ++i;
+        }
+        else if (arg == "--benchmark")
+        {
+            gBenchmarkMode = true;
+        }
+        else if (arg == "--microbench")
+        {
+            gBenchmarkMode = true;
+            gMicrobenchMode = true;
+        }
+        else if (arg == "--regression" && i + 1 < argc)
+        {
+            gBenchmarkMode = true;
+            gRegressionMode = true;
+            gRegressionDirectory = argv[++i];
+        }
+        else if (arg == "--update-references")
+        {
+            gUpdateReferences = true;
+        }
+        else if (arg == "--image-tolerance" && i + 1 < argc && UParseDouble(argv[i + 1], gImageTolerance))
+        {
+            ++i;
+        }
+        else if (arg == "--perf-threshold" && i + 1 < argc && UParseDouble(argv[i + 1], gPerfThreshold))
+        {
+            ++i;
+        }
+        else if (arg == "--frames" && i + 1 < argc && UParseInt(argv[i + 1], gBenchmarkFrames))
+        {
+            ++i;
+        }
+        else if (arg == "--bench-out" && i + 1 < argc)
+        {
+            gBenchmarkOutput = argv[++i];
+        }
+        else if (arg == "--log-level" && i + 1 < argc && UParseLogLevel(argv[i + 1], gLogLevel))
+        {
+            ++i;
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            gTraceOutput = argv[++i];
+        }
+        else if (arg == "--no-texture-cache")
+        {
+            gUseTextureCache = false;
+        }
+        else if (arg == "--no-shader-cache")
+        {
+            gUseProgramCache = false;
+        }
+        else if (arg == "--no-bindless")
+        {
+            gUseBindless = false;
+        }
+        else if (arg == "--model" && i + 1 < argc)
+        {
+            gModelPath = argv[++i];
+        }
+        else if (arg == "--no-mesh-cache")
+        {
+            gUseMeshCache = false;
+        }
+        else if (arg == "--packed-vertices")
+        {
+            gPackVertices = true;
+        }
+        else if (arg == "--continuous")
+        {
+            gContinuousRendering = true;
+        }
+        else if (arg == "--fps-cap" && i + 1 < argc && UParseInt(argv[i + 1], gFpsCap))
+        {
+            ++i;
+        }
+        else if (arg == "--vsync" && i + 1 < argc && UParseVsyncMode(argv[i + 1], gVsyncMode))
+        {
+            ++i;
+        }
+        else if (arg == "--record-input" && i + 1 < argc)
+        {
+            gRecordInputPath = argv[++i];
+        }
+        else if (arg == "--replay-input" && i + 1 < argc)
+        {
+            gReplayInputPath = argv[++i];
+        }
+        else
+        {
+            LogMessage(LOG_ERROR) << "Usage: " << argv[0] << " [--log-level LEVEL] [--instances N] [--no-instancing] [--lights N] [--benchmark [--frames N] [--bench-out PREFIX]] [--microbench [--bench-out PREFIX]] [--regression DIR [--update-references] [--image-tolerance E] [--perf-threshold P] [--bench-out PREFIX]] [--trace FILE] [--no-texture-cache] [--no-shader-cache] [--no-bindless] [--model FILE [--no-mesh-cache]] [--packed-vertices] [--continuous] [--fps-cap N] [--vsync MODE] [--record-input FILE | --replay-input FILE]"
+                << "\n  --log-level LEVEL   least severe messages printed: debug, info (default), warning or error"
+                << "\n  --instances N       draw N copies of the bottle (instancing stress scene)"
+                << "\n  --no-instancing     draw the copies with one draw call each instead of one instanced draw"
+                << "\n  --lights N          add N moving point lights (clustered lighting stress test)"
+                << "\n  --benchmark         render offscreen without a window along a scripted camera path"
+                << "\n  --frames N          number of measured benchmark frames (default 600)"
+                << "\n  --bench-out PREFIX  write the benchmark results to PREFIX.csv and PREFIX.json (default benchmark)"
+                << "\n  --microbench        time image flips and decoding, mesh building, matrices and uniform uploads; writes PREFIX.micro.json"
+                << "\n  --regression DIR    render fixed poses on Mesa's llvmpipe and check them against the reference images and frame time baseline in DIR"
+                << "\n  --update-references write the regression reference images and baseline instead of checking them"
+                << "\n  --image-tolerance E color difference (CIE76 delta E) a pixel may have from its reference (default 2.3, just noticeable)"
+                << "\n  --perf-threshold P  percent a median frame time may exceed its baseline by (default 10)"
+                << "\n  --trace FILE        file the profiler trace is written to with F12 and after a benchmark (default trace.json)"
+                << "\n  --no-texture-cache  decode the source images instead of using block-compressed cache files"
+                << "\n  --no-shader-cache   compile the shader programs instead of loading cached program binaries"
+                << "\n  --no-bindless       sample a texture array even where bindless textures are available"
+                << "\n  --model FILE        load a glTF 2.0 (.gltf, .glb) or OBJ model and draw it next to the bottle"
+                << "\n  --no-mesh-cache     parse the model instead of loading (and writing) its binary mesh cache"
+                << "\n  --packed-vertices   upload 16-byte quantized vertices instead of 32-byte float ones"
+                << "\n  --continuous        draw a frame every simulation step instead of only when something changed"
+                << "\n  --fps-cap N         present at most N frames per second (default 0, no cap)"
+                << "\n  --vsync MODE        swap interval: off, on (default) or adaptive (late frames tear instead of waiting)"
+                << "\n  --record-input FILE write the session's keys, mouse, scroll and resizes to FILE, step by step"
+                << "\n  --replay-input FILE drive the session from a recording instead of the window's input, drawing its every frame";
+            return false;
+        }
+    }
+
+    if (gInstanceCount < 0)
+    {
+        LogMessage(LOG_ERROR) << "Instance count must not be negative";
+        return false;
+    }
+
+    if (gLightCount < 0)
+    {
+        LogMessage(LOG_ERROR) << "Light count must not be negative";
+        return false;
+    }
+
+    if (gBenchmarkFrames <= 0)
+    {
+        LogMessage(LOG_ERROR) << "Benchmark frame count must be positive";
+        return false;
+    }
+
+    if (gImageTolerance < 0.0 || gPerfThreshold < 0.0)
+    {
+        LogMessage(LOG_ERROR) << "Image tolerance and frame time threshold must not be negative";
+        return false;
+    }
+
+    if (gUpdateReferences && !gRegressionMode)
+    {
+        LogMessage(LOG_ERROR) << "--update-references needs --regression DIR";
+        return false;
+    }
+
+    if (gMicrobenchMode && gRegressionMode)
+    {
+        LogMessage(LOG_ERROR) << "--microbench and --regression cannot be combined";
+        return false;
+    }
+
+    if (gFpsCap < 0)
+    {
+        LogMessage(LOG_ERROR) << "Frame rate cap must not be negative";
+        return false;
+    }
+
+    if (!gRecordInputPath.empty() && !gReplayInputPath.empty())
+    {
+        LogMessage(LOG_ERROR) << "--record-input and --replay-input cannot be combined";
+        return false;
+    }
+
+    if (gBenchmarkMode && (!gRecordInputPath.empty() || !gReplayInputPath.empty()))
+    {
+        LogMessage(LOG_ERROR) << "The benchmark follows its scripted camera path: it cannot record or replay input";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Initialize GLFW, GLEW, and create a window
+bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+{
+    // GLFW: initialize and configure
+    // ------------------------------
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    // GLFW: window creation
+    // ---------------------
+    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (*window == NULL)
+    {
+        LogMessage(LOG_ERROR) << "Failed to create GLFW window";
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(*window);
+    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetCursorPosCallback(*window, UMousePositionCallback);
+    glfwSetScrollCallback(*window, UMouseScrollCallback);
+    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+    glfwSetWindowRefreshCallback(*window, UWindowRefreshCallback);
+
+    // tell GLFW to capture our mouse
+    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // GLEW: initialize
+    // ----------------
+    // Note: if using GLEW version 1.13 or earlier
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    if (GLEW_OK != GlewInitResult)
+    {
+        LogMessage(LOG_ERROR) << glewGetErrorString(GlewInitResult);
+        return false;
+    }
+
+    // Displays GPU OpenGL version
+    LogMessage(LOG_INFO) << "OpenGL Version: " << glGetString(GL_VERSION);
+
+    // The framebuffer can be larger than the window (high-DPI displays)
+    glfwGetFramebufferSize(*window, &gViewportWidth, &gViewportHeight);
+
+    return true;
+}
+
+
+// Creates an offscreen OpenGL 4.4 core context without a window or display (EGL surfaceless or pbuffer),
+// so the benchmark runs on display-less machines, including Mesa's llvmpipe software renderer
+bool UInitializeHeadless()
+{
+#ifdef __linux__
+    // The regression references are rendered by Mesa's software rasterizer: select it unless the caller chose
+    if (gRegressionMode)
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+
+    // Prefer Mesa's surfaceless platform, which needs neither X11 nor Wayland nor a GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        gEglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (gEglDisplay == EGL_NO_DISPLAY)
+        gEglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (gEglDisplay == EGL_NO_DISPLAY || !eglInitialize(gEglDisplay, &major, &minor))
+    {
+        LogMessage(LOG_ERROR) << "Failed to initialize EGL";
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config = NULL;
+    EGLint configCount = 0;
+    eglChooseConfig(gEglDisplay, configAttributes, &config, 1, &configCount);
+
+    // Same version and profile as the windowed context
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglBindAPI(EGL_OPENGL_API);
+    gEglContext = eglCreateContext(gEglDisplay, configCount > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+    if (gEglContext == EGL_NO_CONTEXT)
+    {
+        LogMessage(LOG_ERROR) << "Failed to create EGL context";
+        UDestroyHeadless();
+        return false;
+    }
+
+    // Rendering goes to an FBO, so a tiny pbuffer (or no surface at all) is enough
+    if (configCount > 0)
+    {
+        const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        gEglSurface = eglCreatePbufferSurface(gEglDisplay, config, pbufferAttributes);
+    }
+    if (!eglMakeCurrent(gEglDisplay, gEglSurface, gEglSurface, gEglContext))
+    {
+        LogMessage(LOG_ERROR) << "Failed to make the EGL context current";
+        UDestroyHeadless();
+        return false;
+    }
+
+    // GLEW: initialize
+    // ----------------
+    // A GLX-only GLEW reports the missing X display after it has loaded the GL entry points
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    if (GLEW_OK != GlewInitResult && GLEW_ERROR_NO_GLX_DISPLAY != GlewInitResult)
+    {
+        LogMessage(LOG_ERROR) << glewGetErrorString(GlewInitResult);
+        UDestroyHeadless();
+        return false;
+    }
+    glGetError(); // Clear a GL_INVALID_ENUM GLEW may have raised while probing extensions
+
+    // Displays GPU OpenGL version
+    LogMessage(LOG_INFO) << "OpenGL Version: " << glGetString(GL_VERSION);
+    LogMessage(LOG_INFO) << "OpenGL Renderer: " << glGetString(GL_RENDERER);
+
+    return true;
+#else
+    LogMessage(LOG_ERROR) << "Benchmark mode needs EGL, which is only supported on Linux";
+    return false;
+#endif
+}
+
+
+void UDestroyHeadless()
+{
+#ifdef __linux__
+    if (gEglDisplay == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(gEglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (gEglSurface != EGL_NO_SURFACE)
+        eglDestroySurface(gEglDisplay, gEglSurface);
+    if (gEglContext != EGL_NO_CONTEXT)
+        eglDestroyContext(gEglDisplay, gEglContext);
+    eglTerminate(gEglDisplay);
+
+    gEglDisplay = EGL_NO_DISPLAY;
+    gEglContext = EGL_NO_CONTEXT;
+    gEglSurface = EGL_NO_SURFACE;
+#endif
+}
+
+
+// Renders the scene offscreen along the scripted camera path and writes per-frame timings and their statistics
+bool URunBenchmark()
+{
+    using namespace std::chrono;
+
+    GLRenderTarget target;
+    UCreateRenderTarget(WINDOW_WIDTH, WINDOW_HEIGHT, target);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    gViewportWidth = WINDOW_WIDTH;
+    gViewportHeight = WINDOW_HEIGHT;
+
+    // GPU timer queries are read back a few frames late so the CPU does not wait for the GPU
+    const int QUERY_LATENCY = 4;
+    GLuint queries[QUERY_LATENCY];
+    glGenQueries(QUERY_LATENCY, queries);
+
+    const int totalFrames = BENCHMARK_WARMUP_FRAMES + gBenchmarkFrames;
+    vector<BenchmarkFrame> frames(gBenchmarkFrames);
+
+    // Measure the finished scene, not the placeholder textures
+    UWaitForTextureLoads();
+
+    // Start from the interactive mode's initial pose and advance with a fixed time step
+    gCamera = Camera(glm::vec3(0.0f, 0.0f, 7.0f));
+    gClock.timeNs = 0;
+
+    LogMessage(LOG_INFO) << "Benchmark: " << gBenchmarkFrames << " frames (+" << BENCHMARK_WARMUP_FRAMES << " warm-up) at "
+        << WINDOW_WIDTH << "x" << WINDOW_HEIGHT;
+
+    steady_clock::time_point previousEnd = steady_clock::now();
+    for (int frame = 0; frame < totalFrames + QUERY_LATENCY; ++frame)
+    {
+        // Collect the GPU time of the frame that last used this query object
+        const int slot = frame % QUERY_LATENCY;
+        const int queryFrame = frame - QUERY_LATENCY - BENCHMARK_WARMUP_FRAMES;
+        if (queryFrame >= 0)
+        {
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsedNs);
+            frames[queryFrame].gpuMs = elapsedNs / 1.0e6;
+        }
+
+        // The loop runs QUERY_LATENCY extra iterations only to drain the queries
+        if (frame >= totalFrames)
+            continue;
+
+        steady_clock::time_point start = steady_clock::now();
+
+        UProfileBeginFrame();
+        UBenchmarkCameraStep(frame);
+        gClock.timeNs = int64_t(frame + 1) * 1000000000 / BENCHMARK_FRAME_RATE;
+
+        // Single-threaded: the snapshot is built and drawn in the same iteration, at the frame's own step
+        FrameSnapshot& snapshot = gSnapshots.buffers[0];
+        UBuildSnapshot(snapshot, UProfileNow(), 1.0f);
+
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+        URender(snapshot);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        steady_clock::time_point submitted = steady_clock::now();
+        glFlush(); // Stands in for the swap: hands the frame over to the driver
+        steady_clock::time_point end = steady_clock::now();
+
+        const int measuredFrame = frame - BENCHMARK_WARMUP_FRAMES;
+        if (measuredFrame >= 0)
+        {
+            frames[measuredFrame].cpuMs = duration<double, std::milli>(submitted - start).count();
+            frames[measuredFrame].frameMs = duration<double, std::milli>(end - previousEnd).count();
+            frames[measuredFrame].drawCalls = gFrameStats.drawCalls;
+            frames[measuredFrame].visibleObjects = gFrameStats.visibleObjects;
+            frames[measuredFrame].cullMs = gFrameStats.cullMs;
+            frames[measuredFrame].stateChanges = gFrameStats.stateChanges;
+            frames[measuredFrame].redundantStateChanges = gFrameStats.redundantStateChanges;
+            frames[measuredFrame].lightAssignments = gFrameStats.lightAssignments;
+            frames[measuredFrame].lightBinMs = gFrameStats.lightBinMs;
+            frames[measuredFrame].uploadBytes = double(gFrameStats.uploadBytes);
+            frames[measuredFrame].fenceWaitMs = gFrameStats.fenceWaitMs;
+        }
+        previousEnd = end;
+    }
+
+    glDeleteQueries(QUERY_LATENCY, queries);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    UDestroyRenderTarget(target);
+
+    // Flush the last GPU scopes into the trace before writing it
+    glFinish();
+    UProfileBeginFrame();
+    UProfileBeginFrame();
+
+    return UWriteBenchmarkResults(frames, gBenchmarkOutput) && UWriteChromeTrace(gTraceOutput);
+}
+
+
+// Moves the camera along the benchmark's scripted path through the same Camera calls the keyboard and
+// mouse use: strafing right while turning left circles the scene, dollying in and out every two seconds
+void UBenchmarkCameraStep(int frame)
+{
+    gCamera.ProcessKeyboard(RIGHT, BENCHMARK_FRAME_TIME);
+    gCamera.ProcessMouseMovement(-2.0f, 0.0f);
+    gCamera.ProcessKeyboard((frame / 120) % 2 == 0 ? FORWARD : BACKWARD, 0.5f * BENCHMARK_FRAME_TIME);
+}
+
+
+// Writes the per-frame timings to <prefix>.csv and their min/avg/p95/p99 statistics to <prefix>.json
+bool UWriteBenchmarkResults(const vector<BenchmarkFrame>& frames, const string& prefix)
+{
+    ofstream csv(prefix + ".csv");
+    if (!csv)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << prefix << ".csv";
+        return false;
+    }
+
+    csv << "frame,cpu_ms,gpu_ms,frame_ms,draw_calls,visible_objects,culled_objects,cull_ms,state_changes,redundant_state_changes,light_assignments,light_bin_ms,upload_bytes,fence_wait_ms\n";
+    for (size_t i = 0; i < frames.size(); ++i)
+        csv << i << ',' << frames[i].cpuMs << ',' << frames[i].gpuMs << ',' << frames[i].frameMs << ',' << frames[i].drawCalls << ','
+            << frames[i].visibleObjects << ',' << gScene.objects.size() - frames[i].visibleObjects << ',' << frames[i].cullMs << ','
+            << frames[i].stateChanges << ',' << frames[i].redundantStateChanges << ',' << frames[i].lightAssignments << ','
+            << frames[i].lightBinMs << ',' << frames[i].uploadBytes << ',' << frames[i].fenceWaitMs << '\n';
+
+    // Nearest-rank statistics of one timing column
+    auto writeStats = [&frames](ostream& out, const char* name, double BenchmarkFrame::* field)
+    {
+        vector<double> values;
+        values.reserve(frames.size());
+        for (const BenchmarkFrame& frame : frames)
+            values.push_back(frame.*field);
+        std::sort(values.begin(), values.end());
+
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+
+        auto percentile = [&values](double p) { return values[size_t(ceil(p * values.size())) - 1]; };
+
+        out << "  \"" << name << "\": { \"min\": " << values.front() << ", \"avg\": " << sum / values.size()
+            << ", \"p95\": " << percentile(0.95) << ", \"p99\": " << percentile(0.99) << ", \"max\": " << values.back() << " }";
+    };
+
+    GLuint maxDrawCalls = 0;
+    double totalDrawCalls = 0.0;
+    double totalVisibleObjects = 0.0;
+    double totalUploadBytes = 0.0;
+    double totalFrameMs = 0.0;
+    for (const BenchmarkFrame& frame : frames)
+    {
+        maxDrawCalls = std::max(maxDrawCalls, frame.drawCalls);
+        totalDrawCalls += frame.drawCalls;
+        totalVisibleObjects += frame.visibleObjects;
+        totalUploadBytes += frame.uploadBytes;
+        totalFrameMs += frame.frameMs;
+    }
+
+    ofstream json(prefix + ".json");
+    if (!json)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << prefix << ".json";
+        return false;
+    }
+
+    json << "{\n";
+    json << "  \"renderer\": \"" << UJsonEscape(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) << "\",\n";
+    json << "  \"frames\": " << frames.size() << ",\n";
+    json << "  \"width\": " << WINDOW_WIDTH << ",\n";
+    json << "  \"height\": " << WINDOW_HEIGHT << ",\n";
+    json << "  \"instances\": " << gInstanceCount << ",\n";
+    json << "  \"lights\": " << gLightCount << ",\n";
+    writeStats(json, "cpu_ms", &BenchmarkFrame::cpuMs);
+    json << ",\n";
+    writeStats(json, "gpu_ms", &BenchmarkFrame::gpuMs);
+    json << ",\n";
+    writeStats(json, "frame_ms", &BenchmarkFrame::frameMs);
+    json << ",\n";
+    writeStats(json, "cull_ms", &BenchmarkFrame::cullMs);
+    json << ",\n";
+    writeStats(json, "light_bin_ms", &BenchmarkFrame::lightBinMs);
+    json << ",\n";
+    writeStats(json, "upload_bytes", &BenchmarkFrame::uploadBytes);
+    json << ",\n";
+    writeStats(json, "fence_wait_ms", &BenchmarkFrame::fenceWaitMs);
+    json << ",\n";
+    json << "  \"upload_mb_per_s\": " << totalUploadBytes / 1.0e6 / (totalFrameMs / 1000.0) << ",\n";
+    json << "  \"draw_calls\": { \"avg\": " << totalDrawCalls / frames.size() << ", \"max\": " << maxDrawCalls << " },\n";
+    json << "  \"objects\": { \"total\": " << gScene.objects.size() << ", \"visible_avg\": " << totalVisibleObjects / frames.size() << " },\n";
+    json << "  \"gpu_memory_kb\": { \"live\": " << gResources.totalBytes / 1024 << ", \"peak\": " << gResources.peakTotalBytes / 1024 << " }\n";
+    json << "}\n";
+
+    LogMessage(LOG_INFO) << "Benchmark results written to " << prefix << ".csv and " << prefix << ".json";
+    return true;
+}
+
+
+// Renderer strings are plain text, but keep the JSON valid if they ever contain quotes or backslashes
+string UJsonEscape(const string& text)
+{
+    string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+
+// Times the CPU side of the program's hot paths in the headless context: image flips and decoding, mesh
+// building, the matrices of a frame and the ways to upload per-frame data. GL calls are timed as submitted,
+// without waiting for the GPU.
+bool URunMicrobenchmarks()
+{
+    // Measure a quiet process: the texture loader's threads are done before the first benchmark
+    UWaitForTextureLoads();
+
+    vector<MicrobenchResult> results;
+    volatile float sink = 0.0f;     // Every benchmark folds a result in, so the compiler cannot drop the work
+
+    // Image flips, at the sizes and channel counts the textures come in
+    const int imageSizes[] = { 256, 1024, 4096 };
+    const int channelCounts[] = { 1, 3, 4 };
+    for (int size : imageSizes)
+        for (int channels : channelCounts)
+        {
+            vector<unsigned char> image(size_t(size) * size * channels, 0x5a);
+            UMicrobench(results, "flipImageVertically/" + std::to_string(size) + "x" + std::to_string(size) + "x" + std::to_string(channels),
+                double(image.size()), [&](uint64_t iterations)
+            {
+                for (uint64_t i = 0; i < iterations; ++i)
+                    flipImageVertically(image.data(), size, size, channels);
+                sink = sink + image[0];
+            });
+        }
+
+    // Image decoding, from memory so the file system stays out of the measurement
+    const char* const imagePaths[] = { "resources/textures/NeonPinkPlastic.jpg", "resources/textures/granite.jpg" };
+    for (const string path : imagePaths)
+    {
+        string encoded;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        if (!UReadFile(path, encoded) ||
+            !stbi_info_from_memory(reinterpret_cast<const stbi_uc*>(encoded.data()), int(encoded.size()), &width, &height, &channels))
+        {
+            LogMessage(LOG_WARNING) << "Microbenchmark of " << path << " skipped: the image cannot be read";
+            continue;
+        }
+        UMicrobench(results, "stbi_load/" + path.substr(UDirectoryOf(path).size()), double(width) * height * channels, [&](uint64_t iterations)
+        {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                unsigned char* image = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(encoded.data()), int(encoded.size()),
+                    &width, &height, &channels, 0);
+                if (image)
+                    sink = sink + image[0];
+                stbi_image_free(image);
+            }
+        });
+    }
+
+    // Mesh building: welding, vertex cache optimization and the upload. Its log line would be timed too.
+    const LogLevel logLevel = gLogLevel;
+    gLogLevel = LOG_WARNING;
+    UMicrobench(results, "UCreateMesh", 0.0, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            GLMesh mesh;
+            UCreateMesh(mesh);
+            sink = sink + float(mesh.nIndices);
+            UDestroyMesh(mesh);
+        }
+    });
+    gLogLevel = logLevel;
+
+    // The matrices URender and UCreateScene build; the inputs vary so nothing is computed once for all iterations
+    UMicrobench(results, "glm::perspective", 0.0, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            const glm::mat4 projection = glm::perspective(glm::radians(45.0f + float(i & 7)), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, CAMERA_NEAR, CAMERA_FAR);
+            sink = sink + projection[0][0];
+        }
+    });
+    Camera camera(glm::vec3(0.0f, 0.0f, 7.0f));
+    UMicrobench(results, "Camera::GetViewMatrix", 0.0, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            camera.Position.x = float(i & 7);
+            sink = sink + camera.GetViewMatrix()[3][0];
+        }
+    });
+    UMicrobench(results, "glm::translate*glm::scale", 0.0, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            const glm::mat4 model = glm::translate(gPyramidPosition + glm::vec3(float(i & 7), 0.0f, 0.0f)) * glm::scale(gPyramidScale);
+            sink = sink + model[3][0];
+        }
+    });
+    UMicrobench(results, "UNormalMatrix", 0.0, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            const glm::mat3 normalMatrix = UNormalMatrix(glm::translate(glm::vec3(float(i & 7), 0.0f, 0.0f)) * glm::scale(gPyramidScale));
+            sink = sink + normalMatrix[0][0];
+        }
+    });
+
+    // The frame's camera data and MICROBENCH_UPLOAD_OBJECTS objects' data, sent as uniforms per draw, with
+    // glBufferSubData, or through the persistently mapped ring URender uses
+    FrameData frameData = {};
+    frameData.view = camera.GetViewMatrix();
+    frameData.projection = glm::perspective(glm::radians(45.0f), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, CAMERA_NEAR, CAMERA_FAR);
+    vector<ObjectData> objects(MICROBENCH_UPLOAD_OBJECTS);
+    for (int i = 0; i < MICROBENCH_UPLOAD_OBJECTS; ++i)
+    {
+        objects[i] = ObjectData();
+        objects[i].model = glm::translate(glm::vec3(float(i), 0.0f, 0.0f));
+        objects[i].color = glm::vec4(gObjectColor, 1.0f);
+    }
+    const size_t objectBytes = objects.size() * sizeof(ObjectData);
+    const double uploadBytes = double(sizeof(FrameData) + objectBytes);
+
+    GLProgram uploadProgram;
+    GLUniformLocations uploadUniforms;
+    if (!UCreateShaderProgram(microbenchVertexShaderSource, microbenchFragmentShaderSource, uploadProgram, uploadUniforms, "microbench upload program"))
+        return false;
+    const GLint modelLocation = glGetUniformLocation(uploadProgram, "model");
+    const GLint viewLocation = glGetUniformLocation(uploadProgram, "view");
+    const GLint projectionLocation = glGetUniformLocation(uploadProgram, "projection");
+    const GLint colorLocation = glGetUniformLocation(uploadProgram, "objectColor");
+    UMicrobench(results, "upload/glUniform", uploadBytes, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            glUseProgram(uploadProgram);
+            glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(frameData.view));
+            glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(frameData.projection));
+            for (const ObjectData& object : objects)
+            {
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(object.model));
+                glUniform3fv(colorLocation, 1, glm::value_ptr(object.color));
+            }
+        }
+    });
+    glUseProgram(0);
+    UResetStateCache(gStateCache);
+
+    GLBuffer uploadBuffer;
+    uploadBuffer.create("microbench upload buffer");
+    glBindBuffer(GL_COPY_WRITE_BUFFER, uploadBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(uploadBytes), NULL, GL_DYNAMIC_DRAW);
+    USetResourceSize(RESOURCE_BUFFER, uploadBuffer, size_t(uploadBytes));
+    UMicrobench(results, "upload/glBufferSubData", uploadBytes, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(FrameData), &frameData);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(FrameData), GLsizeiptr(objectBytes), objects.data());
+        }
+    });
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    UMicrobench(results, "upload/dynamic ring", uploadBytes, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            UBeginDynamicFrame(gDynamicRing);
+            UWriteDynamic(gDynamicRing, &frameData, sizeof(FrameData), gDynamicRing.uniformAlignment);
+            UWriteDynamic(gDynamicRing, objects.data(), objectBytes, gDynamicRing.storageAlignment);
+            UEndDynamicFrame(gDynamicRing);
+        }
+    });
+    glFinish();
+
+    return UWriteMicrobenchResults(results, gBenchmarkOutput + ".micro.json");
+}
+
+
+// Times body(iterations) like Google Benchmark does: the iteration count grows until a run takes
+// MICROBENCH_MIN_TIME_NS, then MICROBENCH_REPETITIONS runs of that count are timed and their median kept
+void UMicrobench(vector<MicrobenchResult>& results, const string& name, double bytesPerIteration, const std::function<void(uint64_t)>& body)
+{
+    // One untimed iteration first, so first-use costs (page faults, lazy driver state) are not measured
+    body(1);
+
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        const int64_t startNs = UProfileNow();
+        body(iterations);
+        const int64_t elapsedNs = UProfileNow() - startNs;
+        if (elapsedNs >= MICROBENCH_MIN_TIME_NS)
+            break;
+
+        // Aim a little past the minimum time, growing at most tenfold per try
+        const double growth = elapsedNs > 0 ? std::min(10.0, 1.4 * MICROBENCH_MIN_TIME_NS / elapsedNs) : 10.0;
+        iterations = std::max(iterations + 1, uint64_t(iterations * growth));
+    }
+
+    vector<double> realNs;
+    vector<double> cpuNs;
+    for (int run = 0; run < MICROBENCH_REPETITIONS; ++run)
+    {
+        const std::clock_t cpuStart = std::clock();
+        const int64_t startNs = UProfileNow();
+        body(iterations);
+        realNs.push_back(double(UProfileNow() - startNs) / iterations);
+        cpuNs.push_back(double(std::clock() - cpuStart) * 1.0e9 / CLOCKS_PER_SEC / iterations);
+    }
+    std::sort(realNs.begin(), realNs.end());
+    std::sort(cpuNs.begin(), cpuNs.end());
+
+    MicrobenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.realNs = realNs[realNs.size() / 2];
+    result.realMinNs = realNs.front();
+    result.realMaxNs = realNs.back();
+    result.cpuNs = cpuNs[cpuNs.size() / 2];
+    result.bytesPerSecond = bytesPerIteration * 1.0e9 / result.realNs;
+    results.push_back(result);
+
+    LogMessage(LOG_INFO) << "Microbenchmark " << name << ": " << result.realNs << " ns (" << result.realMinNs << " to " << result.realMaxNs
+        << " ns over " << MICROBENCH_REPETITIONS << " runs of " << iterations << ")";
+}
+
+
+// Writes the microbenchmark results as JSON, laid out like Google Benchmark's so the same tools can track them
+bool UWriteMicrobenchResults(const vector<MicrobenchResult>& results, const string& path)
+{
+    ofstream json(path);
+    if (!json)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << path;
+        return false;
+    }
+
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    json << "{\n";
+    json << "  \"context\": {\n";
+    json << "    \"date\": \"" << date << "\",\n";
+    json << "    \"renderer\": \"" << UJsonEscape(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) << "\",\n";
+    json << "    \"gl_version\": \"" << UJsonEscape(reinterpret_cast<const char*>(glGetString(GL_VERSION))) << "\",\n";
+    json << "    \"min_time_ns\": " << MICROBENCH_MIN_TIME_NS << ",\n";
+    json << "    \"repetitions\": " << MICROBENCH_REPETITIONS << "\n";
+    json << "  },\n";
+    json << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const MicrobenchResult& result = results[i];
+        json << "    { \"name\": \"" << UJsonEscape(result.name) << "\", \"iterations\": " << result.iterations
+            << ", \"real_time\": " << result.realNs << ", \"real_time_min\": " << result.realMinNs << ", \"real_time_max\": " << result.realMaxNs
+            << ", \"cpu_time\": " << result.cpuNs << ", \"time_unit\": \"ns\"";
+        if (result.bytesPerSecond > 0.0)
+            json << ", \"bytes_per_second\": " << result.bytesPerSecond;
+        json << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n";
+    json << "}\n";
+
+    LogMessage(LOG_INFO) << "Microbenchmark results written to " << path;
+    return true;
+}
+
+
+// Regression harness (--regression): renders every pose of REGRESSION_POSES offscreen and checks its frame
+// against the reference image and its median frame times against the baseline in gRegressionDirectory, or
+// writes both with --update-references. Each frame is read back into a pixel pack buffer that is only mapped
+// REGRESSION_READBACK_BUFFERS poses later, so the copy never stalls the poses rendering after it.
+bool URunRegression()
+{
+    using namespace std::chrono;
+
+    const string renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    if (renderer.find("llvmpipe") == string::npos)
+        LogMessage(LOG_WARNING) << "Regression references are rendered by Mesa's llvmpipe, not " << renderer << ": expect image differences";
+
+    const string baselinePath = gRegressionDirectory + "/" + REGRESSION_BASELINE_FILE;
+    JsonValue baseline;
+    baseline.type = JsonValue::JSON_NULL;
+    if (gUpdateReferences)
+    {
+#ifdef _WIN32
+        _mkdir(gRegressionDirectory.c_str());
+#else
+        mkdir(gRegressionDirectory.c_str(), 0755);
+#endif
+    }
+    else
+    {
+        string text;
+        const bool loaded = UReadFile(baselinePath, text);
+        const char* cursor = text.c_str();
+        if (!loaded || !UParseJsonValue(cursor, baseline, 0) || baseline.type != JsonValue::JSON_OBJECT)
+            LogMessage(LOG_ERROR) << "Failed to load the frame time baseline " << baselinePath << " (run with --update-references to write it)";
+
+        const JsonValue* baselineRenderer = UJsonMember(&baseline, "renderer");
+        if (baselineRenderer && baselineRenderer->text != renderer)
+            LogMessage(LOG_WARNING) << "The baseline was measured on " << baselineRenderer->text << ": frame times on " << renderer << " may not compare";
+    }
+
+    GLRenderTarget target;
+    UCreateRenderTarget(REGRESSION_WIDTH, REGRESSION_HEIGHT, target);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, REGRESSION_WIDTH, REGRESSION_HEIGHT);
+    gViewportWidth = REGRESSION_WIDTH;
+    gViewportHeight = REGRESSION_HEIGHT;
+
+    // Tightly packed RGB rows, bottom row first as glReadPixels returns them
+    const size_t imageBytes = size_t(REGRESSION_WIDTH) * REGRESSION_HEIGHT * 3;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    GLBuffer readbackBuffers[REGRESSION_READBACK_BUFFERS];
+    GLsync readbackFences[REGRESSION_READBACK_BUFFERS];
+    for (int slot = 0; slot < REGRESSION_READBACK_BUFFERS; ++slot)
+    {
+        readbackBuffers[slot].create("regression readback");
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(imageBytes), NULL, GL_STREAM_READ);
+        USetResourceSize(RESOURCE_BUFFER, readbackBuffers[slot], imageBytes);
+        readbackFences[slot] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // A pose's GPU timer queries are read back with its pixels
+    GLuint queries[REGRESSION_READBACK_BUFFERS][REGRESSION_TIMED_FRAMES];
+    glGenQueries(REGRESSION_READBACK_BUFFERS * REGRESSION_TIMED_FRAMES, &queries[0][0]);
+
+    // Compare the finished scene, not the placeholder textures, with the lights frozen at one time
+    UWaitForTextureLoads();
+    gClock.timeNs = REGRESSION_ANIMATION_NS;
+
+    LogMessage(LOG_INFO) << "Regression: " << REGRESSION_POSE_COUNT << " poses at " << REGRESSION_WIDTH << "x" << REGRESSION_HEIGHT << ", "
+        << (gUpdateReferences ? "writing references to " : "checking against ") << gRegressionDirectory;
+
+    auto median = [](vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    };
+
+    vector<RegressionResult> results(REGRESSION_POSE_COUNT);
+    vector<double> cpuMs(REGRESSION_TIMED_FRAMES);
+    vector<double> gpuMs(REGRESSION_TIMED_FRAMES);
+    vector<unsigned char> pixels(imageBytes);
+    for (int pose = 0; pose < REGRESSION_POSE_COUNT + REGRESSION_READBACK_BUFFERS; ++pose)
+    {
+        // Check the pose that last used this slot; its frame has normally finished while the poses after it rendered
+        const int slot = pose % REGRESSION_READBACK_BUFFERS;
+        const int checkedPose = pose - REGRESSION_READBACK_BUFFERS;
+        if (checkedPose >= 0)
+        {
+            RegressionResult& result = results[checkedPose];
+            GLenum status;
+            do
+                status = glClientWaitSync(readbackFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            while (status == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(readbackFences[slot]);
+            readbackFences[slot] = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+            const unsigned char* mapped = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(imageBytes), GL_MAP_READ_BIT));
+            if (mapped)
+            {
+                memcpy(pixels.data(), mapped, imageBytes);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            if (mapped)
+            {
+                flipImageVertically(pixels.data(), REGRESSION_WIDTH, REGRESSION_HEIGHT, 3);
+                UCheckRegressionImage(pixels, result);
+            }
+            else
+                LogMessage(LOG_ERROR) << "Failed to map the pixels of pose " << result.name;
+
+            for (int frame = 0; frame < REGRESSION_TIMED_FRAMES; ++frame)
+            {
+                GLuint64 elapsedNs = 0;
+                glGetQueryObjectui64v(queries[slot][frame], GL_QUERY_RESULT, &elapsedNs);
+                gpuMs[frame] = elapsedNs / 1.0e6;
+            }
+            result.gpuMs = median(gpuMs);
+            if (gUpdateReferences)
+                result.perfPassed = true;
+            else
+                UCheckRegressionTimes(baseline, result);
+        }
+
+        // The loop runs REGRESSION_READBACK_BUFFERS extra iterations only to check the last poses
+        if (pose >= REGRESSION_POSE_COUNT)
+            continue;
+
+        const RegressionPose& regressionPose = REGRESSION_POSES[pose];
+        results[pose].name = regressionPose.name;
+        gCamera = Camera(regressionPose.position, glm::vec3(0.0f, 1.0f, 0.0f), regressionPose.yaw, regressionPose.pitch);
+
+        FrameSnapshot& snapshot = gSnapshots.buffers[0];
+        UBuildSnapshot(snapshot, UProfileNow(), 1.0f);
+
+        // The same frame over and over: the warm-up frames, then the timed ones
+        for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + REGRESSION_TIMED_FRAMES; ++frame)
+        {
+            const int timedFrame = frame - BENCHMARK_WARMUP_FRAMES;
+            UProfileBeginFrame();
+            steady_clock::time_point start = steady_clock::now();
+            if (timedFrame >= 0)
+                glBeginQuery(GL_TIME_ELAPSED, queries[slot][timedFrame]);
+            URender(snapshot);
+            if (timedFrame >= 0)
+            {
+                glEndQuery(GL_TIME_ELAPSED);
+                cpuMs[timedFrame] = duration<double, std::milli>(steady_clock::now() - start).count();
+            }
+            glFlush();
+        }
+        results[pose].cpuMs = median(cpuMs);
+
+        // Queue the copy of the last frame into the slot's buffer and fence it
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+        glReadPixels(0, 0, REGRESSION_WIDTH, REGRESSION_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    glDeleteQueries(REGRESSION_READBACK_BUFFERS * REGRESSION_TIMED_FRAMES, &queries[0][0]);
+    for (GLBuffer& buffer : readbackBuffers)
+        buffer.reset();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    UDestroyRenderTarget(target);
+
+    GLuint failedPoses = 0;
+    for (const RegressionResult& result : results)
+    {
+        const bool passed = result.imagePassed && result.perfPassed;
+        failedPoses += passed ? 0 : 1;
+        if (gUpdateReferences)
+            LogMessage(passed ? LOG_INFO : LOG_ERROR) << "Pose " << result.name << ": reference " << (passed ? "written" : "NOT written")
+                << ", cpu " << result.cpuMs << " ms, gpu " << result.gpuMs << " ms";
+        else
+            LogMessage(passed ? LOG_INFO : LOG_ERROR) << "Pose " << result.name << ": image " << (result.imagePassed ? "passed" : "FAILED")
+                << " (" << 100.0 * result.differingFraction << "% of pixels over delta E " << gImageTolerance << ", max " << result.maxDeltaE
+                << ", mean " << result.meanDeltaE << "), frame times " << (result.perfPassed ? "passed" : "FAILED") << " (cpu " << result.cpuMs
+                << " ms, baseline " << result.baselineCpuMs << " ms; gpu " << result.gpuMs << " ms, baseline " << result.baselineGpuMs << " ms)";
+    }
+
+    const bool written = gUpdateReferences ? UWriteRegressionBaseline(results, baselinePath)
+        : UWriteRegressionResults(results, gBenchmarkOutput + ".regression.json");
+    LogMessage(failedPoses == 0 ? LOG_INFO : LOG_ERROR) << "Regression " << (gUpdateReferences ? "references: " : "check: ") << failedPoses
+        << " of " << REGRESSION_POSE_COUNT << " poses failed";
+    return failedPoses == 0 && written;
+}
+
+
+// CIELAB color (D65 white point) of an 8-bit sRGB pixel: distances in it follow perceived color differences
+glm::vec3 USrgbToLab(const unsigned char* rgb)
+{
+    static const vector<float> linear = []()
+    {
+        vector<float> table(256);
+        for (int i = 0; i < 256; ++i)
+        {
+            const float value = i / 255.0f;
+            table[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+
+    // Linear sRGB to XYZ, relative to the white point
+    const glm::vec3 color(linear[rgb[0]], linear[rgb[1]], linear[rgb[2]]);
+    const glm::vec3 xyz(glm::dot(glm::vec3(0.4124f, 0.3576f, 0.1805f), color) / 0.95047f,
+        glm::dot(glm::vec3(0.2126f, 0.7152f, 0.0722f), color),
+        glm::dot(glm::vec3(0.0193f, 0.1192f, 0.9505f), color) / 1.08883f);
+
+    auto f = [](float t) { return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f; };
+    const glm::vec3 fxyz(f(xyz.x), f(xyz.y), f(xyz.z));
+    return glm::vec3(116.0f * fxyz.y - 16.0f, 500.0f * (fxyz.x - fxyz.y), 200.0f * (fxyz.y - fxyz.z));
+}
+
+
+// Compares a pose's frame (RGB, top row first) with its reference image. A pixel differs when its CIE76
+// color difference (delta E) exceeds --image-tolerance; the frame passes while at most
+// REGRESSION_MAX_DIFFERING_FRACTION of its pixels differ, which accepts rasterization changes along a few
+// edges but not a missing object or different shading. A failed frame is written next to the results,
+// with an image of its differences (differing pixels red over the dimmed reference).
+void UCheckRegressionImage(const vector<unsigned char>& pixels, RegressionResult& result)
+{
+    const string referencePath = gRegressionDirectory + "/" + result.name + ".ppm";
+    if (gUpdateReferences)
+    {
+        result.imagePassed = UWritePpm(referencePath, pixels.data(), REGRESSION_WIDTH, REGRESSION_HEIGHT);
+        return;
+    }
+
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    unsigned char* reference = stbi_load(referencePath.c_str(), &width, &height, &channels, 3);
+    if (!reference || width != REGRESSION_WIDTH || height != REGRESSION_HEIGHT)
+    {
+        LogMessage(LOG_ERROR) << (reference ? "Reference image has the wrong size: " : "Failed to load reference image ") << referencePath
+            << " (run with --update-references to write it)";
+        stbi_image_free(reference);
+        return;
+    }
+
+    const size_t pixelCount = size_t(width) * height;
+    vector<unsigned char> differences(pixelCount * 3);
+    size_t differing = 0;
+    double sumDeltaE = 0.0;
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        const double deltaE = glm::length(USrgbToLab(&pixels[i * 3]) - USrgbToLab(&reference[i * 3]));
+        sumDeltaE += deltaE;
+        result.maxDeltaE = std::max(result.maxDeltaE, deltaE);
+
+        const bool differs = deltaE > gImageTolerance;
+        differing += differs ? 1 : 0;
+        for (int channel = 0; channel < 3; ++channel)
+            differences[i * 3 + channel] = differs ? (channel == 0 ? 255 : 0) : reference[i * 3 + channel] / 4;
+    }
+    stbi_image_free(reference);
+
+    result.meanDeltaE = sumDeltaE / pixelCount;
+    result.differingFraction = double(differing) / pixelCount;
+    result.imagePassed = result.differingFraction <= REGRESSION_MAX_DIFFERING_FRACTION;
+    if (!result.imagePassed)
+    {
+        const string prefix = gBenchmarkOutput + "." + result.name;
+        UWritePpm(prefix + ".actual.ppm", pixels.data(), width, height);
+        UWritePpm(prefix + ".diff.ppm", differences.data(), width, height);
+        LogMessage(LOG_INFO) << "Pose " << result.name << " written to " << prefix << ".actual.ppm, its differences to " << prefix << ".diff.ppm";
+    }
+}
+
+
+// Compares a pose's median frame times with its baseline entry; each may exceed it by at most --perf-threshold
+// percent. A pose missing from the baseline fails, so a new pose cannot go unmeasured.
+void UCheckRegressionTimes(const JsonValue& baseline, RegressionResult& result)
+{
+    const JsonValue* entry = UJsonMember(UJsonMember(&baseline, "poses"), result.name.c_str());
+    result.baselineCpuMs = UJsonNumber(UJsonMember(entry, "cpu_ms"), 0.0);
+    result.baselineGpuMs = UJsonNumber(UJsonMember(entry, "gpu_ms"), 0.0);
+
+    const double limit = 1.0 + gPerfThreshold / 100.0;
+    result.perfPassed = entry && result.cpuMs <= result.baselineCpuMs * limit && result.gpuMs <= result.baselineGpuMs * limit;
+}
+
+
+// Writes an RGB image (top row first) as a binary PPM, which stb_image reads back and most image viewers open
+bool UWritePpm(const string& path, const unsigned char* pixels, int width, int height)
+{
+    ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(pixels), std::streamsize(width) * height * 3);
+    if (!out)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << path;
+        return false;
+    }
+    return true;
+}
+
+
+// Writes the poses' median frame times as the baseline later regression runs are compared against
+bool UWriteRegressionBaseline(const vector<RegressionResult>& results, const string& path)
+{
+    ofstream json(path);
+    if (!json)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << path;
+        return false;
+    }
+
+    json << "{\n";
+    json << "  \"renderer\": \"" << UJsonEscape(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) << "\",\n";
+    json << "  \"width\": " << REGRESSION_WIDTH << ",\n";
+    json << "  \"height\": " << REGRESSION_HEIGHT << ",\n";
+    json << "  \"poses\": {\n";
+    for (size_t i = 0; i < results.size(); ++i)
+        json << "    \"" << UJsonEscape(results[i].name) << "\": { \"cpu_ms\": " << results[i].cpuMs << ", \"gpu_ms\": " << results[i].gpuMs
+            << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    json << "  }\n";
+    json << "}\n";
+
+    LogMessage(LOG_INFO) << "Frame time baseline written to " << path;
+    return true;
+}
+
+
+// Writes every pose's image differences and frame times, next to their references, to path
+bool UWriteRegressionResults(const vector<RegressionResult>& results, const string& path)
+{
+    ofstream json(path);
+    if (!json)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << path;
+        return false;
+    }
+
+    json << "{\n";
+    json << "  \"renderer\": \"" << UJsonEscape(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) << "\",\n";
+    json << "  \"width\": " << REGRESSION_WIDTH << ",\n";
+    json << "  \"height\": " << REGRESSION_HEIGHT << ",\n";
+    json << "  \"image_tolerance\": " << gImageTolerance << ",\n";
+    json << "  \"max_differing_fraction\": " << REGRESSION_MAX_DIFFERING_FRACTION << ",\n";
+    json << "  \"perf_threshold_percent\": " << gPerfThreshold << ",\n";
+    json << "  \"poses\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RegressionResult& result = results[i];
+        json << "    { \"name\": \"" << UJsonEscape(result.name) << "\", \"image_passed\": " << (result.imagePassed ? "true" : "false")
+            << ", \"max_delta_e\": " << result.maxDeltaE << ", \"mean_delta_e\": " << result.meanDeltaE
+            << ", \"differing_fraction\": " << result.differingFraction << ", \"perf_passed\": " << (result.perfPassed ? "true" : "false")
+            << ", \"cpu_ms\": " << result.cpuMs << ", \"baseline_cpu_ms\": " << result.baselineCpuMs
+            << ", \"gpu_ms\": " << result.gpuMs << ", \"baseline_gpu_ms\": " << result.baselineGpuMs
+            << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n";
+    json << "}\n";
+
+    LogMessage(LOG_INFO) << "Regression results written to " << path;
+    return true;
+}
+
+
+// process all input: check whether relevant keys are pressed/released this step and react accordingly. The key
+// state is polled from GLFW or replayed (UPollInputKeys, UReplayInput).
+void UProcessInput(GLFWwindow* window)
+{
+    static const float cameraSpeed = 2.5f;
+
+    if (UKeyDown(GLFW_KEY_ESCAPE))
+        glfwSetWindowShouldClose(window, true);
+
+    // Held movement keys move the camera every step
+    const glm::vec3 cameraPosition = gCamera.Position;
+    if (UKeyDown(GLFW_KEY_W))
+        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
+    if (UKeyDown(GLFW_KEY_S))
+        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
+    if (UKeyDown(GLFW_KEY_A))
+        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
+    if (UKeyDown(GLFW_KEY_D))
+        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+    if (UKeyDown(GLFW_KEY_Q))
+        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
+    if (UKeyDown(GLFW_KEY_E))
+        gCamera.ProcessKeyboard(UP, gDeltaTime);
+    if (gCamera.Position != cameraPosition)
+        gFrameDirty = true;
+
+    // The render thread applies the wrap mode (UApplySnapshotState)
+    if (UKeyDown(GLFW_KEY_1) && gTexWrapMode != GL_REPEAT)
+    {
+        gTexWrapMode = GL_REPEAT;
+        gFrameDirty = true;
+
+        LogMessage(LOG_INFO) << "Current Texture Wrapping Mode: REPEAT";
+    }
+    else if (UKeyDown(GLFW_KEY_2) && gTexWrapMode != GL_MIRRORED_REPEAT)
+    {
+        gTexWrapMode = GL_MIRRORED_REPEAT;
+        gFrameDirty = true;
+
+        LogMessage(LOG_INFO) << "Current Texture Wrapping Mode: MIRRORED REPEAT";
+    }
+    else if (UKeyDown(GLFW_KEY_3) && gTexWrapMode != GL_CLAMP_TO_EDGE)
+    {
+        gTexWrapMode = GL_CLAMP_TO_EDGE;
+        gFrameDirty = true;
+
+        LogMessage(LOG_INFO) << "Current Texture Wrapping Mode: CLAMP TO EDGE";
+    }
+    else if (UKeyDown(GLFW_KEY_4) && gTexWrapMode != GL_CLAMP_TO_BORDER)
+    {
+        gTexWrapMode = GL_CLAMP_TO_BORDER;
+        gFrameDirty = true;
+
+        LogMessage(LOG_INFO) << "Current Texture Wrapping Mode: CLAMP TO BORDER";
+    }
+
+    // The scale changes every frame a bracket key is held: report it a few times per second at most
+    static LogRateLimit scaleLogLimit;
+    if (UKeyDown(GLFW_KEY_RIGHT_BRACKET))
+    {
+        gUVScale += 0.1f;
+        gFrameDirty = true;
+        LogMessage(LOG_INFO, &scaleLogLimit) << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")";
+    }
+    else if (UKeyDown(GLFW_KEY_LEFT_BRACKET))
+    {
+        gUVScale -= 0.1f;
+        gFrameDirty = true;
+        LogMessage(LOG_INFO, &scaleLogLimit) << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")";
+    }
+
+    // Dump the profiler's recent history as a Chrome trace (once per key press, by the render thread)
+    static bool isF12KeyDown = false;
+    bool f12Pressed = UKeyDown(GLFW_KEY_F12);
+    if (f12Pressed && !isF12KeyDown)
+    {
+        gWriteTraceRequested = true;
+        gFrameDirty = true;
+    }
+    isF12KeyDown = f12Pressed;
+}
+
+
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+void UResizeWindow(GLFWwindow* window, int width, int height)
+{
+    URecordInput(INPUT_RECORD_RESIZE, width, height);
+
+    // Runs on the main thread: the render thread sets the viewport from the next snapshot
+    gViewportWidth = width;
+    gViewportHeight = height;
+    gFrameDirty = true;
+}
+
+
+// glfw: whenever the mouse moves, this callback is called
+// -------------------------------------------------------
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+    URecordInput(INPUT_RECORD_CURSOR, xpos, ypos);
+
+    if (gFirstMouse)
+    {
+        gLastX = xpos;
+        gLastY = ypos;
+        gFirstMouse = false;
+    }
+
+    float xoffset = xpos - gLastX;
+    float yoffset = gLastY - ypos; // reversed since y-coordinates go from bottom to top
+
+    gLastX = xpos;
+    gLastY = ypos;
+
+    gCamera.ProcessMouseMovement(xoffset, yoffset);
+    gFrameDirty = true;
+}
+
+
+// glfw: whenever the mouse scroll wheel scrolls, this callback is called
+// ----------------------------------------------------------------------
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    URecordInput(INPUT_RECORD_SCROLL, 0.0, yoffset);
+
+    gCamera.ProcessMouseScroll(yoffset);
+    gFrameDirty = true;
+}
+
+// glfw: handle mouse button events
+// --------------------------------
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    switch (button)
+    {
+    case GLFW_MOUSE_BUTTON_LEFT:
+    {
+        if (action == GLFW_PRESS)
+            LogMessage(LOG_DEBUG) << "Left mouse button pressed";
+        else
+            LogMessage(LOG_DEBUG) << "Left mouse button released";
+    }
+    break;
+
+    case GLFW_MOUSE_BUTTON_MIDDLE:
+    {
+        if (action == GLFW_PRESS)
+            LogMessage(LOG_DEBUG) << "Middle mouse button pressed";
+        else
+            LogMessage(LOG_DEBUG) << "Middle mouse button released";
+    }
+    break;
+
+    case GLFW_MOUSE_BUTTON_RIGHT:
+    {
+        if (action == GLFW_PRESS)
+            LogMessage(LOG_DEBUG) << "Right mouse button pressed";
+        else
+            LogMessage(LOG_DEBUG) << "Right mouse button released";
+    }
+    break;
+
+    default:
+        LogMessage(LOG_DEBUG) << "Unhandled mouse button event";
+        break;
+    }
+}
+
+
+// glfw: whenever the window contents were damaged (uncovered, restored etc.), this callback is called
+// --------------------------------------------------------------------------------------------------
+void UWindowRefreshCallback(GLFWwindow* window)
+{
+    gFrameDirty = true;
+}
+
+
+// Functioned called to render a frame
+void URender(const FrameSnapshot& snapshot)
+{
+    // Clear the frame and z buffers (depth testing and the clear color are set once in main)
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    gFrameStats.drawCalls = 0;
+
+    // Camera, light and projection data is identical for every program: upload it once per frame
+    FrameData frameData;
+    frameData.view = snapshot.view; // camera/view transformation
+    frameData.projection = glm::perspective(glm::radians(snapshot.cameraZoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, CAMERA_NEAR, CAMERA_FAR); // Creates a perspective projection
+    frameData.viewPosition = snapshot.cameraPosition;
+    frameData.lightPos = gLightPosition;
+    frameData.lightColor = gLightColor;
+
+    // Froxel grid of this view; the shaders find a fragment's depth slice as UClusterSlice does
+    const float sliceScale = float(CLUSTER_GRID_Z) / logf(CAMERA_FAR / CAMERA_NEAR);
+    frameData.clusterGrid[0] = CLUSTER_GRID_X;
+    frameData.clusterGrid[1] = CLUSTER_GRID_Y;
+    frameData.clusterGrid[2] = CLUSTER_GRID_Z;
+    frameData.clusterGrid[3] = GLuint(gLightOrbits.size());
+    frameData.clusterParams = glm::vec4(float(snapshot.viewportWidth), float(snapshot.viewportHeight), sliceScale, -logf(CAMERA_NEAR) * sliceScale);
+
+    // Everything rewritten per frame goes to this frame's region of the dynamic ring
+    UBeginDynamicFrame(gDynamicRing);
+    const DynamicRange frameDataRange = UWriteDynamic(gDynamicRing, &frameData, sizeof(FrameData), gDynamicRing.uniformAlignment);
+
+    // Move the point lights and bin them into the froxels of this view
+    ProfileMark lightMark = UProfileBegin("Light binning", false);
+    const int64_t lightStartNs = UProfileNow();
+    UAnimateLights(gLightOrbits, snapshot.animationNs, gLightClusters.lights);
+    UBinLights(gLightClusters, frameData.view, frameData.projection);
+    UUploadLightClusters(gLightClusters, gDynamicRing);
+    gFrameStats.lightBinMs = (UProfileNow() - lightStartNs) / 1.0e6;
+    gFrameStats.lightAssignments = GLuint(gLightClusters.indices.size());
+    gFrameStats.maxClusterLights = gLightClusters.maxClusterLights;
+    UProfileEnd(lightMark);
+
+    // UCreateMesh lays the cap out right after the bottle, so both are one index range
+    const GLSubMesh& bottle = gMesh.subMeshes[SUBMESH_BOTTLE];
+    const GLSubMesh& cap = gMesh.subMeshes[SUBMESH_CAP];
+    const GLSubMesh& plane = gMesh.subMeshes[SUBMESH_PLANE];
+    const GLsizei bottleAndCapCount = bottle.indexCount + cap.indexCount;
+
+    // Cull the scene against the view frustum; only the visible objects are submitted below
+    ProfileMark cullMark = UProfileBegin("Culling", false);
+    const int64_t cullStartNs = UProfileNow();
+    UCullScene(gScene, frameData.projection * frameData.view);
+    gFrameStats.cullMs = (UProfileNow() - cullStartNs) / 1.0e6;
+    gFrameStats.sceneObjects = GLuint(gScene.objects.size());
+    gFrameStats.visibleObjects = 0;
+    for (const vector<GLuint>& visible : gScene.visible)
+        gFrameStats.visibleObjects += GLuint(visible.size());
+    UProfileEnd(cullMark);
+
+    // The pyramid and the plane share the textured, specular material variant
+    const GLMaterialProgram* material = UGetMaterialProgram(MATERIAL_TEXTURED | MATERIAL_SPECULAR);
+    const GLMaterialProgram* instancedMaterial = gInstanceCount > 0 && gUseInstancing ?
+        UGetMaterialProgram(MATERIAL_TEXTURED | MATERIAL_SPECULAR | MATERIAL_INSTANCED) : nullptr;
+    const GLMaterialProgram* untexturedMaterial = gModelMesh.vao ? UGetMaterialProgram(MATERIAL_SPECULAR) : nullptr;
+    if (!material || (gInstanceCount > 0 && gUseInstancing && !instancedMaterial) || (gModelMesh.vao && !untexturedMaterial))
+        return;
+
+    // Record one command per visible object (and one for all visible bottle copies when instancing)
+    ProfileMark queueMark = UProfileBegin("Render queue", false);
+    RenderQueue& queue = gRenderQueue;
+    queue.commands.clear();
+
+    // Depth from the camera to the object's center, over the far plane distance: opaque objects go front to back
+    auto depthOf = [&snapshot](const SceneObject& object) { return glm::distance(snapshot.cameraPosition, (object.boundsMin + object.boundsMax) * 0.5f) / CAMERA_FAR; };
+    auto record = [&queue](RenderPass pass, float depth, RenderCommand command)
+    {
+        command.key = URenderKey(pass, command.program, command.vao, depth);
+        queue.commands.push_back(command);
+    };
+
+    // Pyramid: draw pyramid
+    for (GLuint objectIndex : gScene.visible[SCENE_BOTTLE])
+    {
+        const SceneObject& object = gScene.objects[objectIndex];
+        record(RENDER_PASS_LIT, depthOf(object), { 0, material->programId, &material->uniforms, true, glm::vec3(1.0f), gTextureIdPink, gMesh.vao,
+            &gMesh, bottle.firstIndex, bottleAndCapCount, 0, &object, 0 });
+    }
+
+    const vector<GLuint>& visibleCopies = gScene.visible[SCENE_BOTTLE_COPY];
+    if (gUseInstancing && !visibleCopies.empty())
+    {
+        // Instances: draw every visible bottle copy with one instanced call
+        // Only the copies that passed culling are uploaded
+        gVisibleInstances.clear();
+        for (GLuint objectIndex : visibleCopies)
+            gVisibleInstances.push_back(gInstances[gScene.objects[objectIndex].instance]);
+        const DynamicRange instances = UWriteDynamic(gDynamicRing, gVisibleInstances.data(), gVisibleInstances.size() * sizeof(InstanceData), sizeof(glm::vec4));
+
+        record(RENDER_PASS_LIT, 0.0f, { 0, instancedMaterial->programId, &instancedMaterial->uniforms, true, glm::vec3(1.0f), gTextureIdPink, gInstanceBuffer.vao,
+            &gMesh, bottle.firstIndex, bottleAndCapCount, GLsizei(gVisibleInstances.size()), nullptr, instances.offset });
+    }
+    else
+    {
+        // Instances: draw every visible bottle copy with its own call, for comparison with the instanced path.
+        // The copy's tint goes in as the object color, so both paths draw the same picture.
+        for (GLuint objectIndex : visibleCopies)
+        {
+            const SceneObject& object = gScene.objects[objectIndex];
+            const glm::vec3 tint(gInstances[object.instance].color);
+            record(RENDER_PASS_LIT, depthOf(object), { 0, material->programId, &material->uniforms, true, tint, gTextureIdPink, gMesh.vao,
+                &gMesh, bottle.firstIndex, bottleAndCapCount, 0, &object, 0 });
+        }
+    }
+
+    // Plane: draw plane
+    for (GLuint objectIndex : gScene.visible[SCENE_PLANE])
+    {
+        const SceneObject& object = gScene.objects[objectIndex];
+        record(RENDER_PASS_LIT, depthOf(object), { 0, material->programId, &material->uniforms, true, glm::vec3(1.0f), gTextureIdGranite, gMesh.vao,
+            &gMesh, plane.firstIndex, plane.indexCount, 0, &object, 0 });
+    }
+
+    // Model: one draw per visible object, textured if its material has a texture
+    for (GLuint objectIndex : gScene.visible[SCENE_MODEL])
+    {
+        const SceneObject& object = gScene.objects[objectIndex];
+        const GLSubMesh& subMesh = gModelMesh.subMeshes[object.subMesh];
+        const GLMaterial* surface = subMesh.material >= 0 ? &gModelMesh.materials[subMesh.material] : nullptr;
+        const GLMaterialProgram* variant = surface && surface->textureId ? material : untexturedMaterial;
+        const glm::vec3 color = variant == material ? glm::vec3(1.0f) : surface ? surface->color : gObjectColor;
+        record(RENDER_PASS_LIT, depthOf(object), { 0, variant->programId, &variant->uniforms, true, color,
+            surface ? GLuint(surface->textureId) : 0, gModelMesh.vao, &gModelMesh, subMesh.firstIndex, subMesh.indexCount, 0, &object, 0 });
+    }
+
+    // LAMP: draw lamp (the smaller pyramid is used as a visual que for the light source)
+    for (GLuint objectIndex : gScene.visible[SCENE_LAMP])
+    {
+        const SceneObject& object = gScene.objects[objectIndex];
+        record(RENDER_PASS_UNLIT, depthOf(object), { 0, gLampProgramId, &gLampUniforms, false, gLightColor, 0, gMesh.vao,
+            &gMesh, bottle.firstIndex, bottle.indexCount, 0, &object, 0 });
+    }
+
+    USortRenderQueue(queue);
+
+    // Per-draw data and indirect commands of the sorted queue, and the texture slots they refer to
+    UWriteRenderQueueData(queue, gTextureTable, gDynamicRing);
+    UUploadTextureTable(gTextureTable, gDynamicRing);
+    gFrameStats.drawCommands = GLuint(queue.commands.size());
+    UProfileEnd(queueMark);
+
+    // Texture uploads and shader builds bind objects outside the cache between frames: start from unknown state
+    ProfileMark drawMark = UProfileBegin("Draw", true);
+    UResetStateCache(gStateCache);
+
+    // The frame's data is complete (and the ring's buffer will not change any more): bind it
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, gDynamicRing.buffer, UDynamicOffset(gDynamicRing, frameDataRange.offset), frameDataRange.size);
+    UBindLightClusters(gLightClusters, gDynamicRing);
+    UBindTextureTable(gTextureTable, gDynamicRing);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, OBJECT_BUFFER_BINDING, gDynamicRing.buffer, UDynamicOffset(gDynamicRing, queue.objectData.offset),
+        queue.objectData.size);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gDynamicRing.buffer);
+
+    UExecuteRenderQueue(queue, snapshot, gStateCache);
+    UEndDynamicFrame(gDynamicRing);
+    gFrameStats.stateChanges = gStateCache.stateChanges;
+    gFrameStats.redundantStateChanges = gStateCache.redundantStateChanges;
+    UProfileEnd(drawMark);
+}
+
+
+// Packs a draw's sort key, most significant first: pass (4 bits), program (8), VAO (8) and quantized depth
+// (24). Textures come from the texture table, so they do not split the runs UExecuteRenderQueue merges.
+// GL names are small sequential integers, so their low byte tells them apart; a collision only costs
+// sort quality, as the state cache compares full names.
+uint64_t URenderKey(RenderPass pass, GLuint program, GLuint vao, float depth)
+{
+    const uint64_t depthBits = uint64_t(glm::clamp(depth, 0.0f, 1.0f) * float(0xFFFFFF));
+    return (uint64_t(pass & 0xF) << 60) | (uint64_t(program & 0xFF) << 52) | (uint64_t(vao & 0xFF) << 44) | (depthBits << 20);
+}
+
+
+// Orders the queue's commands by key: a stable least-significant-digit radix sort on bytes, skipping the
+// bytes every key shares (most of them in a small scene)
+void USortRenderQueue(RenderQueue& queue)
+{
+    vector<RenderSortEntry>& entries = queue.entries;
+    vector<RenderSortEntry>& scratch = queue.scratch;
+
+    entries.resize(queue.commands.size());
+    for (GLuint i = 0; i < GLuint(queue.commands.size()); ++i)
+        entries[i] = { queue.commands[i].key, i };
+    if (entries.size() < 2)
+        return;
+    scratch.resize(entries.size());
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[256] = {};
+        for (const RenderSortEntry& entry : entries)
+            ++counts[(entry.key >> shift) & 0xFF];
+        if (counts[(entries[0].key >> shift) & 0xFF] == entries.size())
+            continue;
+
+        size_t offset = 0;
+        for (size_t& count : counts)
+        {
+            const size_t bucketSize = count;
+            count = offset;
+            offset += bucketSize;
+        }
+
+        for (const RenderSortEntry& entry : entries)
+            scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+        entries.swap(scratch);
+    }
+}
+
+
+// Writes the per-draw data of the sorted queue into the dynamic ring: every command's ObjectData and draw
+// index (in recording order), and its indirect draw command (in execution order, so each run of commands
+// UExecuteRenderQueue merges is one contiguous range of the indirect buffer)
+void UWriteRenderQueueData(RenderQueue& queue, const TextureTable& table, DynamicRing& ring)
+{
+    const size_t count = std::max(queue.commands.size(), size_t(1));
+    queue.objectData = UAllocateDynamic(ring, count * sizeof(ObjectData), ring.storageAlignment);
+    queue.drawIndices = UAllocateDynamic(ring, count * sizeof(GLuint), sizeof(GLuint));
+    queue.drawCommands = UAllocateDynamic(ring, count * sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+    if (queue.objectData.size == 0 || queue.drawIndices.size == 0 || queue.drawCommands.size == 0)
+        return;
+
+    // The ring is write-only: fill the entries field by field, never read them back
+    ObjectData* objects = reinterpret_cast<ObjectData*>(ring.mapped + UDynamicOffset(ring, queue.objectData.offset));
+    GLuint* drawIndices = reinterpret_cast<GLuint*>(ring.mapped + UDynamicOffset(ring, queue.drawIndices.offset));
+    for (GLuint i = 0; i < GLuint(queue.commands.size()); ++i)
+    {
+        const RenderCommand& command = queue.commands[i];
+        ObjectData& object = objects[i];
+        object.model = command.object ? command.object->model : glm::mat4(1.0f);
+        for (int column = 0; column < 3; ++column)
+            object.normalMatrix[column] = command.object ? glm::vec4(command.object->normalMatrix[column], 0.0f) : glm::vec4(0.0f);
+        object.color = glm::vec4(command.color, 1.0f);
+        object.positionScale = command.mesh->positionScale;
+        object.textureSlot = command.texture ? UTextureSlot(table, command.texture) : 0;
+        object.positionOffset = command.mesh->positionOffset;
+        drawIndices[i] = i;
+    }
+
+    // A single draw passes its command's index as base instance, which offsets the draw index attribute.
+    // Instanced draws keep base instance 0 for their instance attributes (see UExecuteRenderQueue).
+    DrawElementsIndirectCommand* drawCommands = reinterpret_cast<DrawElementsIndirectCommand*>(ring.mapped + UDynamicOffset(ring, queue.drawCommands.offset));
+    for (size_t i = 0; i < queue.entries.size(); ++i)
+    {
+        const GLuint commandIndex = queue.entries[i].command;
+        const RenderCommand& command = queue.commands[commandIndex];
+        DrawElementsIndirectCommand& draw = drawCommands[i];
+        draw.count = GLuint(command.indexCount);
+        draw.instanceCount = command.instanceCount > 0 ? GLuint(command.instanceCount) : 1;
+        draw.firstIndex = command.firstIndex;
+        draw.baseVertex = 0;
+        draw.baseInstance = command.instanceCount > 0 ? 0 : commandIndex;
+    }
+}
+
+
+// Forgets the cached state, so the next bind of each kind is issued
+void UResetStateCache(GLStateCache& cache)
+{
+    cache.program = STATE_UNKNOWN;
+    cache.vao = STATE_UNKNOWN;
+    cache.stateChanges = 0;
+    cache.redundantStateChanges = 0;
+
+    // The texture array is bound to texture unit 0
+    glActiveTexture(GL_TEXTURE0);
+}
+
+
+// Binds through the cache; each returns true if the state changed
+bool UCacheUseProgram(GLStateCache& cache, GLuint program)
+{
+    if (cache.program == program)
+    {
+        ++cache.redundantStateChanges;
+        return false;
+    }
+    glUseProgram(program);
+    cache.program = program;
+    ++cache.stateChanges;
+    return true;
+}
+
+
+bool UCacheBindVertexArray(GLStateCache& cache, GLuint vao)
+{
+    if (cache.vao == vao)
+    {
+        ++cache.redundantStateChanges;
+        return false;
+    }
+    glBindVertexArray(vao);
+    cache.vao = vao;
+    ++cache.stateChanges;
+    return true;
+}
+
+
+// Issues the sorted commands as multi-draw calls: each run of commands with the same program and VAO is
+// one glMultiDrawElementsIndirect, as the shaders fetch everything else per draw (see UWriteRenderQueueData)
+void UExecuteRenderQueue(const RenderQueue& queue, const FrameSnapshot& snapshot, GLStateCache& cache)
+{
+    if (queue.drawCommands.size == 0)
+        return;
+
+    const vector<RenderSortEntry>& entries = queue.entries;
+    size_t first = 0;
+    while (first < entries.size())
+    {
+        const RenderCommand& command = queue.commands[entries[first].command];
+
+        // Instanced draws are not merged: each binds its own instances
+        size_t last = first + 1;
+        while (command.instanceCount == 0 && last < entries.size())
+        {
+            const RenderCommand& next = queue.commands[entries[last].command];
+            if (next.program != command.program || next.vao != command.vao || next.instanceCount > 0)
+                break;
+            ++last;
+        }
+
+        // The texture scale is the same for every object: set it whenever the program is (re)bound
+        if (UCacheUseProgram(cache, command.program) && command.material)
+            glUniform2fv(command.uniforms->uvScale, 1, glm::value_ptr(snapshot.uvScale));
+
+        // Single draws read their draw index at their base instance; an instanced draw reads it at the start
+        // of its binding, which is why it points at its own entry
+        if (command.instanceCount > 0)
+        {
+            UCacheBindVertexArray(cache, command.vao);
+            glBindVertexBuffer(INSTANCE_VERTEX_BINDING, gDynamicRing.buffer, UDynamicOffset(gDynamicRing, command.dynamicOffset), sizeof(InstanceData));
+            glBindVertexBuffer(DRAW_INDEX_VERTEX_BINDING, gDynamicRing.buffer, UDynamicOffset(gDynamicRing, queue.drawIndices.offset) + sizeof(GLuint) * entries[first].command,
+                sizeof(GLuint));
+        }
+        else if (UCacheBindVertexArray(cache, command.vao))
+            glBindVertexBuffer(DRAW_INDEX_VERTEX_BINDING, gDynamicRing.buffer, UDynamicOffset(gDynamicRing, queue.drawIndices.offset), sizeof(GLuint));
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES, command.mesh->indexType, (const void*)(UDynamicOffset(gDynamicRing, queue.drawCommands.offset) + sizeof(DrawElementsIndirectCommand) * first),
+            GLsizei(last - first), 0);
+        ++gFrameStats.drawCalls;
+        first = last;
+    }
+}
+
+
+// Scatters count point lights over the ground plane, each circling its own center, with a hue per light
+void UCreateStressLights(GLsizei count, vector<LightOrbit>& orbits)
+{
+    const float extent = UPlaneExtent();
+
+    // Fixed-seed LCG, so every run (and every benchmark) sees the same lights
+    uint32_t seed = 12345u;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return float(seed >> 8) / float(1 << 24); };
+
+    orbits.resize(count);
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        LightOrbit& orbit = orbits[i];
+        orbit.center = gPlanePosition + glm::vec3((random() - 0.5f) * extent, 0.2f + 1.3f * random(), (random() - 0.5f) * extent);
+        orbit.orbitRadius = 0.2f + 0.8f * random();
+        orbit.speed = (random() - 0.5f) * 4.0f;
+        orbit.phase = 6.2831853f * random();
+
+        const float hue = random();
+        orbit.light.position = orbit.center;
+        orbit.light.radius = 1.0f + 1.5f * random();
+        orbit.light.color = glm::vec3(0.5f + 0.5f * cosf(6.2831853f * hue), 0.5f + 0.5f * cosf(6.2831853f * (hue - 0.333f)),
+            0.5f + 0.5f * cosf(6.2831853f * (hue - 0.667f)));
+        orbit.light.intensity = 1.5f;
+    }
+}
+
+
+// Moves the point lights along their orbits to the given animation time
+void UAnimateLights(const vector<LightOrbit>& orbits, int64_t timeNs, vector<PointLight>& lights)
+{
+    // Angles are reduced to one turn in double precision, so the orbits stay smooth after weeks of running
+    const double time = timeNs / 1.0e9;
+    lights.resize(orbits.size());
+    for (size_t i = 0; i < orbits.size(); ++i)
+    {
+        const LightOrbit& orbit = orbits[i];
+        const float angle = orbit.phase + float(fmod(orbit.speed * time, 6.283185307179586));
+        lights[i] = orbit.light;
+        lights[i].position = orbit.center + orbit.orbitRadius * glm::vec3(cosf(angle), 0.0f, sinf(angle));
+    }
+}
+
+
+// Sizes the cluster ranges of the froxel grid; the light lists are written to the dynamic ring every frame
+void UCreateLightClusters(LightClusters& clusters)
+{
+    clusters.ranges.assign(CLUSTER_COUNT, ClusterRange());
+}
+
+
+// Depth slice of the froxel grid holding a view-space distance: slices are spaced exponentially between
+// CAMERA_NEAR and CAMERA_FAR, so froxels stay roughly cubic at every distance
+GLuint UClusterSlice(float depth)
+{
+    const float slice = logf(depth / CAMERA_NEAR) * float(CLUSTER_GRID_Z) / logf(CAMERA_FAR / CAMERA_NEAR);
+    return GLuint(glm::clamp(slice, 0.0f, float(CLUSTER_GRID_Z - 1)));
+}
+
+
+// Bins the lights into the froxel grid of the camera. Each light covers the box of froxels overlapping the
+// screen-space bounds of its sphere; a counting pass and a filling pass leave the light indices grouped by
+// cluster, with each cluster's range in ranges.
+void UBinLights(LightClusters& clusters, const glm::mat4& view, const glm::mat4& projection)
+{
+    const vector<PointLight>& lights = clusters.lights;
+    clusters.bounds.resize(lights.size());
+    for (ClusterRange& range : clusters.ranges)
+        range.count = 0;
+
+    // Tile range of one axis: the sphere's bounding box over the depth range, projected (ndc = scale * x / depth)
+    auto tileRange = [](float center, float radius, float depthMin, float depthMax, float scale, GLuint tiles, GLuint& first, GLuint& last)
+    {
+        const float low = center - radius;
+        const float high = center + radius;
+        const float ndcLow = scale * low / (low >= 0.0f ? depthMax : depthMin);
+        const float ndcHigh = scale * high / (high >= 0.0f ? depthMin : depthMax);
+        if (ndcHigh < -1.0f || ndcLow > 1.0f)
+            return false;
+        first = GLuint(std::min(std::max(int(floorf((ndcLow * 0.5f + 0.5f) * tiles)), 0), int(tiles) - 1));
+        last = GLuint(std::min(std::max(int(floorf((ndcHigh * 0.5f + 0.5f) * tiles)), 0), int(tiles) - 1));
+        return true;
+    };
+
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        const PointLight& light = lights[i];
+        ClusterBounds& bounds = clusters.bounds[i];
+        bounds.visible = false;
+
+        // View space looks down -z: depth is the distance along the view direction
+        const glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        const float depthMin = glm::max(-center.z - light.radius, CAMERA_NEAR);
+        const float depthMax = glm::min(-center.z + light.radius, CAMERA_FAR);
+        if (depthMin > depthMax)
+            continue;
+
+        if (!tileRange(center.x, light.radius, depthMin, depthMax, projection[0][0], CLUSTER_GRID_X, bounds.first[0], bounds.last[0]) ||
+            !tileRange(center.y, light.radius, depthMin, depthMax, projection[1][1], CLUSTER_GRID_Y, bounds.first[1], bounds.last[1]))
+            continue;
+        bounds.first[2] = UClusterSlice(depthMin);
+        bounds.last[2] = UClusterSlice(depthMax);
+        bounds.visible = true;
+
+        for (GLuint z = bounds.first[2]; z <= bounds.last[2]; ++z)
+            for (GLuint y = bounds.first[1]; y <= bounds.last[1]; ++y)
+                for (GLuint x = bounds.first[0]; x <= bounds.last[0]; ++x)
+                    ++clusters.ranges[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x].count;
+    }
+
+    GLuint offset = 0;
+    clusters.maxClusterLights = 0;
+    for (ClusterRange& range : clusters.ranges)
+    {
+        range.offset = offset;
+        offset += range.count;
+        clusters.maxClusterLights = std::max(clusters.maxClusterLights, range.count);
+        range.count = 0;
+    }
+    clusters.indices.resize(offset);
+
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        const ClusterBounds& bounds = clusters.bounds[i];
+        if (!bounds.visible)
+            continue;
+        for (GLuint z = bounds.first[2]; z <= bounds.last[2]; ++z)
+            for (GLuint y = bounds.first[1]; y <= bounds.last[1]; ++y)
+                for (GLuint x = bounds.first[0]; x <= bounds.last[0]; ++x)
+                {
+                    ClusterRange& range = clusters.ranges[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x];
+                    clusters.indices[range.offset + range.count++] = GLuint(i);
+                }
+    }
+}
+
+
+// Creates the dynamic ring: one buffer of DYNAMIC_RING_REGIONS regions, mapped once for the whole run.
+// The mapping is coherent, so writes reach the GPU without flushes; the fences keep them off data in flight.
+bool UCreateDynamicRing(DynamicRing& ring, size_t regionSize)
+{
+    GLint uniformAlignment = 0;
+    GLint storageAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    ring.uniformAlignment = size_t(std::max(uniformAlignment, 1));
+    ring.storageAlignment = size_t(std::max(storageAlignment, 1));
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    ring.buffer.create("dynamic data ring");
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * DYNAMIC_RING_REGIONS, NULL, flags);
+    USetResourceSize(RESOURCE_BUFFER, ring.buffer, regionSize * DYNAMIC_RING_REGIONS);
+    ring.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * DYNAMIC_RING_REGIONS, flags));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    ring.regionSize = regionSize;
+    for (GLsync& fence : ring.fences)
+        fence = 0;
+    ring.region = 0;
+    ring.used = 0;
+
+    if (!ring.mapped)
+    {
+        LogMessage(LOG_ERROR) << "Failed to map the dynamic data buffer";
+        ring.buffer.reset();
+        return false;
+    }
+    return true;
+}
+
+
+void UDestroyDynamicRing(DynamicRing& ring)
+{
+    for (GLsync& fence : ring.fences)
+        if (fence)
+        {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    ring.buffer.reset();  // Also unmaps it
+    ring.mapped = nullptr;
+}
+
+
+// Starts writing the next region. If the GPU is still reading the frame that last used it, this is the
+// only place the CPU waits; the time it waits is reported as fence wait time.
+void UBeginDynamicFrame(DynamicRing& ring)
+{
+    ring.region = (ring.region + 1) % DYNAMIC_RING_REGIONS;
+    ring.used = 0;
+    gFrameStats.uploadBytes = 0;
+    gFrameStats.fenceWaitMs = 0.0;
+
+    GLsync& fence = ring.fences[ring.region];
+    if (!fence)
+        return;
+
+    // Poll first: with DYNAMIC_RING_REGIONS frames of slack the region is normally free already
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        const int64_t waitStartNs = UProfileNow();
+        do
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        while (status == GL_TIMEOUT_EXPIRED);
+        gFrameStats.fenceWaitMs = (UProfileNow() - waitStartNs) / 1.0e6;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+
+// Fences the current region after the frame's last command that reads it
+void UEndDynamicFrame(DynamicRing& ring)
+{
+    ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+
+// Replaces the ring with one whose regions hold at least minimumRegionSize bytes. The bytes already written
+// this frame are copied to the start of the same region in the new buffer, which moves with the region size:
+// the ranges handed out so far stay valid because their offsets are region-relative (UDynamicOffset), and
+// because the frame's ranges are only bound after its last write. The old buffer is released at once: the GL
+// keeps it alive until the frames in flight are done with it.
+void UGrowDynamicRing(DynamicRing& ring, size_t minimumRegionSize)
+{
+    size_t regionSize = ring.regionSize;
+    while (regionSize < minimumRegionSize)
+        regionSize *= 2;
+
+    DynamicRing grown;
+    if (!UCreateDynamicRing(grown, regionSize))
+        return;
+    grown.region = ring.region;
+    grown.used = ring.used;
+
+    // The mappings are write-only: the GL copies the bytes (coherent writes are visible to later commands)
+    glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown.buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(ring.region * ring.regionSize),
+        GLintptr(grown.region * grown.regionSize), GLsizeiptr(ring.used));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    UDestroyDynamicRing(ring);
+    ring = std::move(grown);
+    LogMessage(LOG_INFO) << "Dynamic data buffer grown to " << DYNAMIC_RING_REGIONS << " x " << regionSize / 1024 << " KB";
+}
+
+
+// Reserves size bytes of the current region (at the given offset alignment) and returns their region-relative
+// range. The write pointer for the range is ring.mapped + UDynamicOffset(ring, range.offset), valid until the
+// next allocation.
+DynamicRange UAllocateDynamic(DynamicRing& ring, size_t size, size_t alignment)
+{
+    size_t offset = (ring.used + alignment - 1) / alignment * alignment;
+    if (offset + size > ring.regionSize)
+    {
+        UGrowDynamicRing(ring, offset + size);
+        if (offset + size > ring.regionSize)
+        {
+            // Out of memory: hand out an empty range, which the GL rejects when it is bound
+            DynamicRange empty = { 0, 0 };
+            return empty;
+        }
+    }
+
+    ring.used = offset + size;
+    gFrameStats.uploadBytes += size;
+    DynamicRange range = { GLintptr(offset), GLsizeiptr(size) };
+    return range;
+}
+
+
+// Offset in the ring's buffer of a region-relative offset handed out this frame
+GLintptr UDynamicOffset(const DynamicRing& ring, GLintptr offset)
+{
+    return GLintptr(ring.region * ring.regionSize) + offset;
+}
+
+
+// Copies data into the current region and returns its range
+DynamicRange UWriteDynamic(DynamicRing& ring, const void* data, size_t size, size_t alignment)
+{
+    DynamicRange range = UAllocateDynamic(ring, size, alignment);
+    if (size > 0 && range.size > 0)
+        memcpy(ring.mapped + UDynamicOffset(ring, range.offset), data, size);
+    return range;
+}
+
+
+// Writes the lights, the cluster ranges and the light index list into the dynamic ring. Empty lists still
+// take one element, so every binding is a valid range.
+void UUploadLightClusters(LightClusters& clusters, DynamicRing& ring)
+{
+    auto upload = [&ring](const void* data, size_t size, size_t minimumSize)
+    {
+        DynamicRange range = UAllocateDynamic(ring, std::max(size, minimumSize), ring.storageAlignment);
+        if (size > 0 && range.size > 0)
+            memcpy(ring.mapped + UDynamicOffset(ring, range.offset), data, size);
+        return range;
+    };
+    clusters.lightData = upload(clusters.lights.data(), clusters.lights.size() * sizeof(PointLight), sizeof(PointLight));
+    clusters.rangeData = upload(clusters.ranges.data(), clusters.ranges.size() * sizeof(ClusterRange), sizeof(ClusterRange));
+    clusters.indexData = upload(clusters.indices.data(), clusters.indices.size() * sizeof(GLuint), sizeof(GLuint));
+}
+
+
+// Binds the light lists UUploadLightClusters wrote this frame to their shader storage binding points
+void UBindLightClusters(const LightClusters& clusters, const DynamicRing& ring)
+{
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, ring.buffer, UDynamicOffset(ring, clusters.lightData.offset), clusters.lightData.size);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_RANGE_BUFFER_BINDING, ring.buffer, UDynamicOffset(ring, clusters.rangeData.offset), clusters.rangeData.size);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_BUFFER_BINDING, ring.buffer, UDynamicOffset(ring, clusters.indexData.offset), clusters.indexData.size);
+}
+
+
+// Implements the UCreateMesh function
+void UCreateMesh(GLMesh& mesh)
+{
+    // Position and Color data
+    GLfloat verts[] = {
+        //Positions          //Normals
+        // ------------------------------------------------------
+        //Front Left Face    //Negative Z Normal  Texture Coords.
+        //Triangular Prism (Lotion Bottle)
+        //Triangle 1 Left Face 
+         0.35f,  1.0f,  -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Top Left Vertex 1  
+         0.45f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
+         0.45f,  0.2f,  -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
+        //Triangle 2 Right Face
+         0.75f,  0.2f,  -0.25f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
+         0.85f,  1.0f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Vertex 0 
+         0.75f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
+        //Triangle 3 Back Face
+         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
+         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Left Vertex 1 
+         0.75f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 5 
+        //Triangle 4 Back Face
+         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Left Vertex 1 
+         0.45f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
+         0.75f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 5        
+        //Triangle 5 Front Face
+         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
+         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Top Left Vertex 1  
+         0.45f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
+        //Triangle 6 Front Face
+         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
+         0.45f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 3 
+         0.75f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
+        //Triangle 7 Bottom Face
+         0.75f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
+         0.45f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
+         0.45f,  0.2f,  -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
+        //Triangle 8 Bottom Face
+         0.75f,  0.2f,  -0.25f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
+         0.45f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 3 
+         0.75f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
+
+        //Cylinder (Lotion Bottle Cap)
+        //Bottom Circle
+         //Triangle 1
+         0.6f,  0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.45f, 0.01f, -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
+         0.43f,  0.01f, -0.2f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1    
+         //Triangle 2
+         0.6f,  0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.6f,  0.01f, -0.26f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Center Back Vertex 3 
+         0.45f, 0.01f, -0.25f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Back Vertex 2 
+         //Triangle 3
+         0.6f,  0.01f, -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.75f, 0.01f, -0.25f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Bottom Right Back Vertex 4 
+         0.6f,  0.01f, -0.26f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Center Back Vertex 3 
+         //Triangle 4
+         0.6f,  0.01f, -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.77f,  0.01f, -0.2f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Right Vertex 5 
+         0.75f, 0.01f, -0.25f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 4 
+         //Triangle 5
+         0.6f,  0.01f, -0.2f,   0.0f, -1.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.75f, 0.01f, -0.15f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f, // Bottom Right Front Vertex 6 
+         0.77f,  0.01f, -0.2f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Vertex 5 
+         //Triangle 6
+         0.6f,  0.01f, -0.2f,   0.0f,  1.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.6f,  0.01f, -0.14f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f, // Bottom Center Front Vertex 7 
+         0.75f, 0.01f, -0.15f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 6 
+         //Triangle 7
+         0.6f,  0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.45f, 0.01f, -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 8 
+         0.6f,  0.01f, -0.14f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Center Front Vertex 7 
+         //Triangle 8
+         0.6f,  0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
+         0.43f, 0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Vertex 1  
+         0.45f, 0.01f, -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
+
+         //The circles connecting planes
+         //Plane 1 Front
+         0.6f,  0.01f, -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Bottom Center Front Vertex 7 
+         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Center Front Vertex 7 
+         0.45f, 0.01f, -0.15f,   0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
+         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Center Front Vertex 7 
+         0.45f, 0.2f,  -0.15f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Left Front Vertex 8 
+         0.45f, 0.01f, -0.15f,   0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
+         //Plane 2 Front
+         0.75f, 0.01f, -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Bottom Right Front Vertex 6 
+         0.75f, 0.2f,  -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f,// Bottom Right Front Vertex 6 
+         0.6f,  0.01f, -0.14f,   0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Center Front Vertex 7 
+         0.75f, 0.2f,  -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Bottom Right Front Vertex 6 
+         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Center Front Vertex 7 
+         0.6f,  0.01f, -0.14f,   0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Center Front Vertex 7 
+         //Plane 3 Left Front
+         0.45f, 0.01f, -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,// Bottom Left Front Vertex 8 
+         0.45f, 0.2f,  -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 8 
+         0.43f, 0.01f, -0.2f,    -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1  
+         0.45f, 0.2f,  -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Left Front Vertex 8 
+         0.43f, 0.2f,  -0.2f,    -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,// Bottom Left Vertex 1 
+         0.43f, 0.01f, -0.2f,    -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1 
+         //Plane 4 Right Front
+         0.77f, 0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Vertex 5 
+         0.77f, 0.2f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Vertex 5 
+         0.75f, 0.01f, -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 6 
+         0.77f, 0.2f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Top Right Vertex 5 
+         0.75f, 0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Front Vertex 6 
+         0.75f, 0.01f, -0.15f,  1.0f,  0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 6 
+         //Plane 5 Back
+         0.75f, 0.01f, -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 4 
+         0.75f, 0.2f,  -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
+         0.6f,  0.01f, -0.26f,  0.0f, -1.0f, 0.0f,   0.0f, 1.0f, // Bottom Center Back Vertex 3 
+         0.75f, 0.2f,  -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Top Right Back Vertex 4 
+         0.6f,  0.2f,  -0.26f,  0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
+         0.6f,  0.01f, -0.26f,  0.0f, -1.0f, 0.0f,   0.0f, 1.0f, // Bottom Center Back Vertex 3 
+         //Plane 6 Back
+         0.6f,  0.01f, -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Bottom Center Back Vertex 3 
+         0.6f,  0.2f,  -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
+         0.45f, 0.01f, -0.25f,  0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Back Vertex 2 
+         0.6f,  0.2f,  -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Top Center Back Vertex 3 
+         0.45f, 0.2f,  -0.25f,  0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
+         0.45f, 0.01f, -0.25f,  0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Back Vertex 2 
+         //Plane 7 Back Left
+         0.45f, 0.01f, -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Bottom Left Back Vertex 2 
+         0.45f, 0.2f,  -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
+         0.43f, 0.01f, -0.2f,  -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Vertex 1  
+         0.45f, 0.2f,  -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Top Left Back Vertex 2 
+         0.43f, 0.2f,  -0.2f,  -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Left Vertex 1  
+         0.43f, 0.01f, -0.2f,  -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Vertex 1 
+         //Plane 8 Back Right
+         0.77f, 0.01f, -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Bottom Right Vertex 5 
+         0.77f, 0.2f,  -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Vertex 5 
+         0.75f, 0.01f, -0.25f,  1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Back Vertex 4 
+         0.77f, 0.2f,  -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Top Right Vertex 5 
+         0.75f, 0.2f,  -0.25f,  1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
+         0.75f, 0.01f, -0.25f,  1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Back Vertex 4      
+
+         //Top Circle
+         //Triangle 1
+         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.45f, 0.2f, -0.25f, 0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
+         0.43f, 0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   0.0f, 1.0f, // Top Left Vertex 1    
+         //Triangle 2
+         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.6f,  0.2f, -0.26f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
+         0.45f, 0.2f, -0.25f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,// Top Left Back Vertex 2 
+         //Triangle 3
+         0.6f,  0.2f, -0.2f,  -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.75f, 0.2f, -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
+         0.6f,  0.2f, -0.26f, -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Top Center Back Vertex 3 
+         //Triangle 4
+         0.6f,  0.2f, -0.2f,  1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.77f, 0.2f, -0.2f,  1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Vertex 5 
+         0.75f, 0.2f, -0.25f, 1.0f, 0.0f, 0.0f,   0.0f, 1.0f,// Top Right Back Vertex 4 
+         //Triangle 5
+         0.6f,  0.2f, -0.2f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.75f, 0.2f, -0.15f, 0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Right Front Vertex 6 
+         0.77f, 0.2f, -0.2f, 0.0f,  -1.0f, 0.0f,   0.0f, 1.0f, // Top Right Vertex 5 
+         //Triangle 6
+         0.6f,  0.2f, -0.2f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.6f,  0.2f, -0.14f, 0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Center Front Vertex 7 
+         0.75f, 0.2f, -0.15f, 0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Top Right Front Vertex 6 
+         //Triangle 7
+         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.45f, 0.2f, -0.15f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f, // Top Left Front Vertex 8 
+         0.6f,  0.2f, -0.14f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f, // Top Center Front Vertex 7 
+         //Triangle 8
+         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
+         0.43f, 0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Top Left Vertex 1  
+         0.45f, 0.2f, -0.15f, 0.0f, 0.0f, -1.0f,   0.0f, 1.0f,// Top Left Front Vertex 8
+
+        //Plane
+         //Triangle 1 Back Triangle
+        -2.0f, 0.0f,  2.0f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 1 GREEN
+        -2.0f, 0.0f, -2.0f,  0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Bottom Left Front Vertex 2 GREEN
+         2.0f, 0.0f, -2.0f,  0.0f, 0.0f, -1.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 3 GREEN
+         //Triangle 2 Front Triangle
+        -2.0f, 0.0f,  2.0f,  0.0f, 0.0f,  1.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 1 GREEN
+         2.0f, 0.0f, -2.0f,  0.0f, 0.0f,  1.0f,   1.0f, 1.0f, // Bottom Right Front Vertex 3 GREEN
+         2.0f, 0.0f,  2.0f,  0.0f, 0.0f,  1.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 4 GREEN
+
+
+    };
+
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
+    const GLuint floatsPerUV = 2;
+    const GLuint floatsPerMeshVertex = floatsPerVertex + floatsPerNormal + floatsPerUV;
+
+    const GLuint nSourceVertices = sizeof(verts) / (sizeof(verts[0]) * floatsPerMeshVertex);
+
+    // Objects in verts[], in order: 8 prism triangles, 32 cylinder triangles, 2 plane triangles (bounds are computed below)
+    mesh.subMeshes.clear();
+    mesh.subMeshes.push_back({ "bottle", 0, 8 * 3, glm::vec3(), glm::vec3(), -1 });
+    mesh.subMeshes.push_back({ "cap", 8 * 3, 32 * 3, glm::vec3(), glm::vec3(), -1 });
+    mesh.subMeshes.push_back({ "plane", (8 + 32) * 3, 2 * 3, glm::vec3(), glm::vec3(), -1 });
+
+    // Mesh build stage: weld the duplicated corners into an indexed mesh (one index per source
+    // vertex, so the source ranges are the index ranges), then reorder each object's triangles for
+    // the post-transform vertex cache and overdraw, and the vertices for fetch locality
+    vector<GLfloat> vertices;
+    vector<GLuint> indices;
+    UWeldVertices(verts, nSourceVertices, floatsPerMeshVertex, vertices, indices);
+    mesh.nVertices = GLuint(vertices.size() / floatsPerMeshVertex);
+
+    size_t weldedInvocations, optimizedInvocations;
+    UOptimizeMesh(mesh, vertices, indices, floatsPerMeshVertex, weldedInvocations, optimizedInvocations);
+
+    // Bounding box of each object, for culling
+    UComputeSubMeshBounds(mesh, vertices, indices, floatsPerMeshVertex);
+
+    // glDrawArrays runs the vertex shader once per vertex, so the source vertex count is the baseline
+    LogMessage(LOG_INFO) << "Mesh: " << nSourceVertices << " vertices welded to " << mesh.nVertices
+        << ", vertex shader invocations " << nSourceVertices << " (non-indexed) -> " << weldedInvocations
+        << " (indexed) -> " << optimizedInvocations << " (cache-optimized)";
+
+    // Use 16-bit indices whenever the vertex count allows it to halve the index buffer
+    mesh.nIndices = GLsizei(indices.size());
+    vector<unsigned char> indexData;
+    UPackIndices(indices, mesh.nVertices, indexData, mesh.indexType);
+    UUploadMesh(mesh, vertices.data(), indexData.data(), "scene mesh");
+}
+
+
+// Sets up the position, normal and texture coordinate attributes of the mesh's vertex buffer (bound to
+// GL_ARRAY_BUFFER) for its float or packed vertices, and the draw index attribute
+void USetMeshVertexAttributes(const GLMesh& mesh)
+{
+    // Draw index: advances per instance, so a draw's base instance selects its entry (UExecuteRenderQueue binds the buffer)
+    glVertexAttribIFormat(11, 1, GL_UNSIGNED_INT, 0);
+    glVertexAttribBinding(11, DRAW_INDEX_VERTEX_BINDING);
+    glEnableVertexAttribArray(11);
+    glVertexBindingDivisor(DRAW_INDEX_VERTEX_BINDING, 1);
+
+    if (mesh.packed)
+    {
+        // The shaders still read a vec3 position and normal: the position comes in 0 to 1 (the draw's
+        // positionScale and positionOffset map it onto the bounds), the normal with z 0 (PACKED_VERTICES decodes it)
+        const GLint packedStride = sizeof(PackedVertex);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, packedStride, (void*)offsetof(PackedVertex, position));
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, packedStride, (void*)offsetof(PackedVertex, normal));
+        glEnableVertexAttribArray(1);
+
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, packedStride, (void*)offsetof(PackedVertex, uv));
+        glEnableVertexAttribArray(2);
+        return;
+    }
+
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
+    const GLuint floatsPerUV = 2;
+
+    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
+    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+
+    // Create Vertex Attribute Pointers
+    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+    glEnableVertexAttribArray(2);
+}
+
+
+// Reorders each sub-mesh's triangles for the post-transform vertex cache and overdraw, then the vertices
+// for fetch locality; reports the vertex shader invocations before and after
+void UOptimizeMesh(GLMesh& mesh, vector<GLfloat>& vertices, vector<GLuint>& indices, GLuint floatsPerVertex, size_t& unoptimizedInvocations, size_t& optimizedInvocations)
+{
+    unoptimizedInvocations = 0;
+    optimizedInvocations = 0;
+    for (const GLSubMesh& subMesh : mesh.subMeshes)
+    {
+        GLuint* first = indices.data() + subMesh.firstIndex;
+        unoptimizedInvocations += UCountVertexShaderInvocations(first, subMesh.indexCount);
+
+        // The vertex cache pass keeps per-vertex tables: run it on the range of vertices the object uses,
+        // so a model with many objects does not pay for the whole vertex buffer each time
+        GLuint lowest = ~0u, highest = 0;
+        for (GLsizei i = 0; i < subMesh.indexCount; ++i)
+        {
+            lowest = std::min(lowest, first[i]);
+            highest = std::max(highest, first[i]);
+        }
+        for (GLsizei i = 0; i < subMesh.indexCount; ++i)
+            first[i] -= lowest;
+        UOptimizeVertexCache(first, subMesh.indexCount, subMesh.indexCount > 0 ? highest - lowest + 1 : 0);
+        for (GLsizei i = 0; i < subMesh.indexCount; ++i)
+            first[i] += lowest;
+
+        UOptimizeOverdraw(first, subMesh.indexCount, vertices, floatsPerVertex);
+        optimizedInvocations += UCountVertexShaderInvocations(first, subMesh.indexCount);
+    }
+    UOptimizeVertexFetch(indices, vertices, floatsPerVertex);
+}
+
+
+// Computes the bounding box of each sub-mesh, for culling
+void UComputeSubMeshBounds(GLMesh& mesh, const vector<GLfloat>& vertices, const vector<GLuint>& indices, GLuint floatsPerVertex)
+{
+    for (GLSubMesh& subMesh : mesh.subMeshes)
+    {
+        subMesh.boundsMin = glm::vec3(FLT_MAX);
+        subMesh.boundsMax = glm::vec3(-FLT_MAX);
+        for (GLsizei i = 0; i < subMesh.indexCount; ++i)
+        {
+            const GLfloat* position = &vertices[indices[subMesh.firstIndex + i] * floatsPerVertex];
+            subMesh.boundsMin = glm::min(subMesh.boundsMin, glm::make_vec3(position));
+            subMesh.boundsMax = glm::max(subMesh.boundsMax, glm::make_vec3(position));
+        }
+    }
+}
+
+
+// Packs the indices into the smallest type the vertex count allows (16-bit halves the index buffer)
+void UPackIndices(const vector<GLuint>& indices, GLuint vertexCount, vector<unsigned char>& packed, GLenum& indexType)
+{
+    if (vertexCount <= 0xFFFF)
+    {
+        indexType = GL_UNSIGNED_SHORT;
+        packed.resize(indices.size() * sizeof(GLushort));
+        GLushort* shortIndices = reinterpret_cast<GLushort*>(packed.data());
+        for (size_t i = 0; i < indices.size(); ++i)
+            shortIndices[i] = GLushort(indices[i]);
+    }
+    else
+    {
+        indexType = GL_UNSIGNED_INT;
+        packed.resize(indices.size() * sizeof(GLuint));
+        memcpy(packed.data(), indices.data(), packed.size());
+    }
+}
+
+
+// Creates the mesh's VAO and buffers from nVertices float vertices (position, normal, texture coordinate) and
+// nIndices indices of indexType. With --packed-vertices the vertices are packed on the way (the mesh cache
+// keeps the float ones), and the precision they lost is reported under the mesh's name.
+void UUploadMesh(GLMesh& mesh, const void* vertices, const void* indices, const string& name)
+{
+    const size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    vector<PackedVertex> packedVertices;
+    size_t vertexSize = MESH_FLOATS_PER_VERTEX * sizeof(GLfloat);
+    mesh.packed = gPackVertices;
+    mesh.positionScale = glm::vec3(1.0f);
+    mesh.positionOffset = glm::vec3(0.0f);
+    if (mesh.packed)
+    {
+        VertexPackError error;
+        UPackVertices(static_cast<const GLfloat*>(vertices), mesh.nVertices, packedVertices, mesh.positionScale, mesh.positionOffset, error);
+        LogMessage(LOG_INFO) << "Packed vertices of " << name << ": " << sizeof(PackedVertex) << " instead of " << vertexSize << " bytes ("
+            << size_t(mesh.nVertices) * sizeof(PackedVertex) / 1024 << " KB), max errors: position " << error.position << " ("
+            << 100.0f * error.position / std::max(glm::length(mesh.positionScale), FLT_MIN) << "% of the bounds diagonal), normal "
+            << error.normal << " degrees, texture coordinate " << error.uv;
+        vertices = packedVertices.data();
+        vertexSize = sizeof(PackedVertex);
+    }
+
+    mesh.vao.create(name);
+    glBindVertexArray(mesh.vao);
+
+    // Create 2 buffers: first one for the vertex data; second one for the indices
+    mesh.vbo.create(name + " vertices");
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, size_t(mesh.nVertices) * vertexSize, vertices, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    USetResourceSize(RESOURCE_BUFFER, mesh.vbo, size_t(mesh.nVertices) * vertexSize);
+
+    mesh.ebo.create(name + " indices");
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo); // Recorded in the VAO
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_t(mesh.nIndices) * indexSize, indices, GL_STATIC_DRAW);
+    USetResourceSize(RESOURCE_BUFFER, mesh.ebo, size_t(mesh.nIndices) * indexSize);
+
+    USetMeshVertexAttributes(mesh);
+}
+
+
+// Packs float vertices (MESH_FLOATS_PER_VERTEX floats each) into PackedVertex entries, returning how the
+// positions map back onto object space and the largest error of each attribute
+void UPackVertices(const GLfloat* vertices, GLuint vertexCount, vector<PackedVertex>& packed, glm::vec3& positionScale, glm::vec3& positionOffset, VertexPackError& error)
+{
+    // The positions are quantized across the mesh's bounding box
+    glm::vec3 boundsMin(vertexCount > 0 ? FLT_MAX : 0.0f);
+    glm::vec3 boundsMax(vertexCount > 0 ? -FLT_MAX : 0.0f);
+    for (GLuint v = 0; v < vertexCount; ++v)
+    {
+        const glm::vec3 position = glm::make_vec3(vertices + size_t(v) * MESH_FLOATS_PER_VERTEX);
+        boundsMin = glm::min(boundsMin, position);
+        boundsMax = glm::max(boundsMax, position);
+    }
+    positionOffset = boundsMin;
+    positionScale = boundsMax - boundsMin;
+
+    packed.resize(vertexCount);
+    error.position = 0.0f;
+    error.normal = 0.0f;
+    error.uv = 0.0f;
+    for (GLuint v = 0; v < vertexCount; ++v)
+    {
+        const GLfloat* vertex = vertices + size_t(v) * MESH_FLOATS_PER_VERTEX;
+        PackedVertex& out = packed[v];
+
+        // Decode each attribute as the GL and the vertex shader do, and measure the difference
+        const glm::vec3 position = glm::make_vec3(vertex);
+        glm::vec3 decoded;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // A flat axis (the height of the ground plane) stays 0: its offset alone is exact
+            const float t = positionScale[axis] > 0.0f ? (position[axis] - positionOffset[axis]) / positionScale[axis] : 0.0f;
+            out.position[axis] = GLushort(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+            decoded[axis] = out.position[axis] / 65535.0f * positionScale[axis] + positionOffset[axis];
+        }
+        out.padding = 0;
+        error.position = std::max(error.position, glm::length(decoded - position));
+
+        const glm::vec3 normal = glm::make_vec3(vertex + 3);
+        UEncodeOctahedral(normal, out.normal);
+        if (glm::length(normal) > 0.0f)
+        {
+            const float cosine = glm::dot(glm::normalize(normal), UDecodeOctahedral(out.normal));
+            error.normal = std::max(error.normal, glm::degrees(acosf(std::min(std::max(cosine, -1.0f), 1.0f))));
+        }
+
+        for (int k = 0; k < 2; ++k)
+        {
+            out.uv[k] = UFloatToHalf(vertex[6 + k]);
+            error.uv = std::max(error.uv, fabsf(UHalfToFloat(out.uv[k]) - vertex[6 + k]));
+        }
+    }
+}
+
+
+// Octahedral normal encoding: the normal is projected onto the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one, so x and y alone describe it; they are stored as signed normalized shorts
+void UEncodeOctahedral(const glm::vec3& normal, GLshort encoded[2])
+{
+    const float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+    float x = sum > 0.0f ? normal.x / sum : 0.0f;
+    float y = sum > 0.0f ? normal.y / sum : 0.0f;
+    if (normal.z < 0.0f)
+    {
+        const float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = GLshort(roundf(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f));
+    encoded[1] = GLshort(roundf(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f));
+}
+
+
+// Decodes a packed normal like the material vertex shader (decodeOctahedral)
+glm::vec3 UDecodeOctahedral(const GLshort encoded[2])
+{
+    glm::vec3 n(std::max(encoded[0] / 32767.0f, -1.0f), std::max(encoded[1] / 32767.0f, -1.0f), 0.0f);
+    n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+    const float fold = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -fold : fold;
+    n.y += n.y >= 0.0f ? -fold : fold;
+    return glm::normalize(n);
+}
+
+
+// Converts a float to a half float (IEEE 754 binary16), rounding to nearest even; too large values become infinity
+GLushort UFloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t floatExponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (floatExponent == 0xFF)
+        return GLushort(sign | 0x7C00 | (mantissa ? 0x200 : 0));  // Infinity or NaN
+
+    const int exponent = int(floatExponent) - 127 + 15;
+    if (exponent >= 31)
+        return GLushort(sign | 0x7C00);
+
+    // Keep the top 10 mantissa bits (fewer for a subnormal half) and round on the bits dropped. A carry out
+    // of the mantissa correctly moves on to the next exponent.
+    int shift = 13;
+    uint32_t half = (uint32_t(std::max(exponent, 0)) << 10);
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return GLushort(sign);
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+    }
+    half += mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        ++half;
+    return GLushort(sign | half);
+}
+
+
+float UHalfToFloat(GLushort half)
+{
+    const float sign = (half & 0x8000) ? -1.0f : 1.0f;
+    const int exponent = (half >> 10) & 0x1F;
+    const int mantissa = half & 0x3FF;
+    if (exponent == 0)
+        return sign * ldexpf(float(mantissa), -24);
+    if (exponent == 31)
+        return mantissa ? NAN : sign * INFINITY;
+    return sign * ldexpf(float(mantissa | 0x400), exponent - 25);
+}
+
+
+// Reads a whole file into contents; returns false if it cannot be read
+bool UReadFile(const string& path, string& contents)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+
+    contents.resize(size_t(in.tellg()));
+    in.seekg(0);
+    return bool(in.read(&contents[0], contents.size()));
+}
+
+
+// Directory part of a path, with its trailing separator ("" for a bare file name)
+string UDirectoryOf(const string& path)
+{
+    return path.substr(0, path.find_last_of("/\\") + 1);
+}
+
+
+// Gives the vertices flagged in missingNormals smooth normals: the area-weighted sum of the normals of
+// the triangles using them
+void UGenerateNormals(ModelData& model)
+{
+    if (std::find(model.missingNormals.begin(), model.missingNormals.end(), true) == model.missingNormals.end())
+        return;
+
+    vector<GLfloat>& vertices = model.vertices;
+    for (size_t i = 0; i + 2 < model.indices.size(); i += 3)
+    {
+        GLfloat* corners[3];
+        for (int k = 0; k < 3; ++k)
+            corners[k] = &vertices[size_t(model.indices[i + k]) * MESH_FLOATS_PER_VERTEX];
+
+        // Length is twice the triangle area
+        const glm::vec3 p0 = glm::make_vec3(corners[0]);
+        const glm::vec3 faceNormal = glm::cross(glm::make_vec3(corners[1]) - p0, glm::make_vec3(corners[2]) - p0);
+        for (int k = 0; k < 3; ++k)
+        {
+            if (!model.missingNormals[model.indices[i + k]])
+                continue;
+            corners[k][3] += faceNormal.x;
+            corners[k][4] += faceNormal.y;
+            corners[k][5] += faceNormal.z;
+        }
+    }
+
+    for (size_t v = 0; v < model.missingNormals.size(); ++v)
+    {
+        if (!model.missingNormals[v])
+            continue;
+        GLfloat* normal = &vertices[v * MESH_FLOATS_PER_VERTEX + 3];
+        const float length = glm::length(glm::make_vec3(normal));
+        const glm::vec3 unit = length > 0.0f ? glm::make_vec3(normal) / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        normal[0] = unit.x;
+        normal[1] = unit.y;
+        normal[2] = unit.z;
+    }
+}
+
+
+// Skips spaces and tabs within a line of an OBJ or MTL file
+void USkipObjSpace(const char*& cursor, const char* lineEnd)
+{
+    while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+        ++cursor;
+}
+
+
+// Rest of an OBJ or MTL line, without the surrounding whitespace (names and file names may hold spaces)
+string UObjRestOfLine(const char* cursor, const char* lineEnd)
+{
+    USkipObjSpace(cursor, lineEnd);
+    while (lineEnd > cursor && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t' || lineEnd[-1] == '\r'))
+        --lineEnd;
+    return string(cursor, lineEnd);
+}
+
+
+// Reads up to count floats from an OBJ or MTL line; returns how many were read
+int UParseObjFloats(const char*& cursor, const char* lineEnd, float* values, int count)
+{
+    int parsed = 0;
+    for (; parsed < count; ++parsed)
+    {
+        // strtof skips newlines too, so stop at the end of the line before calling it
+        USkipObjSpace(cursor, lineEnd);
+        if (cursor >= lineEnd)
+            break;
+        char* next;
+        values[parsed] = strtof(cursor, &next);
+        if (next == cursor)
+            break;
+        cursor = next;
+    }
+    return parsed;
+}
+
+
+// Reads the materials of an MTL file: diffuse color (Kd) and diffuse texture (map_Kd), whose path is
+// made relative to the model's directory through the MTL file's own directory
+void UParseMtl(const string& modelDirectory, const string& mtlName, vector<GLMaterial>& materials)
+{
+    string text;
+    if (!UReadFile(modelDirectory + mtlName, text))
+    {
+        LogMessage(LOG_WARNING) << "Material library " << modelDirectory + mtlName << " not found; its materials are untextured";
+        return;
+    }
+
+    const string mtlDirectory = UDirectoryOf(mtlName);
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    while (cursor < end)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        if (!lineEnd)
+            lineEnd = end;
+
+        USkipObjSpace(cursor, lineEnd);
+        const char* keywordEnd = cursor;
+        while (keywordEnd < lineEnd && *keywordEnd != ' ' && *keywordEnd != '\t')
+            ++keywordEnd;
+        const string keyword(cursor, keywordEnd);
+
+        if (keyword == "newmtl")
+            materials.push_back({ UObjRestOfLine(keywordEnd, lineEnd), glm::vec3(0.8f), "", GLTexture() });
+        else if (keyword == "Kd" && !materials.empty())
+            UParseObjFloats(keywordEnd, lineEnd, glm::value_ptr(materials.back().color), 3);
+        else if (keyword == "map_Kd" && !materials.empty())
+        {
+            // Options (-s, -o, ...) come before the file name: keep the last word when there are any
+            string file = UObjRestOfLine(keywordEnd, lineEnd);
+            if (!file.empty() && file[0] == '-')
+                file = file.substr(file.find_last_of(" \t") + 1);
+            std::replace(file.begin(), file.end(), '\\', '/');
+            materials.back().texture = mtlDirectory + file;
+        }
+
+        cursor = lineEnd + 1;
+    }
+}
+
+
+// Parses a Wavefront OBJ file (positions, texture coordinates, normals and polygonal faces, which are
+// triangulated as fans) and its MTL materials. Each run of faces sharing a material is a sub-mesh.
+bool UParseObj(const string& path, ModelData& model)
+{
+    string text;
+    if (!UReadFile(path, text))
+    {
+        LogMessage(LOG_ERROR) << "Failed to read model " << path;
+        return false;
+    }
+
+    vector<glm::vec3> positions, normals;
+    vector<glm::vec2> uvs;
+    std::unordered_map<ObjVertexKey, GLuint, ObjVertexKeyHash> vertexMap;
+    vector<GLuint> face;
+    const string directory = UDirectoryOf(path);
+
+    // Starts a sub-mesh at the end of the index buffer, replacing the current one if it has no faces yet
+    auto beginSubMesh = [&model, &vertexMap](GLint material)
+    {
+        if (!model.subMeshes.empty() && model.subMeshes.back().indexCount == 0)
+            model.subMeshes.pop_back();
+        const string name = material >= 0 ? model.materials[material].name : "default";
+        model.subMeshes.push_back({ name, GLuint(model.indices.size()), 0, glm::vec3(), glm::vec3(), material });
+
+        // Vertices are not shared across sub-meshes, so each one uses a compact vertex range
+        vertexMap.clear();
+    };
+    beginSubMesh(-1);
+
+    // OBJ numbers from 1, and negative numbers count back from the last element read
+    auto resolve = [](long number, size_t count) { return number > 0 ? long(number - 1) : long(count) + number; };
+
+    size_t lineNumber = 0;
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    while (cursor < end)
+    {
+        ++lineNumber;
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        if (!lineEnd)
+            lineEnd = end;
+
+        USkipObjSpace(cursor, lineEnd);
+        const char* keywordEnd = cursor;
+        while (keywordEnd < lineEnd && *keywordEnd != ' ' && *keywordEnd != '\t')
+            ++keywordEnd;
+        const size_t keywordLength = keywordEnd - cursor;
+
+        if (keywordLength == 1 && cursor[0] == 'v')
+        {
+            glm::vec3 position(0.0f);
+            UParseObjFloats(keywordEnd, lineEnd, glm::value_ptr(position), 3);
+            positions.push_back(position);
+        }
+        else if (keywordLength == 2 && cursor[0] == 'v' && cursor[1] == 't')
+        {
+            glm::vec2 uv(0.0f);
+            UParseObjFloats(keywordEnd, lineEnd, glm::value_ptr(uv), 2);
+            uvs.push_back(uv);
+        }
+        else if (keywordLength == 2 && cursor[0] == 'v' && cursor[1] == 'n')
+        {
+            glm::vec3 normal(0.0f);
+            UParseObjFloats(keywordEnd, lineEnd, glm::value_ptr(normal), 3);
+            normals.push_back(normal);
+        }
+        else if (keywordLength == 1 && cursor[0] == 'f')
+        {
+            // Each corner is position[/uv][/normal]
+            face.clear();
+            const char* p = keywordEnd;
+            for (;;)
+            {
+                USkipObjSpace(p, lineEnd);
+                if (p >= lineEnd)
+                    break;
+
+                char* next;
+                ObjVertexKey key = { resolve(strtol(p, &next, 10), positions.size()), -1, -1 };
+                bool valid = next != p;
+                p = next;
+                if (p < lineEnd && *p == '/')
+                {
+                    ++p;
+                    if (p < lineEnd && *p != '/')
+                    {
+                        key.uv = resolve(strtol(p, &next, 10), uvs.size());
+                        valid = valid && next != p && key.uv >= 0 && key.uv < long(uvs.size());
+                        p = next;
+                    }
+                    if (p < lineEnd && *p == '/')
+                    {
+                        ++p;
+                        key.normal = resolve(strtol(p, &next, 10), normals.size());
+                        valid = valid && next != p && key.normal >= 0 && key.normal < long(normals.size());
+                        p = next;
+                    }
+                }
+
+                // A given uv or normal is range-checked where it is read: one resolving to -1 is not "none"
+                if (!valid || key.position < 0 || key.position >= long(positions.size()))
+                {
+                    LogMessage(LOG_ERROR) << "Invalid face in " << path << " at line " << lineNumber;
+                    return false;
+                }
+
+                auto found = vertexMap.find(key);
+                if (found == vertexMap.end())
+                {
+                    const GLuint index = GLuint(model.missingNormals.size());
+                    const glm::vec3& position = positions[key.position];
+                    const glm::vec3 normal = key.normal >= 0 ? normals[key.normal] : glm::vec3(0.0f);
+                    const glm::vec2 uv = key.uv >= 0 ? uvs[key.uv] : glm::vec2(0.0f);
+                    const GLfloat vertex[MESH_FLOATS_PER_VERTEX] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, uv.x, uv.y };
+                    model.vertices.insert(model.vertices.end(), vertex, vertex + MESH_FLOATS_PER_VERTEX);
+                    model.missingNormals.push_back(key.normal < 0);
+                    found = vertexMap.emplace(key, index).first;
+                }
+                face.push_back(found->second);
+            }
+
+            for (size_t i = 2; i < face.size(); ++i)
+            {
+                model.indices.push_back(face[0]);
+                model.indices.push_back(face[i - 1]);
+                model.indices.push_back(face[i]);
+                model.subMeshes.back().indexCount += 3;
+            }
+        }
+        else if (keywordLength == 6 && strncmp(cursor, "usemtl", 6) == 0)
+        {
+            const string name = UObjRestOfLine(keywordEnd, lineEnd);
+            GLint material = -1;
+            for (size_t i = 0; i < model.materials.size(); ++i)
+                if (model.materials[i].name == name)
+                    material = GLint(i);
+            if (material != model.subMeshes.back().material)
+                beginSubMesh(material);
+        }
+        else if (keywordLength == 6 && strncmp(cursor, "mtllib", 6) == 0)
+        {
+            // Recorded even if it is missing, so the cache is rebuilt once it appears
+            const string mtlName = UObjRestOfLine(keywordEnd, lineEnd);
+            model.dependencies.push_back(directory + mtlName);
+            UParseMtl(directory, mtlName, model.materials);
+        }
+
+        cursor = lineEnd + 1;
+    }
+
+    if (model.subMeshes.back().indexCount == 0)
+        model.subMeshes.pop_back();
+
+    return true;
+}
+
+
+// Skips JSON whitespace
+void USkipJsonSpace(const char*& cursor)
+{
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')
+        ++cursor;
+}
+
+
+// Parses a JSON string, decoding its escapes (\u escapes to UTF-8)
+bool UParseJsonString(const char*& cursor, string& text)
+{
+    if (*cursor != '"')
+        return false;
+    ++cursor;
+
+    text.clear();
+    while (*cursor != '"')
+    {
+        if (*cursor == '\0')
+            return false;
+        if (*cursor != '\\')
+        {
+            text += *cursor++;
+            continue;
+        }
+
+        ++cursor;
+        switch (*cursor++)
+        {
+        case '"': text += '"'; break;
+        case '\\': text += '\\'; break;
+        case '/': text += '/'; break;
+        case 'b': text += '\b'; break;
+        case 'f': text += '\f'; break;
+        case 'n': text += '\n'; break;
+        case 'r': text += '\r'; break;
+        case 't': text += '\t'; break;
+        case 'u':
+        {
+            unsigned int code = 0;
+            for (int i = 0; i < 4; ++i, ++cursor)
+            {
+                const char c = *cursor;
+                if (c >= '0' && c <= '9')
+                    code = code * 16 + (c - '0');
+                else if (c >= 'a' && c <= 'f')
+                    code = code * 16 + (c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F')
+                    code = code * 16 + (c - 'A' + 10);
+                else
+                    return false;
+            }
+            if (code < 0x80)
+                text += char(code);
+            else if (code < 0x800)
+            {
+                text += char(0xC0 | (code >> 6));
+                text += char(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                text += char(0xE0 | (code >> 12));
+                text += char(0x80 | ((code >> 6) & 0x3F));
+                text += char(0x80 | (code & 0x3F));
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    ++cursor;
+    return true;
+}
+
+
+// Parses a JSON value from zero-terminated text; returns false on a syntax error
+bool UParseJsonValue(const char*& cursor, JsonValue& value, int depth)
+{
+    if (depth > JSON_MAX_DEPTH)
+        return false;
+
+    USkipJsonSpace(cursor);
+    value.number = 0.0;
+    switch (*cursor)
+    {
+    case '{':
+        value.type = JsonValue::JSON_OBJECT;
+        ++cursor;
+        USkipJsonSpace(cursor);
+        if (*cursor == '}')
+        {
+            ++cursor;
+            return true;
+        }
+        for (;;)
+        {
+            USkipJsonSpace(cursor);
+            value.keys.emplace_back();
+            if (!UParseJsonString(cursor, value.keys.back()))
+                return false;
+            USkipJsonSpace(cursor);
+            if (*cursor != ':')
+                return false;
+            ++cursor;
+            value.items.emplace_back();
+            if (!UParseJsonValue(cursor, value.items.back(), depth + 1))
+                return false;
+            USkipJsonSpace(cursor);
+            if (*cursor == ',')
+                ++cursor;
+            else if (*cursor == '}')
+            {
+                ++cursor;
+                return true;
+            }
+            else
+                return false;
+        }
+
+    case '[':
+        value.type = JsonValue::JSON_ARRAY;
+        ++cursor;
+        USkipJsonSpace(cursor);
+        if (*cursor == ']')
+        {
+            ++cursor;
+            return true;
+        }
+        for (;;)
+        {
+            value.items.emplace_back();
+            if (!UParseJsonValue(cursor, value.items.back(), depth + 1))
+                return false;
+            USkipJsonSpace(cursor);
+            if (*cursor == ',')
+                ++cursor;
+            else if (*cursor == ']')
+            {
+                ++cursor;
+                return true;
+            }
+            else
+                return false;
+        }
+
+    case '"':
+        value.type = JsonValue::JSON_STRING;
+        return UParseJsonString(cursor, value.text);
+
+    case 't':
+    case 'f':
+    case 'n':
+    {
+        const bool isTrue = strncmp(cursor, "true", 4) == 0;
+        const bool isFalse = strncmp(cursor, "false", 5) == 0;
+        if (!isTrue && !isFalse && strncmp(cursor, "null", 4) != 0)
+            return false;
+        value.type = isTrue || isFalse ? JsonValue::JSON_BOOL : JsonValue::JSON_NULL;
+        value.number = isTrue ? 1.0 : 0.0;
+        cursor += isFalse ? 5 : 4;
+        return true;
+    }
+
+    default:
+    {
+        char* next;
+        value.number = strtod(cursor, &next);
+        if (next == cursor)
+            return false;
+        value.type = JsonValue::JSON_NUMBER;
+        cursor = next;
+        return true;
+    }
+    }
+}
+
+
+// Member of a JSON object, or nullptr if value is not an object or lacks it (so lookups can be chained)
+const JsonValue* UJsonMember(const JsonValue* value, const char* key)
+{
+    if (!value || value->type != JsonValue::JSON_OBJECT)
+        return nullptr;
+    for (size_t i = 0; i < value->keys.size(); ++i)
+        if (value->keys[i] == key)
+            return &value->items[i];
+    return nullptr;
+}
+
+
+// Element of a JSON array, or nullptr if value is not an array or index is out of range
+const JsonValue* UJsonItem(const JsonValue* value, int index)
+{
+    if (!value || value->type != JsonValue::JSON_ARRAY || index < 0 || size_t(index) >= value->items.size())
+        return nullptr;
+    return &value->items[index];
+}
+
+
+// Number of a JSON value, or fallback if it is missing or not a number
+double UJsonNumber(const JsonValue* value, double fallback)
+{
+    return value && (value->type == JsonValue::JSON_NUMBER || value->type == JsonValue::JSON_BOOL) ? value->number : fallback;
+}
+
+
+// Copies count numbers of a JSON array into values; leaves values unchanged if the array is missing or short
+void UJsonFloats(const JsonValue* value, float* values, size_t count)
+{
+    if (!value || value->type != JsonValue::JSON_ARRAY || value->items.size() < count)
+        return;
+    for (size_t i = 0; i < count; ++i)
+        values[i] = float(UJsonNumber(&value->items[i], values[i]));
+}
+
+
+// Decodes base64 text (the payload of a data: URI), stopping at padding or any character outside the alphabet
+void UDecodeBase64(const char* text, vector<unsigned char>& bytes)
+{
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (; *text; ++text)
+    {
+        const char c = *text;
+        int digit;
+        if (c >= 'A' && c <= 'Z')
+            digit = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            digit = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            digit = c - '0' + 52;
+        else if (c == '+')
+            digit = 62;
+        else if (c == '/')
+            digit = 63;
+        else
+            break;
+
+        bits = (bits << 6) | uint32_t(digit);
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            bytes.push_back((unsigned char)(bits >> bitCount));
+        }
+    }
+}
+
+
+// Decodes the %XX escapes of a relative URI into a file path
+string UDecodeUri(const string& uri)
+{
+    string path;
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+        if (uri[i] == '%' && i + 2 < uri.size() && isxdigit((unsigned char)uri[i + 1]) && isxdigit((unsigned char)uri[i + 2]))
+        {
+            path += char(strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }
+        else
+            path += uri[i];
+    }
+    return path;
+}
+
+
+// Resolves a glTF accessor to its bytes in a loaded buffer; returns false if it is missing, has fewer
+// than minComponents components, or does not fit its buffer view. An accessor without a buffer view
+// (all zeros, or sparse, which is not supported) resolves to a null data pointer.
+bool UGetGltfAccessor(const JsonValue& gltf, const vector<vector<unsigned char>>& buffers, int index, int minComponents, GltfAccessor& accessor)
+{
+    const JsonValue* json = UJsonItem(UJsonMember(&gltf, "accessors"), index);
+    const JsonValue* type = UJsonMember(json, "type");
+    if (!json || !type)
+        return false;
+
+    accessor.componentType = int(UJsonNumber(UJsonMember(json, "componentType"), 0));
+    accessor.count = size_t(UJsonNumber(UJsonMember(json, "count"), 0));
+    accessor.normalized = UJsonNumber(UJsonMember(json, "normalized"), 0) != 0;
+    accessor.components = type->text == "SCALAR" ? 1 : type->text == "VEC2" ? 2 : type->text == "VEC3" ? 3 : type->text == "VEC4" ? 4 : 0;
+    accessor.data = nullptr;
+
+    size_t componentSize = 0;
+    switch (accessor.componentType)
+    {
+    case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: componentSize = 1; break;
+    case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: componentSize = 2; break;
+    case GLTF_UNSIGNED_INT: case GLTF_FLOAT: componentSize = 4; break;
+    }
+    if (componentSize == 0 || accessor.components < minComponents)
+        return false;
+
+    const JsonValue* view = UJsonItem(UJsonMember(&gltf, "bufferViews"), int(UJsonNumber(UJsonMember(json, "bufferView"), -1)));
+    if (!view)
+        return true;
+
+    const int buffer = int(UJsonNumber(UJsonMember(view, "buffer"), -1));
+    if (buffer < 0 || size_t(buffer) >= buffers.size())
+        return false;
+
+    const size_t elementSize = componentSize * accessor.components;
+    const size_t viewOffset = size_t(UJsonNumber(UJsonMember(view, "byteOffset"), 0));
+    const size_t viewLength = size_t(UJsonNumber(UJsonMember(view, "byteLength"), 0));
+    const size_t offset = size_t(UJsonNumber(UJsonMember(json, "byteOffset"), 0));
+    accessor.stride = size_t(UJsonNumber(UJsonMember(view, "byteStride"), 0));
+    if (accessor.stride == 0)
+        accessor.stride = elementSize;
+
+    if (viewOffset > buffers[buffer].size() || viewLength > buffers[buffer].size() - viewOffset ||
+        (accessor.count > 0 && offset + accessor.stride * (accessor.count - 1) + elementSize > viewLength))
+        return false;
+
+    accessor.data = buffers[buffer].data() + viewOffset + offset;
+    return true;
+}
+
+
+// Component of an accessor element as a float, normalizing integer components if the accessor says so
+float UGltfFloat(const GltfAccessor& accessor, size_t element, int component)
+{
+    if (!accessor.data)
+        return 0.0f;
+
+    const unsigned char* bytes = accessor.data + element * accessor.stride;
+    switch (accessor.componentType)
+    {
+    case GLTF_FLOAT:
+    {
+        float value;
+        memcpy(&value, bytes + component * 4, 4);
+        return value;
+    }
+    case GLTF_BYTE:
+    {
+        const float value = float(int8_t(bytes[component]));
+        return accessor.normalized ? glm::max(value / 127.0f, -1.0f) : value;
+    }
+    case GLTF_UNSIGNED_BYTE:
+        return accessor.normalized ? bytes[component] / 255.0f : float(bytes[component]);
+    case GLTF_SHORT:
+    {
+        int16_t value;
+        memcpy(&value, bytes + component * 2, 2);
+        return accessor.normalized ? glm::max(value / 32767.0f, -1.0f) : float(value);
+    }
+    case GLTF_UNSIGNED_SHORT:
+    {
+        uint16_t value;
+        memcpy(&value, bytes + component * 2, 2);
+        return accessor.normalized ? value / 65535.0f : float(value);
+    }
+    default:
+    {
+        uint32_t value;
+        memcpy(&value, bytes + component * 4, 4);
+        return float(value);
+    }
+    }
+}
+
+
+// Element of an index accessor (unsigned byte, short or int)
+GLuint UGltfIndex(const GltfAccessor& accessor, size_t element)
+{
+    if (!accessor.data)
+        return 0;
+
+    const unsigned char* bytes = accessor.data + element * accessor.stride;
+    if (accessor.componentType == GLTF_UNSIGNED_BYTE)
+        return bytes[0];
+    if (accessor.componentType == GLTF_UNSIGNED_SHORT)
+    {
+        uint16_t value;
+        memcpy(&value, bytes, 2);
+        return value;
+    }
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+    return value;
+}
+
+
+// Local transform of a glTF node: its matrix, or its translation, rotation and scale
+glm::mat4 UGltfNodeTransform(const JsonValue& node)
+{
+    const JsonValue* matrix = UJsonMember(&node, "matrix");
+    if (matrix && matrix->items.size() == 16)
+    {
+        // Column-major, like glm
+        glm::mat4 transform(1.0f);
+        UJsonFloats(matrix, glm::value_ptr(transform), 16);
+        return transform;
+    }
+
+    glm::vec3 translation(0.0f), scale(1.0f);
+    glm::vec4 q(0.0f, 0.0f, 0.0f, 1.0f); // Rotation quaternion (x, y, z, w)
+    UJsonFloats(UJsonMember(&node, "translation"), glm::value_ptr(translation), 3);
+    UJsonFloats(UJsonMember(&node, "rotation"), glm::value_ptr(q), 4);
+    UJsonFloats(UJsonMember(&node, "scale"), glm::value_ptr(scale), 3);
+
+    glm::mat4 rotation(1.0f);
+    rotation[0] = glm::vec4(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.z * q.w), 2.0f * (q.x * q.z - q.y * q.w), 0.0f);
+    rotation[1] = glm::vec4(2.0f * (q.x * q.y - q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.x * q.w), 0.0f);
+    rotation[2] = glm::vec4(2.0f * (q.x * q.z + q.y * q.w), 2.0f * (q.y * q.z - q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y), 0.0f);
+
+    return glm::translate(translation) * rotation * glm::scale(scale);
+}
+
+
+// Appends a triangle primitive of a glTF mesh, transformed into model space, as one sub-mesh
+bool UAppendGltfPrimitive(const JsonValue& gltf, const vector<vector<unsigned char>>& buffers, const JsonValue& primitive, const glm::mat4& world, const string& name, ModelData& model)
+{
+    // Points, lines and strips are skipped
+    if (UJsonNumber(UJsonMember(&primitive, "mode"), GLTF_TRIANGLES) != GLTF_TRIANGLES)
+        return true;
+
+    const JsonValue* attributes = UJsonMember(&primitive, "attributes");
+    GltfAccessor positions, normals, uvs;
+    if (!UGetGltfAccessor(gltf, buffers, int(UJsonNumber(UJsonMember(attributes, "POSITION"), -1)), 3, positions))
+        return false;
+    const bool hasNormals = UGetGltfAccessor(gltf, buffers, int(UJsonNumber(UJsonMember(attributes, "NORMAL"), -1)), 3, normals) &&
+        normals.count == positions.count;
+    const bool hasUVs = UGetGltfAccessor(gltf, buffers, int(UJsonNumber(UJsonMember(attributes, "TEXCOORD_0"), -1)), 2, uvs) &&
+        uvs.count == positions.count;
+
+    const GLuint firstVertex = GLuint(model.missingNormals.size());
+    const glm::mat3 normalMatrix = UNormalMatrix(world);
+    model.vertices.reserve(model.vertices.size() + positions.count * MESH_FLOATS_PER_VERTEX);
+    for (size_t i = 0; i < positions.count; ++i)
+    {
+        const glm::vec3 position = glm::vec3(world * glm::vec4(UGltfFloat(positions, i, 0), UGltfFloat(positions, i, 1), UGltfFloat(positions, i, 2), 1.0f));
+        glm::vec3 normal(0.0f);
+        if (hasNormals)
+        {
+            normal = normalMatrix * glm::vec3(UGltfFloat(normals, i, 0), UGltfFloat(normals, i, 1), UGltfFloat(normals, i, 2));
+            const float length = glm::length(normal);
+            normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+
+        // glTF puts the texture origin at the top left, OpenGL (and the flipped images) at the bottom left
+        const glm::vec2 uv = hasUVs ? glm::vec2(UGltfFloat(uvs, i, 0), 1.0f - UGltfFloat(uvs, i, 1)) : glm::vec2(0.0f);
+
+        const GLfloat vertex[MESH_FLOATS_PER_VERTEX] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, uv.x, uv.y };
+        model.vertices.insert(model.vertices.end(), vertex, vertex + MESH_FLOATS_PER_VERTEX);
+        model.missingNormals.push_back(!hasNormals);
+    }
+
+    const GLuint firstIndex = GLuint(model.indices.size());
+    const JsonValue* indexAccessor = UJsonMember(&primitive, "indices");
+    if (indexAccessor)
+    {
+        GltfAccessor indices;
+        if (!UGetGltfAccessor(gltf, buffers, int(UJsonNumber(indexAccessor, -1)), 1, indices))
+            return false;
+        for (size_t i = 0; i < indices.count; ++i)
+        {
+            const GLuint index = UGltfIndex(indices, i);
+            if (index >= positions.count)
+                return false;
+            model.indices.push_back(firstVertex + index);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < positions.count; ++i)
+            model.indices.push_back(firstVertex + GLuint(i));
+    }
+    model.indices.resize(firstIndex + (model.indices.size() - firstIndex) / 3 * 3);
+
+    // A mirroring transform turns the triangles inside out: restore the counter-clockwise winding
+    if (glm::determinant(glm::mat3(world)) < 0.0f)
+        for (size_t i = firstIndex; i < model.indices.size(); i += 3)
+            std::swap(model.indices[i + 1], model.indices[i + 2]);
+
+    GLint material = GLint(UJsonNumber(UJsonMember(&primitive, "material"), -1));
+    if (material >= GLint(model.materials.size()))
+        material = -1;
+
+    const GLsizei indexCount = GLsizei(model.indices.size() - firstIndex);
+    if (indexCount > 0)
+        model.subMeshes.push_back({ name, firstIndex, indexCount, glm::vec3(), glm::vec3(), material });
+    return true;
+}
+
+
+// Appends the meshes of a glTF node and its children, with their transforms applied to the vertices
+bool UAppendGltfNode(const JsonValue& gltf, const vector<vector<unsigned char>>& buffers, int nodeIndex, const glm::mat4& parent, int depth, ModelData& model)
+{
+    const JsonValue* node = UJsonItem(UJsonMember(&gltf, "nodes"), nodeIndex);
+    if (!node || depth > JSON_MAX_DEPTH) // Also stops cycles, which valid files do not have
+        return false;
+
+    const glm::mat4 world = parent * UGltfNodeTransform(*node);
+
+    const int meshIndex = int(UJsonNumber(UJsonMember(node, "mesh"), -1));
+    const JsonValue* mesh = UJsonItem(UJsonMember(&gltf, "meshes"), meshIndex);
+    if (mesh)
+    {
+        const JsonValue* meshName = UJsonMember(mesh, "name");
+        const string name = meshName && !meshName->text.empty() ? meshName->text : "mesh" + to_string(meshIndex);
+        const JsonValue* primitives = UJsonMember(mesh, "primitives");
+        for (size_t i = 0; primitives && i < primitives->items.size(); ++i)
+            if (!UAppendGltfPrimitive(gltf, buffers, primitives->items[i], world, name, model))
+                return false;
+    }
+
+    const JsonValue* children = UJsonMember(node, "children");
+    for (size_t i = 0; children && i < children->items.size(); ++i)
+        if (!UAppendGltfNode(gltf, buffers, int(UJsonNumber(&children->items[i], -1)), world, depth + 1, model))
+            return false;
+
+    return true;
+}
+
+
+// Parses a glTF 2.0 model, either a .gltf (JSON, with buffers in files or data: URIs) or a binary .glb.
+// The meshes of the default scene's nodes are baked into one set of vertices; each triangle primitive is
+// a sub-mesh, and each material keeps its base color factor and base color texture file.
+bool UParseGltf(const string& path, ModelData& model)
+{
+    string file;
+    if (!UReadFile(path, file))
+    {
+        LogMessage(LOG_ERROR) << "Failed to read model " << path;
+        return false;
+    }
+
+    // A .glb is a 12-byte header and chunks: the JSON first, then optionally the binary buffer
+    string json;
+    vector<unsigned char> glbBuffer;
+    if (file.size() >= 12 && memcmp(file.data(), "glTF", 4) == 0)
+    {
+        size_t offset = 12;
+        while (offset + 8 <= file.size())
+        {
+            uint32_t chunk[2]; // Length and type
+            memcpy(chunk, file.data() + offset, sizeof(chunk));
+            offset += sizeof(chunk);
+            if (chunk[0] > file.size() - offset)
+                break;
+            if (chunk[1] == GLB_CHUNK_JSON && json.empty())
+                json.assign(file.data() + offset, chunk[0]);
+            else if (chunk[1] == GLB_CHUNK_BIN && glbBuffer.empty())
+                glbBuffer.assign(file.data() + offset, file.data() + offset + chunk[0]);
+            offset += (size_t(chunk[0]) + 3) & ~size_t(3);
+        }
+    }
+    else
+        json.swap(file);
+
+    JsonValue gltf;
+    const char* cursor = json.c_str();
+    if (!UParseJsonValue(cursor, gltf, 0) || gltf.type != JsonValue::JSON_OBJECT)
+    {
+        LogMessage(LOG_ERROR) << "Failed to parse the glTF JSON of " << path;
+        return false;
+    }
+
+    // Buffers: the .glb's binary chunk, a data: URI, or a file next to the model
+    const string directory = UDirectoryOf(path);
+    vector<vector<unsigned char>> buffers;
+    const JsonValue* bufferList = UJsonMember(&gltf, "buffers");
+    for (size_t i = 0; bufferList && i < bufferList->items.size(); ++i)
+    {
+        const JsonValue* uri = UJsonMember(&bufferList->items[i], "uri");
+        buffers.emplace_back();
+        if (!uri)
+            buffers.back().swap(glbBuffer);
+        else if (uri->text.compare(0, 5, "data:") == 0)
+        {
+            const size_t comma = uri->text.find(',');
+            if (comma != string::npos)
+                UDecodeBase64(uri->text.c_str() + comma + 1, buffers.back());
+        }
+        else
+        {
+            string contents;
+            model.dependencies.push_back(directory + UDecodeUri(uri->text));
+            if (!UReadFile(directory + UDecodeUri(uri->text), contents))
+            {
+                LogMessage(LOG_ERROR) << "Failed to read buffer " << directory + UDecodeUri(uri->text) << " of " << path;
+                return false;
+            }
+            buffers.back().assign(contents.begin(), contents.end());
+        }
+
+        if (buffers.back().size() < size_t(UJsonNumber(UJsonMember(&bufferList->items[i], "byteLength"), 0)))
+        {
+            LogMessage(LOG_ERROR) << "Buffer " << i << " of " << path << " is shorter than its byteLength";
+            return false;
+        }
+    }
+
+    // Materials: the base color texture, if it is an image file, otherwise the base color factor
+    const JsonValue* materials = UJsonMember(&gltf, "materials");
+    for (size_t i = 0; materials && i < materials->items.size(); ++i)
+    {
+        const JsonValue& material = materials->items[i];
+        const JsonValue* pbr = UJsonMember(&material, "pbrMetallicRoughness");
+        const JsonValue* name = UJsonMember(&material, "name");
+
+        glm::vec4 color(1.0f);
+        UJsonFloats(UJsonMember(pbr, "baseColorFactor"), glm::value_ptr(color), 4);
+
+        const int textureIndex = int(UJsonNumber(UJsonMember(UJsonMember(pbr, "baseColorTexture"), "index"), -1));
+        const JsonValue* texture = UJsonItem(UJsonMember(&gltf, "textures"), textureIndex);
+        const JsonValue* image = UJsonItem(UJsonMember(&gltf, "images"), int(UJsonNumber(UJsonMember(texture, "source"), -1)));
+        const JsonValue* imageUri = UJsonMember(image, "uri");
+
+        string texturePath;
+        if (imageUri && imageUri->text.compare(0, 5, "data:") != 0)
+            texturePath = UDecodeUri(imageUri->text);
+        else if (image)
+            LogMessage(LOG_WARNING) << "Embedded image of material " << i << " in " << path << " is not supported; it is drawn untextured";
+
+        model.materials.push_back({ name ? name->text : "material" + to_string(i), glm::vec3(color), texturePath, GLTexture() });
+    }
+
+    // Nodes of the default scene (or of the first one); without scenes, every mesh as is
+    const JsonValue* scenes = UJsonMember(&gltf, "scenes");
+    const JsonValue* scene = UJsonItem(scenes, int(UJsonNumber(UJsonMember(&gltf, "scene"), 0)));
+    const JsonValue* roots = UJsonMember(scene, "nodes");
+    if (roots)
+    {
+        for (const JsonValue& root : roots->items)
+            if (!UAppendGltfNode(gltf, buffers, int(UJsonNumber(&root, -1)), glm::mat4(1.0f), 0, model))
+            {
+                LogMessage(LOG_ERROR) << "Invalid node, mesh or accessor in " << path;
+                return false;
+            }
+    }
+    else
+    {
+        const JsonValue* meshes = UJsonMember(&gltf, "meshes");
+        for (size_t m = 0; meshes && m < meshes->items.size(); ++m)
+        {
+            const JsonValue* primitives = UJsonMember(&meshes->items[m], "primitives");
+            for (size_t i = 0; primitives && i < primitives->items.size(); ++i)
+                if (!UAppendGltfPrimitive(gltf, buffers, primitives->items[i], glm::mat4(1.0f), "mesh" + to_string(m), model))
+                {
+                    LogMessage(LOG_ERROR) << "Invalid mesh or accessor in " << path;
+                    return false;
+                }
+        }
+    }
+
+    return true;
+}
+
+
+// Copies a name into a fixed-size, zero-terminated field of a cache file (truncating it)
+void UCopyCacheString(char* field, size_t capacity, const string& text)
+{
+    memset(field, 0, capacity);
+    memcpy(field, text.data(), std::min(text.size(), capacity - 1));
+}
+
+
+// Gets the size and modification time of a file, or 0 and -1 if it does not exist
+void UFileStamp(const string& path, uint64_t& size, int64_t& time)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        size = 0;
+        time = -1;
+        return;
+    }
+    size = uint64_t(info.st_size);
+    time = int64_t(info.st_mtime);
+}
+
+
+// Builds the cache file of a loaded model from its optimized vertices and packed indices, recording the
+// files it was parsed from
+void UBuildMeshCache(const GLMesh& mesh, const vector<GLfloat>& vertices, const vector<unsigned char>& indexData, uint64_t sourceSize, int64_t sourceTime,
+    const vector<string>& dependencies, vector<unsigned char>& file)
+{
+    MeshCacheHeader header = {};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.indexType = mesh.indexType;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.vertexCount = mesh.nVertices;
+    header.indexCount = uint32_t(mesh.nIndices);
+    header.subMeshCount = uint32_t(mesh.subMeshes.size());
+    header.materialCount = uint32_t(mesh.materials.size());
+    header.dependencyCount = uint32_t(dependencies.size());
+
+    vector<MeshCacheDependency> dependencyEntries(dependencies.size());
+    for (size_t i = 0; i < dependencyEntries.size(); ++i)
+    {
+        MeshCacheDependency& entry = dependencyEntries[i];
+        UCopyCacheString(entry.path, sizeof(entry.path), dependencies[i]);
+        UFileStamp(dependencies[i], entry.size, entry.time);
+        if (dependencies[i].size() >= sizeof(entry.path))
+            entry.size = UINT64_MAX;    // No file has this size
+    }
+
+    vector<MeshCacheSubMesh> subMeshes(mesh.subMeshes.size());
+    for (size_t i = 0; i < subMeshes.size(); ++i)
+    {
+        const GLSubMesh& subMesh = mesh.subMeshes[i];
+        MeshCacheSubMesh& entry = subMeshes[i];
+        UCopyCacheString(entry.name, sizeof(entry.name), subMesh.name);
+        entry.firstIndex = subMesh.firstIndex;
+        entry.indexCount = uint32_t(subMesh.indexCount);
+        entry.material = subMesh.material;
+        memcpy(entry.boundsMin, glm::value_ptr(subMesh.boundsMin), sizeof(entry.boundsMin));
+        memcpy(entry.boundsMax, glm::value_ptr(subMesh.boundsMax), sizeof(entry.boundsMax));
+        entry.reserved = 0;
+    }
+
+    vector<MeshCacheMaterial> materials(mesh.materials.size());
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        const GLMaterial& material = mesh.materials[i];
+        MeshCacheMaterial& entry = materials[i];
+        UCopyCacheString(entry.name, sizeof(entry.name), material.name);
+        UCopyCacheString(entry.texture, sizeof(entry.texture), material.texture);
+        memcpy(entry.color, glm::value_ptr(material.color), sizeof(float) * 3);
+        entry.color[3] = 1.0f;
+    }
+
+    auto append = [&file](const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        file.insert(file.end(), bytes, bytes + size);
+    };
+    file.clear();
+    append(&header, sizeof(header));
+    append(dependencyEntries.data(), dependencyEntries.size() * sizeof(MeshCacheDependency));
+    append(subMeshes.data(), subMeshes.size() * sizeof(MeshCacheSubMesh));
+    append(materials.data(), materials.size() * sizeof(MeshCacheMaterial));
+    append(vertices.data(), vertices.size() * sizeof(GLfloat));
+    append(indexData.data(), indexData.size());
+}
+
+
+// Checks a mapped mesh cache file against the source model and the other files it was parsed from and, if
+// it is up to date, fills the mesh's
+// tables and uploads the vertices and indices straight from the mapping. Returns false if the cache is
+// stale or malformed (the mesh is left without GL objects).
+bool UUploadMeshCache(const unsigned char* data, size_t size, uint64_t sourceSize, int64_t sourceTime, GLMesh& mesh, const string& name)
+{
+    MeshCacheHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+        (header.indexType != GL_UNSIGNED_SHORT && header.indexType != GL_UNSIGNED_INT))
+        return false;
+
+    const uint64_t indexSize = header.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    const uint64_t dependencyOffset = sizeof(header);
+    const uint64_t subMeshOffset = dependencyOffset + uint64_t(header.dependencyCount) * sizeof(MeshCacheDependency);
+    const uint64_t materialOffset = subMeshOffset + uint64_t(header.subMeshCount) * sizeof(MeshCacheSubMesh);
+    const uint64_t vertexOffset = materialOffset + uint64_t(header.materialCount) * sizeof(MeshCacheMaterial);
+    const uint64_t indexOffset = vertexOffset + uint64_t(header.vertexCount) * MESH_FLOATS_PER_VERTEX * sizeof(GLfloat);
+    if (indexOffset + uint64_t(header.indexCount) * indexSize != size)
+        return false;
+
+    for (uint32_t i = 0; i < header.dependencyCount; ++i)
+    {
+        MeshCacheDependency entry;
+        memcpy(&entry, data + dependencyOffset + i * sizeof(MeshCacheDependency), sizeof(entry));
+        uint64_t dependencySize;
+        int64_t dependencyTime;
+        UFileStamp(string(entry.path, strnlen(entry.path, sizeof(entry.path))), dependencySize, dependencyTime);
+        if (dependencySize != entry.size || dependencyTime != entry.time)
+            return false;
+    }
+
+    // Every index must name a cached vertex, or the draws would read past the vertex buffer (the mapping
+    // need not be aligned for the index type, hence the copies)
+    for (uint32_t i = 0; i < header.indexCount; ++i)
+    {
+        uint32_t index;
+        if (header.indexType == GL_UNSIGNED_SHORT)
+        {
+            GLushort shortIndex;
+            memcpy(&shortIndex, data + indexOffset + i * indexSize, sizeof(shortIndex));
+            index = shortIndex;
+        }
+        else
+            memcpy(&index, data + indexOffset + i * indexSize, sizeof(index));
+        if (index >= header.vertexCount)
+            return false;
+    }
+
+    mesh.subMeshes.resize(header.subMeshCount);
+    for (uint32_t i = 0; i < header.subMeshCount; ++i)
+    {
+        MeshCacheSubMesh entry;
+        memcpy(&entry, data + subMeshOffset + i * sizeof(MeshCacheSubMesh), sizeof(entry));
+        if (uint64_t(entry.firstIndex) + entry.indexCount > header.indexCount || entry.material >= int32_t(header.materialCount))
+            return false;
+
+        GLSubMesh& subMesh = mesh.subMeshes[i];
+        subMesh.name.assign(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        subMesh.firstIndex = entry.firstIndex;
+        subMesh.indexCount = GLsizei(entry.indexCount);
+        subMesh.material = entry.material;
+        subMesh.boundsMin = glm::make_vec3(entry.boundsMin);
+        subMesh.boundsMax = glm::make_vec3(entry.boundsMax);
+    }
+
+    mesh.materials.resize(header.materialCount);
+    for (uint32_t i = 0; i < header.materialCount; ++i)
+    {
+        MeshCacheMaterial entry;
+        memcpy(&entry, data + materialOffset + i * sizeof(MeshCacheMaterial), sizeof(entry));
+
+        GLMaterial& material = mesh.materials[i];
+        material.name.assign(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        material.color = glm::make_vec3(entry.color);
+        material.texture.assign(entry.texture, strnlen(entry.texture, sizeof(entry.texture)));
+    }
+
+    mesh.nVertices = header.vertexCount;
+    mesh.nIndices = GLsizei(header.indexCount);
+    mesh.indexType = header.indexType;
+    UUploadMesh(mesh, data + vertexOffset, data + indexOffset, name);
+    return true;
+}
+
+
+// Loads a glTF 2.0 (.gltf, .glb) or Wavefront OBJ model into mesh. The parsed and optimized mesh is saved
+// to a cache file next to the model, which later runs map and upload without parsing anything.
+bool ULoadModel(const string& path, GLMesh& mesh)
+{
+    const int64_t startNs = UProfileNow();
+
+    struct stat source;
+    if (stat(path.c_str(), &source) != 0)
+    {
+        LogMessage(LOG_ERROR) << "Failed to open model " << path;
+        return false;
+    }
+    const uint64_t sourceSize = uint64_t(source.st_size);
+    const int64_t sourceTime = int64_t(source.st_mtime);
+
+    mesh = GLMesh();
+
+    const string cachePath = path + MESH_CACHE_EXTENSION;
+    MappedFile cache;
+    if (gUseMeshCache && UMapFile(cachePath, cache))
+    {
+        const bool cacheHit = UUploadMeshCache(cache.data, cache.size, sourceSize, sourceTime, mesh, path);
+        UUnmapFile(cache);
+        if (cacheHit)
+        {
+            LogMessage(LOG_INFO) << "Model " << path << ": " << mesh.nVertices << " vertices, " << mesh.nIndices / 3 << " triangles, "
+                << mesh.subMeshes.size() << " objects, loaded from its cache in " << (UProfileNow() - startNs) / 1.0e6 << " ms";
+            return true;
+        }
+        mesh = GLMesh();
+    }
+
+    string extension = path.substr(std::min(path.find_last_of('.'), path.size()));
+    for (char& c : extension)
+        c = char(tolower((unsigned char)c));
+
+    ModelData model;
+    bool parsed = false;
+    if (extension == ".obj")
+        parsed = UParseObj(path, model);
+    else if (extension == ".gltf" || extension == ".glb")
+        parsed = UParseGltf(path, model);
+    else
+        LogMessage(LOG_ERROR) << "Unsupported model format " << path << " (expected .gltf, .glb or .obj)";
+    if (!parsed)
+        return false;
+    if (model.indices.empty())
+    {
+        LogMessage(LOG_ERROR) << "Model " << path << " has no triangles";
+        return false;
+    }
+    const int64_t parsedNs = UProfileNow();
+
+    // Same build stage as the built-in mesh
+    UGenerateNormals(model);
+    mesh.subMeshes.swap(model.subMeshes);
+    mesh.materials.swap(model.materials);
+    mesh.nVertices = GLuint(model.vertices.size() / MESH_FLOATS_PER_VERTEX);
+    mesh.nIndices = GLsizei(model.indices.size());
+
+    size_t unoptimizedInvocations, optimizedInvocations;
+    UOptimizeMesh(mesh, model.vertices, model.indices, MESH_FLOATS_PER_VERTEX, unoptimizedInvocations, optimizedInvocations);
+    UComputeSubMeshBounds(mesh, model.vertices, model.indices, MESH_FLOATS_PER_VERTEX);
+
+    vector<unsigned char> indexData;
+    UPackIndices(model.indices, mesh.nVertices, indexData, mesh.indexType);
+    UUploadMesh(mesh, model.vertices.data(), indexData.data(), path);
+
+    if (gUseMeshCache)
+    {
+        vector<unsigned char> file;
+        UBuildMeshCache(mesh, model.vertices, indexData, sourceSize, sourceTime, model.dependencies, file);
+
+        // Write to a temporary file first, so a concurrent or interrupted run never sees a partial cache
+        const string tempPath = cachePath + ".tmp";
+        ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+        out.close();
+        if (out)
+        {
+            remove(cachePath.c_str());
+            rename(tempPath.c_str(), cachePath.c_str());
+        }
+        else
+            remove(tempPath.c_str());
+    }
+
+    LogMessage(LOG_INFO) << "Model " << path << ": " << mesh.nVertices << " vertices, " << mesh.nIndices / 3 << " triangles, "
+        << mesh.subMeshes.size() << " objects, parsed in " << (parsedNs - startNs) / 1.0e6 << " ms, built in "
+        << (UProfileNow() - parsedNs) / 1.0e6 << " ms (vertex shader invocations " << unoptimizedInvocations << " -> "
+        << optimizedInvocations << ")";
+    return true;
+}
+
+
+// Width (and depth) of the ground plane in the world: its vertices span [-2, 2] before gPlaneScale
+float UPlaneExtent()
+{
+    return 4.0f * gPlaneScale.x;
+}
+
+
+// Lays out count bottle copies on a grid covering the ground plane, with a tint per copy
+void UCreateStressInstances(GLsizei count, vector<InstanceData>& instances)
+{
+    const GLsizei gridSize = GLsizei(ceil(sqrt(double(count))));
+    const float extent = UPlaneExtent();
+    const float spacing = extent / gridSize;
+    const float scale = glm::min(gPyramidScale.x, spacing * 1.5f); // Shrink dense grids so copies do not overlap
+
+    instances.resize(count);
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        const GLsizei row = i / gridSize;
+        const GLsizei column = i % gridSize;
+        // Each copy stands in the middle of its grid cell, so the grid is centered on the plane
+        glm::vec3 position(-0.5f * extent + spacing * (column + 0.5f), 0.0f, -0.5f * extent + spacing * (row + 0.5f));
+
+        instances[i].model = glm::translate(gPlanePosition + position) * glm::scale(glm::vec3(scale));
+        instances[i].normalMatrix = UNormalMatrix(instances[i].model);
+
+        // Cycle the tint through a few hues so neighbouring copies can be told apart
+        const float hue = float(i % 7) / 7.0f;
+        instances[i].color = glm::vec4(0.6f + 0.4f * cosf(6.2831853f * hue), 0.6f + 0.4f * cosf(6.2831853f * (hue - 0.333f)),
+            0.6f + 0.4f * cosf(6.2831853f * (hue - 0.667f)), 1.0f);
+    }
+}
+
+
+// Uploads the instance data and creates a VAO that reads the mesh's vertices per vertex and the instances per instance
+void UCreateInstanceBuffer(const GLMesh& mesh, const vector<InstanceData>& instances, GLInstanceBuffer& instanceBuffer)
+{
+    instanceBuffer.nInstances = GLsizei(instances.size());
+
+    instanceBuffer.vao.create("instanced scene mesh");
+    glBindVertexArray(instanceBuffer.vao);
+
+    // Per-vertex attributes and indices come from the mesh's buffers
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    USetMeshVertexAttributes(mesh);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+
+    // The instance attributes only get their layout here: URender points INSTANCE_VERTEX_BINDING at the frame's
+    // visible instances. A mat4 attribute takes one location per column; every attribute advances once per instance.
+    for (GLuint column = 0; column < 4; ++column)
+    {
+        glVertexAttribFormat(3 + column, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(InstanceData, model) + sizeof(glm::vec4) * column));
+        glVertexAttribBinding(3 + column, INSTANCE_VERTEX_BINDING);
+        glEnableVertexAttribArray(3 + column);
+    }
+
+    glVertexAttribFormat(7, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(InstanceData, color)));
+    glVertexAttribBinding(7, INSTANCE_VERTEX_BINDING);
+    glEnableVertexAttribArray(7);
+
+    for (GLuint column = 0; column < 3; ++column)
+    {
+        glVertexAttribFormat(8 + column, 3, GL_FLOAT, GL_FALSE, GLuint(offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * column));
+        glVertexAttribBinding(8 + column, INSTANCE_VERTEX_BINDING);
+        glEnableVertexAttribArray(8 + column);
+    }
+    glVertexBindingDivisor(INSTANCE_VERTEX_BINDING, 1);
+
+    // Every instance reads the same draw index: a divisor no instance count reaches
+    glVertexBindingDivisor(DRAW_INDEX_VERTEX_BINDING, 1u << 30);
+
+    glBindVertexArray(0);
+}
+
+
+void UDestroyInstanceBuffer(GLInstanceBuffer& instanceBuffer)
+{
+    instanceBuffer.vao.reset();
+}
+
+
+// Adds an object drawing subMeshCount consecutive sub-meshes, with its world-space bounding box
+void UAddSceneObject(Scene& scene, SceneObjectKind kind, const glm::mat4& model, const GLMesh& mesh, GLuint firstSubMesh, GLuint subMeshCount, GLuint instance = 0)
+{
+    glm::vec3 localMin(FLT_MAX), localMax(-FLT_MAX);
+    for (GLuint i = 0; i < subMeshCount; ++i)
+    {
+        localMin = glm::min(localMin, mesh.subMeshes[firstSubMesh + i].boundsMin);
+        localMax = glm::max(localMax, mesh.subMeshes[firstSubMesh + i].boundsMax);
+    }
+
+    // Transform the box's center, and its half extent by the absolute matrix (Arvo)
+    const glm::vec3 center = glm::vec3(model * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+    const glm::vec3 halfExtent = (localMax - localMin) * 0.5f;
+    glm::vec3 worldHalfExtent;
+    for (int row = 0; row < 3; ++row)
+        worldHalfExtent[row] = fabsf(model[0][row]) * halfExtent.x + fabsf(model[1][row]) * halfExtent.y + fabsf(model[2][row]) * halfExtent.z;
+
+    SceneObject object;
+    object.kind = kind;
+    object.model = model;
+    object.normalMatrix = UNormalMatrix(model);
+    object.instance = instance;
+    object.subMesh = firstSubMesh;
+    object.boundsMin = center - worldHalfExtent;
+    object.boundsMax = center + worldHalfExtent;
+    scene.objects.push_back(object);
+}
+
+
+// Builds the BVH node over objectOrder[begin, end), splitting at the median object centroid along the
+// longest axis; returns the node's index
+GLuint UBuildBvh(Scene& scene, GLuint begin, GLuint end)
+{
+    const GLuint nodeIndex = GLuint(scene.nodes.size());
+    scene.nodes.push_back(BvhNode());
+
+    BvhNode node;
+    node.boundsMin = glm::vec3(FLT_MAX);
+    node.boundsMax = glm::vec3(-FLT_MAX);
+    glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+    for (GLuint i = begin; i < end; ++i)
+    {
+        const SceneObject& object = scene.objects[scene.objectOrder[i]];
+        node.boundsMin = glm::min(node.boundsMin, object.boundsMin);
+        node.boundsMax = glm::max(node.boundsMax, object.boundsMax);
+        centroidMin = glm::min(centroidMin, object.boundsMin + object.boundsMax);
+        centroidMax = glm::max(centroidMax, object.boundsMin + object.boundsMax);
+    }
+
+    if (end - begin <= BVH_LEAF_SIZE)
+    {
+        node.first = begin;
+        node.objectCount = end - begin;
+    }
+    else
+    {
+        const glm::vec3 extent = centroidMax - centroidMin;
+        const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        const GLuint middle = begin + (end - begin) / 2;
+        const vector<SceneObject>& objects = scene.objects;
+        std::nth_element(scene.objectOrder.begin() + begin, scene.objectOrder.begin() + middle, scene.objectOrder.begin() + end,
+            [&objects, axis](GLuint a, GLuint b)
+            {
+                return objects[a].boundsMin[axis] + objects[a].boundsMax[axis] < objects[b].boundsMin[axis] + objects[b].boundsMax[axis];
+            });
+
+        UBuildBvh(scene, begin, middle); // Lands right after this node
+        node.first = UBuildBvh(scene, middle, end);
+        node.objectCount = 0;
+    }
+
+    scene.nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+
+// Places the scene's objects (from the global positions and scales, plus the stress scene's copies and
+// the loaded model's objects) and builds their bounding volume hierarchy
+void UCreateScene(const GLMesh& mesh, const GLMesh& model, const vector<InstanceData>& instances, Scene& scene)
+{
+    scene.objects.clear();
+    scene.nodes.clear();
+
+    // The stress scene's copies take the place of the single bottle
+    if (instances.empty())
+        UAddSceneObject(scene, SCENE_BOTTLE, glm::translate(gPyramidPosition) * glm::scale(gPyramidScale), mesh, SUBMESH_BOTTLE, 2);
+    for (GLuint i = 0; i < GLuint(instances.size()); ++i)
+        UAddSceneObject(scene, SCENE_BOTTLE_COPY, instances[i].model, mesh, SUBMESH_BOTTLE, 2, i);
+    UAddSceneObject(scene, SCENE_PLANE, glm::translate(gPlanePosition) * glm::scale(gPlaneScale), mesh, SUBMESH_PLANE, 1);
+    UAddSceneObject(scene, SCENE_LAMP, glm::translate(gLightPosition) * glm::scale(gLightScale), mesh, SUBMESH_BOTTLE, 1);
+
+    // Model: scaled so its largest dimension is MODEL_FIT_SIZE, standing on the plane at gModelPosition
+    if (model.vao)
+    {
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        for (const GLSubMesh& subMesh : model.subMeshes)
+        {
+            boundsMin = glm::min(boundsMin, subMesh.boundsMin);
+            boundsMax = glm::max(boundsMax, subMesh.boundsMax);
+        }
+        const glm::vec3 extent = boundsMax - boundsMin;
+        const float scale = MODEL_FIT_SIZE / glm::max(glm::max(extent.x, extent.y), glm::max(extent.z, 1e-6f));
+        const glm::vec3 base((boundsMin.x + boundsMax.x) * 0.5f, boundsMin.y, (boundsMin.z + boundsMax.z) * 0.5f);
+        const glm::mat4 placement = glm::translate(gModelPosition) * glm::scale(glm::vec3(scale)) * glm::translate(-base);
+
+        for (GLuint i = 0; i < GLuint(model.subMeshes.size()); ++i)
+            UAddSceneObject(scene, SCENE_MODEL, placement, model, i, 1);
+    }
+
+    scene.objectOrder.resize(scene.objects.size());
+    std::iota(scene.objectOrder.begin(), scene.objectOrder.end(), 0);
+    UBuildBvh(scene, 0, GLuint(scene.objects.size()));
+
+    gVisibleInstances.reserve(instances.size());
+
+    LogMessage(LOG_INFO) << "Scene: " << scene.objects.size() << " objects, " << scene.nodes.size() << " BVH nodes";
+}
+
+
+// Tests a box against the frustum planes (inward-facing, not normalized)
+CullResult UClassifyBounds(const glm::vec4* planes, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    CullResult result = CULL_INSIDE;
+    for (int i = 0; i < 6; ++i)
+    {
+        const glm::vec4& plane = planes[i];
+
+        // Corner furthest along the plane normal: if it is behind the plane, the whole box is
+        const float px = plane.x >= 0.0f ? boundsMax.x : boundsMin.x;
+        const float py = plane.y >= 0.0f ? boundsMax.y : boundsMin.y;
+        const float pz = plane.z >= 0.0f ? boundsMax.z : boundsMin.z;
+        if (plane.x * px + plane.y * py + plane.z * pz + plane.w < 0.0f)
+            return CULL_OUTSIDE;
+
+        // Opposite corner: if it is behind the plane, the box straddles it
+        const float nx = plane.x >= 0.0f ? boundsMin.x : boundsMax.x;
+        const float ny = plane.y >= 0.0f ? boundsMin.y : boundsMax.y;
+        const float nz = plane.z >= 0.0f ? boundsMin.z : boundsMax.z;
+        if (plane.x * nx + plane.y * ny + plane.z * nz + plane.w < 0.0f)
+            result = CULL_INTERSECTING;
+    }
+
+    return result;
+}
+
+
+// Collects the objects whose bounding boxes intersect the view frustum into scene.visible. Subtrees
+// entirely inside the frustum are accepted without further tests.
+void UCullScene(Scene& scene, const glm::mat4& viewProjection)
+{
+    // Frustum planes from the rows of the view-projection matrix (Gribb and Hartmann)
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; ++row)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    const glm::vec4 planes[6] =
+    {
+        rows[3] + rows[0], rows[3] - rows[0],   // Left, right
+        rows[3] + rows[1], rows[3] - rows[1],   // Bottom, top
+        rows[3] + rows[2], rows[3] - rows[2]    // Near, far
+    };
+
+    for (vector<GLuint>& visible : scene.visible)
+        visible.clear();
+    if (scene.nodes.empty())
+        return;
+
+    // Nodes left to visit, and whether they are known to be entirely inside the frustum
+    GLuint stack[64];
+    bool stackInside[64];
+    int top = 0;
+    stack[top] = 0;
+    stackInside[top++] = false;
+
+    while (top > 0)
+    {
+        --top;
+        const BvhNode& node = scene.nodes[stack[top]];
+        const GLuint nodeIndex = stack[top];
+        bool inside = stackInside[top];
+
+        if (!inside)
+        {
+            const CullResult result = UClassifyBounds(planes, node.boundsMin, node.boundsMax);
+            if (result == CULL_OUTSIDE)
+                continue;
+            inside = result == CULL_INSIDE;
+        }
+
+        if (node.objectCount == 0)
+        {
+            stack[top] = node.first;
+            stackInside[top++] = inside;
+            stack[top] = nodeIndex + 1;
+            stackInside[top++] = inside;
+            continue;
+        }
+
+        for (GLuint i = 0; i < node.objectCount; ++i)
+        {
+            const GLuint objectIndex = scene.objectOrder[node.first + i];
+            const SceneObject& object = scene.objects[objectIndex];
+
+            // A leaf's box is looser than its objects' boxes: test them unless the leaf is inside
+            if (inside || UClassifyBounds(planes, object.boundsMin, object.boundsMax) != CULL_OUTSIDE)
+                scene.visible[object.kind].push_back(objectIndex);
+        }
+    }
+}
+
+
+// Welds bit-identical vertices: uniqueVerts receives one copy of each distinct vertex
+// and indices one entry per source vertex
+void UWeldVertices(const GLfloat* verts, GLuint vertexCount, GLuint floatsPerVertex, vector<GLfloat>& uniqueVerts, vector<GLuint>& indices)
+{
+    const size_t vertexBytes = sizeof(GLfloat) * floatsPerVertex;
+
+    // Open-addressing hash table of unique vertex numbers plus one (0 marks an empty slot)
+    size_t tableSize = 1;
+    while (tableSize < size_t(vertexCount) * 2)
+        tableSize <<= 1;
+    vector<GLuint> table(tableSize, 0);
+
+    uniqueVerts.clear();
+    indices.resize(vertexCount);
+
+    for (GLuint v = 0; v < vertexCount; ++v)
+    {
+        const GLfloat* vertex = verts + size_t(v) * floatsPerVertex;
+
+        // FNV-1a hash of the raw vertex bytes
+        uint32_t hash = 2166136261u;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertex);
+        for (size_t b = 0; b < vertexBytes; ++b)
+            hash = (hash ^ bytes[b]) * 16777619u;
+
+        size_t slot = hash & (tableSize - 1);
+        while (table[slot] != 0 && memcmp(&uniqueVerts[size_t(table[slot] - 1) * floatsPerVertex], vertex, vertexBytes) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if (table[slot] == 0)
+        {
+            uniqueVerts.insert(uniqueVerts.end(), vertex, vertex + floatsPerVertex);
+            table[slot] = GLuint(uniqueVerts.size() / floatsPerVertex);
+        }
+        indices[v] = table[slot] - 1;
+    }
+}
+
+
+// Vertex score of Forsyth's linear-speed vertex cache optimization
+float UVertexCacheScore(int cachePosition, GLuint remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f; // No triangle left to emit: the vertex no longer matters
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // Vertices of the last triangle get a fixed score so the next triangle does not just reuse the same edge
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = powf(1.0f - float(cachePosition - 3) / float(VERTEX_CACHE_SIZE - 3), 1.5f);
+    }
+
+    // Boost vertices with few triangles left so they are finished off instead of being orphaned
+    score += 2.0f * powf(float(remainingTriangles), -0.5f);
+
+    return score;
+}
+
+
+// Reorders the triangles of an index range for post-transform vertex cache locality
+// (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation")
+void UOptimizeVertexCache(GLuint* indices, size_t indexCount, GLuint vertexCount)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Per-vertex lists of the triangles still to be emitted
+    vector<GLuint> remaining(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; ++i)
+        ++remaining[indices[i]];
+
+    vector<GLuint> offsets(vertexCount + 1, 0);
+    for (GLuint v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + remaining[v];
+
+    vector<GLuint> adjacency(indexCount);
+    vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; ++t)
+        for (int k = 0; k < 3; ++k)
+            adjacency[fill[indices[t * 3 + k]]++] = GLuint(t);
+
+    // Initial scores
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> vertexScore(vertexCount);
+    for (GLuint v = 0; v < vertexCount; ++v)
+        vertexScore[v] = UVertexCacheScore(-1, remaining[v]);
+
+    vector<float> triangleScore(triangleCount);
+    vector<bool> emitted(triangleCount, false);
+    size_t bestTriangle = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        if (triangleScore[t] > triangleScore[bestTriangle])
+            bestTriangle = t;
+    }
+
+    vector<GLuint> output;
+    output.reserve(indexCount);
+    vector<GLuint> cache, newCache;
+    size_t scanCursor = 0;
+    bool haveBest = true;
+
+    while (output.size() < indexCount)
+    {
+        // Nothing in the cache touches a pending triangle: restart from the next one not yet emitted
+        if (!haveBest)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+            bestTriangle = scanCursor;
+        }
+
+        const GLuint* triangle = indices + bestTriangle * 3;
+        emitted[bestTriangle] = true;
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // Remove the triangle from the pending lists of its vertices
+        for (int k = 0; k < 3; ++k)
+        {
+            GLuint v = triangle[k];
+            GLuint* pending = &adjacency[offsets[v]];
+            for (GLuint i = 0; i < remaining[v]; ++i)
+            {
+                if (pending[i] == bestTriangle)
+                {
+                    pending[i] = pending[remaining[v] - 1];
+                    break;
+                }
+            }
+            --remaining[v];
+        }
+
+        // Move the triangle's vertices to the front of the modeled LRU cache
+        newCache.assign(triangle, triangle + 3);
+        for (GLuint v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache.push_back(v);
+
+        // Rescore the cached (and just evicted) vertices and their pending triangles
+        for (size_t i = 0; i < newCache.size(); ++i)
+        {
+            GLuint v = newCache[i];
+            cachePosition[v] = i < VERTEX_CACHE_SIZE ? int(i) : -1;
+            vertexScore[v] = UVertexCacheScore(cachePosition[v], remaining[v]);
+        }
+
+        haveBest = false;
+        float bestScore = -1.0f;
+        for (GLuint v : newCache)
+        {
+            for (GLuint i = 0; i < remaining[v]; ++i)
+            {
+                GLuint t = adjacency[offsets[v] + i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                    haveBest = true;
+                }
+            }
+        }
+
+        if (newCache.size() > VERTEX_CACHE_SIZE)
+            newCache.resize(VERTEX_CACHE_SIZE);
+        cache.swap(newCache);
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+
+// Reorders clusters of cache-optimized triangles so outward-facing clusters are drawn first and
+// occlude what is behind them. Clusters start where the vertex cache is flushed, so the cache
+// efficiency is kept (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+void UOptimizeOverdraw(GLuint* indices, size_t indexCount, const vector<GLfloat>& verts, GLuint floatsPerVertex)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    struct Cluster
+    {
+        size_t first;   // First index of the cluster
+        size_t count;   // Number of indices of the cluster
+        float sortKey;  // How much the cluster faces away from the mesh center
+    };
+    vector<Cluster> clusters;
+
+    // Hard cluster boundaries: triangles whose three vertices all miss the FIFO cache
+    vector<GLuint> fifo(VERTEX_CACHE_SIZE, ~0u);
+    size_t fifoHead = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            GLuint v = indices[t * 3 + k];
+            if (std::find(fifo.begin(), fifo.end(), v) == fifo.end())
+            {
+                fifo[fifoHead] = v;
+                fifoHead = (fifoHead + 1) % VERTEX_CACHE_SIZE;
+                ++misses;
+            }
+        }
+
+        if (t == 0 || misses == 3)
+            clusters.push_back({ t * 3, 0, 0.0f });
+        clusters.back().count += 3;
+    }
+
+    // Area-weighted centroid and normal of a range of triangles
+    auto accumulate = [&](size_t first, size_t count, glm::vec3& centroid, glm::vec3& normal)
+    {
+        float area = 0.0f;
+        centroid = glm::vec3(0.0f);
+        normal = glm::vec3(0.0f);
+        for (size_t i = first; i < first + count; i += 3)
+        {
+            glm::vec3 p0 = glm::make_vec3(&verts[size_t(indices[i]) * floatsPerVertex]);
+            glm::vec3 p1 = glm::make_vec3(&verts[size_t(indices[i + 1]) * floatsPerVertex]);
+            glm::vec3 p2 = glm::make_vec3(&verts[size_t(indices[i + 2]) * floatsPerVertex]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // Length is twice the triangle area
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            centroid = centroid / area;
+    };
+
+    glm::vec3 meshCentroid, meshNormal;
+    accumulate(0, indexCount, meshCentroid, meshNormal);
+
+    for (Cluster& cluster : clusters)
+    {
+        glm::vec3 centroid, normal;
+        accumulate(cluster.first, cluster.count, centroid, normal);
+        float normalLength = glm::length(normal);
+        cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    vector<GLuint> output;
+    output.reserve(indexCount);
+    for (const Cluster& cluster : clusters)
+        output.insert(output.end(), indices + cluster.first, indices + cluster.first + cluster.count);
+    std::copy(output.begin(), output.end(), indices);
+}
+
+
+// Renumbers the vertices in order of first use so vertex fetch walks the buffer sequentially
+void UOptimizeVertexFetch(vector<GLuint>& indices, vector<GLfloat>& verts, GLuint floatsPerVertex)
+{
+    const GLuint vertexCount = GLuint(verts.size() / floatsPerVertex);
+    vector<GLuint> remap(vertexCount, ~0u);
+    vector<GLfloat> reordered;
+    reordered.reserve(verts.size());
+
+    for (GLuint& index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = GLuint(reordered.size() / floatsPerVertex);
+            reordered.insert(reordered.end(), verts.begin() + size_t(index) * floatsPerVertex, verts.begin() + size_t(index + 1) * floatsPerVertex);
+        }
+        index = remap[index];
+    }
+
+    verts.swap(reordered); // Unreferenced vertices are dropped
+}
+
+
+// Counts the vertex shader invocations of an indexed draw with a FIFO post-transform cache model
+size_t UCountVertexShaderInvocations(const GLuint* indices, size_t indexCount)
+{
+    vector<GLuint> fifo(VERTEX_CACHE_SIZE, ~0u);
+    size_t fifoHead = 0;
+    size_t invocations = 0;
+
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end())
+        {
+            fifo[fifoHead] = indices[i];
+            fifoHead = (fifoHead + 1) % VERTEX_CACHE_SIZE;
+            ++invocations;
+        }
+    }
+
+    return invocations;
+}
+
+
+// Byte offset of an index in a mesh's element buffer, as expected by glDrawElements
+const void* UIndexOffset(const GLMesh& mesh, GLuint firstIndex)
+{
+    size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    return reinterpret_cast<const void*>(size_t(firstIndex) * indexSize);
+}
+
+
+void UDestroyMesh(GLMesh& mesh)
+{
+    mesh.vao.reset();
+    mesh.vbo.reset();
+    mesh.ebo.reset();
+}
+
+
+/*Generate the texture and queue its image for background loading*/
+// The texture holds a 1x1 placeholder until UPumpTextureLoads uploads the image. Returns false if the
+// file is not a readable image (only its header is read here).
+bool UCreateTexture(const char* filename, GLTexture& texture)
+{
+    int width, height, channels;
+    if (!stbi_info(filename, &width, &height, &channels))
+        return false;
+
+    texture.create(filename);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Neutral grey placeholder until the image is resident
+    const unsigned char placeholder[] = { 128, 128, 128, 255 };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    USetResourceSize(RESOURCE_TEXTURE, texture, sizeof(placeholder));
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+    TextureLoader& loader = gTextureLoader;
+    std::unique_ptr<TextureLoad> load(new TextureLoad());
+    load->filename = filename;
+    load->textureId = texture;
+    load->state = TEXTURE_QUEUED;
+    load->pixels = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.queued.push_back(load.get());
+        loader.loads.push_back(std::move(load));
+    }
+    loader.jobAdded.notify_one();
+    gTexturesPending = true;
+
+    UAddTextureSlot(gTextureTable, texture);
+    return true;
+}
+
+
+// Reserves size bytes of the staging buffer for a worker, waiting while the main thread retires older
+// uploads. Returns false if the image can never fit or the loader is shutting down.
+bool UAllocateStaging(size_t size, size_t& offset)
+{
+    TextureLoader& loader = gTextureLoader;
+    if (size > loader.capacity)
+        return false;
+
+    std::unique_lock<std::mutex> lock(loader.mutex);
+    while (!loader.stopping)
+    {
+        bool found = false;
+        if (loader.regions.empty())
+        {
+            offset = 0;
+            found = true;
+        }
+        else
+        {
+            // Keep regions 16-byte aligned for the driver's copy from the unpack buffer
+            const size_t head = (loader.regions.back().end + 15) & ~size_t(15);
+            const size_t tail = loader.regions.front().begin;
+            const bool wrapped = loader.regions.back().begin < tail;
+
+            if (!wrapped && head <= loader.capacity && loader.capacity - head >= size)
+            {
+                offset = head;
+                found = true;
+            }
+            else if (!wrapped && tail >= size)
+            {
+                offset = 0;
+                found = true;
+            }
+            else if (wrapped && tail >= head && tail - head >= size)
+            {
+                offset = head;
+                found = true;
+            }
+        }
+
+        if (found)
+        {
+            loader.regions.push_back({ offset, offset + size, 0 });
+            return true;
+        }
+
+        loader.stagingFreed.wait(lock);
+    }
+
+    return false;
+}
+
+
+// Decodes the source image and copies it, flipped for OpenGL, into the staging buffer
+bool ULoadUncompressedTexture(TextureLoad& load)
+{
+    unsigned char* image = stbi_load(load.filename.c_str(), &load.width, &load.height, &load.channels, 0);
+
+    if (!image || (load.channels != 3 && load.channels != 4))
+    {
+        stbi_image_free(image);
+        return false;
+    }
+
+    const size_t rowBytes = size_t(load.width) * load.channels;
+    const size_t size = rowBytes * load.height;
+
+    load.staged = UAllocateStaging(size, load.stagingOffset);
+    if (load.staged)
+    {
+        // Images are loaded with Y axis going down, but OpenGL's Y axis goes up: copy the rows bottom-up
+        unsigned char* destination = gTextureLoader.mapped + load.stagingOffset;
+        for (int row = 0; row < load.height; ++row)
+            memcpy(destination + rowBytes * row, image + rowBytes * (load.height - 1 - row), rowBytes);
+        stbi_image_free(image);
+    }
+    else
+    {
+        flipImageVertically(image, load.width, load.height, load.channels);
+        load.pixels = image;
+    }
+
+    return true;
+}
+
+
+// Maps the image's cache file, baking (and writing) it first if it is missing or older than the source,
+// and copies the compressed levels into the staging buffer
+bool ULoadCompressedTexture(TextureLoad& load)
+{
+    struct stat source;
+    if (stat(load.filename.c_str(), &source) != 0)
+        return false;
+
+    const string cachePath = load.filename + TEXTURE_CACHE_EXTENSION;
+    MappedFile cache = {};
+    vector<unsigned char> baked;
+    const unsigned char* data;
+    size_t size;
+    size_t levelDataOffset;
+
+    load.cacheHit = UMapFile(cachePath, cache) &&
+        UParseTextureCache(cache.data, cache.size, uint64_t(source.st_size), int64_t(source.st_mtime), load, levelDataOffset);
+    if (load.cacheHit)
+    {
+        data = cache.data;
+        size = cache.size;
+    }
+    else
+    {
+        UUnmapFile(cache);
+        if (!UBakeTextureCache(load.filename, uint64_t(source.st_size), int64_t(source.st_mtime), baked))
+            return false;
+        UParseTextureCache(baked.data(), baked.size(), uint64_t(source.st_size), int64_t(source.st_mtime), load, levelDataOffset);
+        data = baked.data();
+        size = baked.size();
+
+        // Write to a temporary file first, so a concurrent or interrupted run never sees a partial cache
+        const string tempPath = cachePath + ".tmp";
+        ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(data), size);
+        out.close();
+        if (out)
+        {
+            remove(cachePath.c_str());
+            rename(tempPath.c_str(), cachePath.c_str());
+        }
+        else
+            remove(tempPath.c_str());
+    }
+
+    const size_t levelDataSize = size - levelDataOffset;
+    load.staged = UAllocateStaging(levelDataSize, load.stagingOffset);
+    if (load.staged)
+        memcpy(gTextureLoader.mapped + load.stagingOffset, data + levelDataOffset, levelDataSize);
+    else
+        load.compressed.assign(data + levelDataOffset, data + size);
+
+    UUnmapFile(cache);
+    return true;
+}
+
+
+// Worker thread: decodes queued images into the staging buffer
+void UTextureWorker()
+{
+    TextureLoader& loader = gTextureLoader;
+
+    for (;;)
+    {
+        TextureLoad* load;
+        {
+            std::unique_lock<std::mutex> lock(loader.mutex);
+            loader.jobAdded.wait(lock, [&loader] { return loader.stopping || !loader.queued.empty(); });
+            if (loader.stopping)
+                return;
+            load = loader.queued.front();
+            loader.queued.pop_front();
+        }
+
+        load->state = TEXTURE_DECODING;
+        const bool loaded = gUseTextureCache ? ULoadCompressedTexture(*load) : ULoadUncompressedTexture(*load);
+        load->state = loaded ? TEXTURE_UPLOADING : TEXTURE_FAILED;
+
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.decoded.push_back(load);
+    }
+}
+
+
+// Creates the persistently mapped staging buffer and starts the decode threads
+void UCreateTextureLoader()
+{
+    TextureLoader& loader = gTextureLoader;
+    loader.stopping = false;
+    loader.capacity = TEXTURE_STAGING_SIZE;
+
+    if (gUseTextureCache && !GLEW_EXT_texture_compression_s3tc)
+    {
+        LogMessage(LOG_WARNING) << "S3TC texture compression is not supported; texture cache disabled";
+        gUseTextureCache = false;
+    }
+
+    // Mapped once for the whole run; coherent, so worker writes are visible to later uploads without flushes
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    loader.pbo.create("texture staging buffer");
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbo);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, loader.capacity, NULL, flags);
+    USetResourceSize(RESOURCE_BUFFER, loader.pbo, loader.capacity);
+    loader.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, loader.capacity, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Images larger than the staging buffer (or all of them, if mapping failed) use client memory instead
+    if (!loader.mapped)
+        loader.capacity = 0;
+
+    // Leave a core for the render loop; decoding a handful of images does not need more than four threads
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    threadCount = threadCount > 1 ? std::min(threadCount - 1, 4u) : 1u;
+    for (unsigned int i = 0; i < threadCount; ++i)
+        loader.workers.emplace_back(UTextureWorker);
+}
+
+
+void UDestroyTextureLoader()
+{
+    TextureLoader& loader = gTextureLoader;
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.stopping = true;
+    }
+    loader.jobAdded.notify_all();
+    loader.stagingFreed.notify_all();
+    for (std::thread& worker : loader.workers)
+        worker.join();
+    loader.workers.clear();
+
+    for (TextureLoad* load : loader.decoded)
+        stbi_image_free(load->pixels);
+    loader.decoded.clear();
+    loader.queued.clear();
+
+    for (StagingRegion& region : loader.regions)
+        if (region.fence)
+            glDeleteSync(region.fence);
+    loader.regions.clear();
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbo);
+    if (loader.mapped)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    loader.pbo.reset();
+    loader.mapped = nullptr;
+}
+
+
+// Uploads the images the workers have decoded and retires the staging regions the GPU has finished
+// reading. Runs once per frame on the GL thread and never waits for the GPU.
+void UPumpTextureLoads()
+{
+    TextureLoader& loader = gTextureLoader;
+    if (!gTexturesPending)
+        return;
+
+    std::deque<TextureLoad*> ready;
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        ready.swap(loader.decoded);
+    }
+
+    for (TextureLoad* load : ready)
+    {
+        if (load->state == TEXTURE_FAILED)
+        {
+            LogMessage(LOG_ERROR) << "Failed to load texture " << load->filename;
+            continue;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, load->textureId);
+
+        if (load->compressedFormat)
+        {
+            // Upload the baked mip chain as is
+            const unsigned char* base = load->staged ? (const unsigned char*)load->stagingOffset : load->compressed.data();
+            if (load->staged)
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbo);
+            for (size_t level = 0; level < load->levels.size(); ++level)
+            {
+                const TextureLevel& entry = load->levels[level];
+                glCompressedTexImage2D(GL_TEXTURE_2D, GLint(level), load->compressedFormat, entry.width, entry.height, 0, GLsizei(entry.size), base + entry.offset);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(load->levels.size()) - 1);
+
+            size_t compressedSize = 0;
+            for (const TextureLevel& entry : load->levels)
+                compressedSize += size_t(entry.size);
+            USetResourceSize(RESOURCE_TEXTURE, load->textureId, compressedSize);
+            LogMessage(LOG_INFO) << "Texture " << load->filename << (load->cacheHit ? " loaded from cache: " : " baked into cache: ")
+                << (load->compressedFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? "BC3, " : "BC1, ") << load->levels.size() << " levels, "
+                << compressedSize / 1024 << " KiB (" << size_t(load->width) * load->height * 4 * 4 / 3 / 1024 << " KiB as RGBA8)";
+            vector<unsigned char>().swap(load->compressed);
+        }
+        else
+        {
+            const GLenum format = load->channels == 4 ? GL_RGBA : GL_RGB;
+            const GLint internalFormat = load->channels == 4 ? GL_RGBA8 : GL_RGB8;
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows are tightly packed
+            if (load->staged)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbo);
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, load->width, load->height, 0, format, GL_UNSIGNED_BYTE, (void*)load->stagingOffset);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, load->width, load->height, 0, format, GL_UNSIGNED_BYTE, load->pixels);
+                stbi_image_free(load->pixels);
+                load->pixels = nullptr;
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glGenerateMipmap(GL_TEXTURE_2D);
+
+            // Drivers pad RGB8 texels to four bytes; the mip chain adds a third
+            USetResourceSize(RESOURCE_TEXTURE, load->textureId, size_t(load->width) * load->height * 4 * 4 / 3);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // The region may be reused once the GPU has read it
+        if (load->staged)
+        {
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            std::lock_guard<std::mutex> lock(loader.mutex);
+            for (StagingRegion& region : loader.regions)
+                if (region.begin == load->stagingOffset && region.fence == 0)
+                {
+                    region.fence = fence;
+                    break;
+                }
+        }
+
+        load->state = TEXTURE_RESIDENT;
+        UUpdateTextureSlot(gTextureTable, load->textureId);
+    }
+
+    // Retire the oldest regions whose uploads have completed
+    bool freed = false;
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        while (!loader.regions.empty() && loader.regions.front().fence)
+        {
+            GLenum status = glClientWaitSync(loader.regions.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(loader.regions.front().fence);
+            loader.regions.pop_front();
+            freed = true;
+        }
+
+        gTexturesPending = false;
+        for (const std::unique_ptr<TextureLoad>& load : loader.loads)
+            if (load->state != TEXTURE_RESIDENT && load->state != TEXTURE_FAILED)
+                gTexturesPending = true;
+    }
+    if (freed)
+        loader.stagingFreed.notify_all();
+
+    if (!gTexturesPending)
+        LogMessage(LOG_INFO) << "All textures loaded after " << (UProfileNow() - gStartTimeNs) / 1.0e6 << " ms";
+}
+
+
+// Blocks until every queued texture is resident (or failed), for runs that must not see placeholders
+void UWaitForTextureLoads()
+{
+    while (gTexturesPending)
+    {
+        UPumpTextureLoads();
+        if (gTexturesPending)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+
+// Load state of a texture created by UCreateTexture
+TextureLoadState UGetTextureLoadState(GLuint textureId)
+{
+    std::lock_guard<std::mutex> lock(gTextureLoader.mutex);
+    for (const std::unique_ptr<TextureLoad>& load : gTextureLoader.loads)
+        if (load->textureId == textureId)
+            return TextureLoadState(load->state.load());
+
+    return TEXTURE_FAILED;
+}
+
+
+// Creates the texture table: bindless handles where ARB_bindless_texture is available (and not disabled),
+// a texture array otherwise. The array itself is allocated once the slots are known (UReserveTextureArray).
+bool UCreateTextureTable(TextureTable& table)
+{
+    table.bindless = gUseBindless && GLEW_ARB_bindless_texture;
+    table.arrayLayers = 0;
+    table.placeholderHandle = 0;
+
+    if (table.bindless)
+    {
+        // Slots point at this grey texture until their image is resident: a handle freezes its texture
+        const unsigned char grey[] = { 128, 128, 128, 255 };
+        table.placeholder.create("texture table placeholder");
+        glBindTexture(GL_TEXTURE_2D, table.placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        USetResourceSize(RESOURCE_TEXTURE, table.placeholder, sizeof(grey));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        table.placeholderHandle = glGetTextureHandleARB(table.placeholder);
+        glMakeTextureHandleResidentARB(table.placeholderHandle);
+
+        LogMessage(LOG_INFO) << "Textures: bindless handles";
+        return true;
+    }
+
+    // Layers are filled by drawing the loaded texture into them, which works for any size and format
+    GLUniformLocations uniforms;
+    if (!UCreateShaderProgram(textureCopyVertexShaderSource, textureCopyFragmentShaderSource, table.copyProgram, uniforms, "texture copy program"))
+        return false;
+    glUniform1i(glGetUniformLocation(table.copyProgram, "uSource"), 0);
+    table.copyVao.create("texture copy");
+    table.copyFramebuffer.create("texture copy");
+
+    LogMessage(LOG_INFO) << "Textures: " << TEXTURE_ARRAY_SIZE << "x" << TEXTURE_ARRAY_SIZE << " texture array (no ARB_bindless_texture"
+        << (gUseBindless ? "" : ", or --no-bindless") << ")";
+    return true;
+}
+
+
+void UDestroyTextureTable(TextureTable& table)
+{
+    if (table.bindless)
+    {
+        for (const TextureSlot& slot : table.slots)
+            if (slot.handle != table.placeholderHandle)
+                glMakeTextureHandleNonResidentARB(slot.handle);
+        glMakeTextureHandleNonResidentARB(table.placeholderHandle);
+        table.placeholder.reset();
+    }
+    else
+    {
+        table.arrayTexture.reset();
+        table.copyFramebuffer.reset();
+        table.copyVao.reset();
+        UDestroyShaderProgram(table.copyProgram);
+    }
+    table.slots.clear();
+    table.slotOfTexture.clear();
+}
+
+
+// Gives a texture created by UCreateTexture its slot; it samples the placeholder until UUpdateTextureSlot
+GLuint UAddTextureSlot(TextureTable& table, GLuint textureId)
+{
+    const GLuint index = GLuint(table.slots.size());
+    TextureSlot slot;
+    slot.textureId = textureId;
+    slot.wrapMode = GL_REPEAT;
+    slot.handle = table.placeholderHandle;
+    table.slots.push_back(slot);
+    table.slotOfTexture[textureId] = index;
+    return index;
+}
+
+
+// Slot of a texture, or 0 if it has none (its draws then sample slot 0's texture)
+GLuint UTextureSlot(const TextureTable& table, GLuint textureId)
+{
+    std::unordered_map<GLuint, GLuint>::const_iterator found = table.slotOfTexture.find(textureId);
+    return found != table.slotOfTexture.end() ? found->second : 0;
+}
+
+
+// Points a texture's slot at its image once it is resident: a bindless handle, or a copy in the slot's layer
+void UUpdateTextureSlot(TextureTable& table, GLuint textureId)
+{
+    std::unordered_map<GLuint, GLuint>::const_iterator found = table.slotOfTexture.find(textureId);
+    if (found == table.slotOfTexture.end())
+        return;
+
+    TextureSlot& slot = table.slots[found->second];
+    if (table.bindless)
+    {
+        slot.handle = glGetTextureHandleARB(textureId);
+        glMakeTextureHandleResidentARB(slot.handle);
+    }
+    else
+    {
+        UReserveTextureArray(table);
+        UCopyToTextureArray(table, textureId, found->second);
+    }
+}
+
+
+// (Re)allocates the texture array with a layer per slot. Layers already filled are copied over; new ones
+// start grey, like the placeholder of UCreateTexture.
+void UReserveTextureArray(TextureTable& table)
+{
+    const GLsizei layers = std::max(GLsizei(table.slots.size()), 1);
+    if (table.bindless || layers <= table.arrayLayers)
+        return;
+
+    GLTexture arrayTexture;
+    arrayTexture.create("texture array");
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrayTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, TEXTURE_ARRAY_LEVELS, GL_RGBA8, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE, layers);
+    size_t bytes = 0;
+    for (GLsizei level = 0; level < TEXTURE_ARRAY_LEVELS; ++level)
+        bytes += size_t(TEXTURE_ARRAY_SIZE >> level) * (TEXTURE_ARRAY_SIZE >> level) * 4 * layers;
+    USetResourceSize(RESOURCE_TEXTURE, arrayTexture, bytes);
+    // The shaders apply each slot's wrap mode themselves: the sampler only has to repeat. Mipmapped like the
+    // bindless textures, so the tiled plane and distant copies do not alias.
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Every level of the new layers starts grey; the filled layers bring their whole mipmap chain along
+    const unsigned char grey[] = { 128, 128, 128, 255 };
+    for (GLsizei level = 0; level < TEXTURE_ARRAY_LEVELS; ++level)
+    {
+        glClearTexImage(arrayTexture, level, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        if (table.arrayTexture)
+            glCopyImageSubData(table.arrayTexture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, arrayTexture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                TEXTURE_ARRAY_SIZE >> level, TEXTURE_ARRAY_SIZE >> level, table.arrayLayers);
+    }
+
+    table.arrayTexture = std::move(arrayTexture);   // Deletes the old array
+    table.arrayLayers = layers;
+}
+
+
+// Resamples a resident texture into a layer of the texture array by drawing it into the layer. Blits and
+// image copies would need matching (and renderable) formats; the cached textures are block-compressed.
+void UCopyToTextureArray(const TextureTable& table, GLuint textureId, GLuint layer)
+{
+    GLint viewport[4];
+    GLint framebuffer = 0;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+
+    // The copy framebuffer has no depth buffer, so depth testing passes every fragment
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, table.copyFramebuffer);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, table.arrayTexture, 0, GLint(layer));
+    glViewport(0, 0, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE);
+
+    glUseProgram(table.copyProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glBindVertexArray(table.copyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    // Rebuild the smaller levels from the new level 0 (the other layers' levels come out unchanged)
+    glBindTexture(GL_TEXTURE_2D_ARRAY, table.arrayTexture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+
+// Writes this frame's slot table (handles or layers, and wrap modes) into the dynamic ring
+void UUploadTextureTable(TextureTable& table, DynamicRing& ring)
+{
+    UReserveTextureArray(table);
+
+    const size_t count = std::max(table.slots.size(), size_t(1));
+    table.slotData = UAllocateDynamic(ring, count * sizeof(TextureSlotData), ring.storageAlignment);
+    if (table.slotData.size == 0)
+        return;
+
+    TextureSlotData* data = reinterpret_cast<TextureSlotData*>(ring.mapped + UDynamicOffset(ring, table.slotData.offset));
+    for (size_t i = 0; i < count; ++i)
+    {
+        const bool used = i < table.slots.size();
+        data[i].handle = used ? table.slots[i].handle : table.placeholderHandle;
+        data[i].layer = GLuint(i);
+        data[i].wrapMode = used ? table.slots[i].wrapMode : GL_REPEAT;
+    }
+}
+
+
+// Binds the slot table UUploadTextureTable wrote this frame, and the texture array to texture unit 0
+void UBindTextureTable(const TextureTable& table, const DynamicRing& ring)
+{
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, TEXTURE_SLOT_BUFFER_BINDING, ring.buffer, UDynamicOffset(ring, table.slotData.offset), table.slotData.size);
+    if (!table.bindless)
+        glBindTexture(GL_TEXTURE_2D_ARRAY, table.arrayTexture);
+}
+
+
+// Maps a whole file read-only; returns false if it cannot be opened
+bool UMapFile(const string& path, MappedFile& file)
+{
+    file.data = nullptr;
+    file.size = 0;
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file referenced
+    if (mapping == MAP_FAILED)
+        return false;
+
+    file.data = static_cast<const unsigned char*>(mapping);
+    file.size = size_t(info.st_size);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+
+    file.buffer.resize(size_t(in.tellg()));
+    in.seekg(0);
+    if (file.buffer.empty() || !in.read(reinterpret_cast<char*>(file.buffer.data()), file.buffer.size()))
+        return false;
+
+    file.data = file.buffer.data();
+    file.size = file.buffer.size();
+#endif
+
+    return true;
+}
+
+
+void UUnmapFile(MappedFile& file)
+{
+#ifndef _WIN32
+    if (file.data)
+        munmap(const_cast<unsigned char*>(file.data), file.size);
+#endif
+    vector<unsigned char>().swap(file.buffer);
+    file.data = nullptr;
+    file.size = 0;
+}
+
+
+// Packs an 8-bit colour into RGB565
+uint16_t UPackRgb565(const float* color)
+{
+    const int r = int(glm::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    const int g = int(glm::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+    const int b = int(glm::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+
+// Expands an RGB565 colour back to 8 bits per channel
+void UUnpackRgb565(uint16_t packed, int* color)
+{
+    const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+
+// Compresses a 4x4 block of RGBA8 pixels into an 8-byte BC1 (DXT1) colour block. The endpoints are the
+// pixels furthest apart along the block's principal colour axis.
+void UCompressBlockBC1(const unsigned char* pixels, unsigned char* block)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            mean[c] += pixels[i * 4 + c] / 16.0f;
+
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i)
+    {
+        const float r = pixels[i * 4 + 0] - mean[0], g = pixels[i * 4 + 1] - mean[1], b = pixels[i * 4 + 2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+
+    // A few power iterations are enough to find the dominant axis
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 4; ++iteration)
+    {
+        const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const float length = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+        if (length == 0.0f)
+            break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
 
-    // Reference matrix uniforms from the Pyramid Shader program for the pyramid color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gPlaneProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gPlaneProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gPlaneProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gPlaneProgramId, "viewPosition");
+    int minPixel = 0, maxPixel = 0;
+    float minProjection = 1e30f, maxProjection = -1e30f;
+    for (int i = 0; i < 16; ++i)
+    {
+        const float projection = pixels[i * 4 + 0] * axis[0] + pixels[i * 4 + 1] * axis[1] + pixels[i * 4 + 2] * axis[2];
+        if (projection < minProjection) { minProjection = projection; minPixel = i; }
+        if (projection > maxProjection) { maxProjection = projection; maxPixel = i; }
+    }
 
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+    float endpoint0[3], endpoint1[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        endpoint0[c] = pixels[maxPixel * 4 + c];
+        endpoint1[c] = pixels[minPixel * 4 + c];
+    }
+    uint16_t color0 = UPackRgb565(endpoint0);
+    uint16_t color1 = UPackRgb565(endpoint1);
 
-    UVScaleLoc = glGetUniformLocation(gPlaneProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    // color0 > color1 selects the four-colour mode
+    if (color0 < color1)
+        std::swap(color0, color1);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdGranite);
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        int palette[4][3];
+        UUnpackRgb565(color0, palette[0]);
+        UUnpackRgb565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const int d = pixels[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError) { bestError = error; best = p; }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    block[0] = uint8_t(color0); block[1] = uint8_t(color0 >> 8);
+    block[2] = uint8_t(color1); block[3] = uint8_t(color1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = uint8_t(indices >> (8 * i));
+}
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
-    // LAMP: draw lamp
-    //----------------
-    glUseProgram(gLampProgramId);
+// Compresses the alpha of a 4x4 block of RGBA8 pixels into the 8-byte alpha block of BC3 (DXT5)
+void UCompressBlockBC3Alpha(const unsigned char* pixels, unsigned char* block)
+{
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        alpha0 = std::max(alpha0, int(pixels[i * 4 + 3]));
+        alpha1 = std::min(alpha1, int(pixels[i * 4 + 3]));
+    }
 
-    //Transform the smaller pyramid used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
+    // alpha0 > alpha1 selects eight interpolated values
+    int palette[8] = { alpha0, alpha1 };
+    for (int p = 2; p < 8; ++p)
+        palette[p] = ((8 - p) * alpha0 + (p - 1) * alpha1) / 7;
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
+    uint64_t indices = 0;
+    if (alpha0 != alpha1)
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 256;
+            for (int p = 0; p < 8; ++p)
+            {
+                const int error = abs(pixels[i * 4 + 3] - palette[p]);
+                if (error < bestError) { bestError = error; best = p; }
+            }
+            indices |= uint64_t(best) << (3 * i);
+        }
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    block[0] = uint8_t(alpha0);
+    block[1] = uint8_t(alpha1);
+    for (int i = 0; i < 6; ++i)
+        block[2 + i] = uint8_t(indices >> (8 * i));
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
-    // Deactivate the Vertex Array Object and shader program
-    glBindVertexArray(0);
-    glUseProgram(0);
+// Compresses an RGBA8 image into BC1 or BC3 blocks; edge blocks repeat the last row and column
+void UCompressImage(const unsigned char* image, int width, int height, GLenum format, unsigned char* blocks)
+{
+    const bool hasAlpha = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    unsigned char pixels[16 * 4];
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    for (int by = 0; by < height; by += 4)
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                {
+                    const int sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+                    memcpy(pixels + (y * 4 + x) * 4, image + (size_t(sy) * width + sx) * 4, 4);
+                }
+
+            if (hasAlpha)
+            {
+                UCompressBlockBC3Alpha(pixels, blocks);
+                blocks += 8;
+            }
+            UCompressBlockBC1(pixels, blocks);
+            blocks += 8;
+        }
 }
 
 
-// Implements the UCreateMesh function
-void UCreateMesh(GLMesh& mesh)
+// Decodes a source image and builds its cache file in memory: flipped for OpenGL, box-filtered down to
+// 1x1 and compressed to BC1 (or BC3 for images with alpha)
+bool UBakeTextureCache(const string& filename, uint64_t sourceSize, int64_t sourceTime, vector<unsigned char>& file)
 {
-    // Position and Color data
-    GLfloat verts[] = {
-        //Positions          //Normals
-        // ------------------------------------------------------
-        //Front Left Face    //Negative Z Normal  Texture Coords.
-        //Triangular Prism (Lotion Bottle)
-        //Triangle 1 Left Face 
-         0.35f,  1.0f,  -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Top Left Vertex 1  
-         0.45f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
-         0.45f,  0.2f,  -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
-        //Triangle 2 Right Face
-         0.75f,  0.2f,  -0.25f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
-         0.85f,  1.0f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Vertex 0 
-         0.75f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
-        //Triangle 3 Back Face
-         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
-         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Left Vertex 1 
-         0.75f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 5 
-        //Triangle 4 Back Face
-         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Left Vertex 1 
-         0.45f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
-         0.75f,  0.2f,  -0.25f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 5        
-        //Triangle 5 Front Face
-         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
-         0.35f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Top Left Vertex 1  
-         0.45f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
-        //Triangle 6 Front Face
-         0.85f,  1.0f,  -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Top Right Vertex 0 
-         0.45f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 3 
-         0.75f,  0.2f,  -0.15f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
-        //Triangle 7 Bottom Face
-         0.75f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
-         0.45f,  0.2f,  -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
-         0.45f,  0.2f,  -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 3 
-        //Triangle 8 Bottom Face
-         0.75f,  0.2f,  -0.25f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Back Vertex 5 
-         0.45f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 3 
-         0.75f,  0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 4 
+    int width, height, channels;
+    unsigned char* image = stbi_load(filename.c_str(), &width, &height, &channels, 4);
+    if (!image || (channels != 3 && channels != 4))
+    {
+        stbi_image_free(image);
+        return false;
+    }
 
-        //Cylinder (Lotion Bottle Cap)
-        //Bottom Circle
-         //Triangle 1
-         0.6f,  0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.45f, 0.01f, -0.25f,  -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Back Vertex 2 
-         0.43f,  0.01f, -0.2f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1    
-         //Triangle 2
-         0.6f,  0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.6f,  0.01f, -0.26f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Center Back Vertex 3 
-         0.45f, 0.01f, -0.25f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Back Vertex 2 
-         //Triangle 3
-         0.6f,  0.01f, -0.2f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.75f, 0.01f, -0.25f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Bottom Right Back Vertex 4 
-         0.6f,  0.01f, -0.26f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Center Back Vertex 3 
-         //Triangle 4
-         0.6f,  0.01f, -0.2f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.77f,  0.01f, -0.2f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Right Vertex 5 
-         0.75f, 0.01f, -0.25f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Right Back Vertex 4 
-         //Triangle 5
-         0.6f,  0.01f, -0.2f,   0.0f, -1.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.75f, 0.01f, -0.15f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f, // Bottom Right Front Vertex 6 
-         0.77f,  0.01f, -0.2f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Vertex 5 
-         //Triangle 6
-         0.6f,  0.01f, -0.2f,   0.0f,  1.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.6f,  0.01f, -0.14f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f, // Bottom Center Front Vertex 7 
-         0.75f, 0.01f, -0.15f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 6 
-         //Triangle 7
-         0.6f,  0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.45f, 0.01f, -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 8 
-         0.6f,  0.01f, -0.14f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Center Front Vertex 7 
-         //Triangle 8
-         0.6f,  0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Center Bottom Vertex 9 
-         0.43f, 0.01f, -0.2f,   -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Vertex 1  
-         0.45f, 0.01f, -0.15f,  -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
+    flipImageVertically(image, width, height, 4);
+    vector<unsigned char> level(image, image + size_t(width) * height * 4);
+    stbi_image_free(image);
 
-         //The circles connecting planes
-         //Plane 1 Front
-         0.6f,  0.01f, -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Bottom Center Front Vertex 7 
-         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Center Front Vertex 7 
-         0.45f, 0.01f, -0.15f,   0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
-         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f, // Top Center Front Vertex 7 
-         0.45f, 0.2f,  -0.15f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f, // Top Left Front Vertex 8 
-         0.45f, 0.01f, -0.15f,   0.0f,  0.0f, -1.0f,  0.0f, 1.0f, // Bottom Left Front Vertex 8 
-         //Plane 2 Front
-         0.75f, 0.01f, -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Bottom Right Front Vertex 6 
-         0.75f, 0.2f,  -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f,// Bottom Right Front Vertex 6 
-         0.6f,  0.01f, -0.14f,   0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Center Front Vertex 7 
-         0.75f, 0.2f,  -0.15f,   0.0f,  0.0f,  1.0f,  1.0f, 0.0f, // Bottom Right Front Vertex 6 
-         0.6f,  0.2f,  -0.14f,   0.0f,  0.0f,  1.0f,  1.0f, 1.0f, // Bottom Center Front Vertex 7 
-         0.6f,  0.01f, -0.14f,   0.0f,  0.0f,  1.0f,  0.0f, 1.0f, // Bottom Center Front Vertex 7 
-         //Plane 3 Left Front
-         0.45f, 0.01f, -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,// Bottom Left Front Vertex 8 
-         0.45f, 0.2f,  -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Bottom Left Front Vertex 8 
-         0.43f, 0.01f, -0.2f,    -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1  
-         0.45f, 0.2f,  -0.15f,   -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Left Front Vertex 8 
-         0.43f, 0.2f,  -0.2f,    -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,// Bottom Left Vertex 1 
-         0.43f, 0.01f, -0.2f,    -1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Left Vertex 1 
-         //Plane 4 Right Front
-         0.77f, 0.01f, -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Bottom Right Vertex 5 
-         0.77f, 0.2f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Vertex 5 
-         0.75f, 0.01f, -0.15f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f, // Bottom Right Front Vertex 6 
-         0.77f, 0.2f,  -0.2f,   1.0f,  0.0f,  0.0f,  1.0f, 0.0f, // Top Right Vertex 5 
-         0.75f, 0.2f,  -0.15f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, // Top Right Front Vertex 6 
-         0.75f, 0.01f, -0.15f,  1.0f,  0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 6 
-         //Plane 5 Back
-         0.75f, 0.01f, -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 4 
-         0.75f, 0.2f,  -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
-         0.6f,  0.01f, -0.26f,  0.0f, -1.0f, 0.0f,   0.0f, 1.0f, // Bottom Center Back Vertex 3 
-         0.75f, 0.2f,  -0.25f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Top Right Back Vertex 4 
-         0.6f,  0.2f,  -0.26f,  0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
-         0.6f,  0.01f, -0.26f,  0.0f, -1.0f, 0.0f,   0.0f, 1.0f, // Bottom Center Back Vertex 3 
-         //Plane 6 Back
-         0.6f,  0.01f, -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Bottom Center Back Vertex 3 
-         0.6f,  0.2f,  -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
-         0.45f, 0.01f, -0.25f,  0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Back Vertex 2 
-         0.6f,  0.2f,  -0.26f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Top Center Back Vertex 3 
-         0.45f, 0.2f,  -0.25f,  0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
-         0.45f, 0.01f, -0.25f,  0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Back Vertex 2 
-         //Plane 7 Back Left
-         0.45f, 0.01f, -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Bottom Left Back Vertex 2 
-         0.45f, 0.2f,  -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
-         0.43f, 0.01f, -0.2f,  -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Vertex 1  
-         0.45f, 0.2f,  -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Top Left Back Vertex 2 
-         0.43f, 0.2f,  -0.2f,  -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Left Vertex 1  
-         0.43f, 0.01f, -0.2f,  -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Left Vertex 1 
-         //Plane 8 Back Right
-         0.77f, 0.01f, -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Bottom Right Vertex 5 
-         0.77f, 0.2f,  -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Vertex 5 
-         0.75f, 0.01f, -0.25f,  1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Back Vertex 4 
-         0.77f, 0.2f,  -0.2f,   1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Top Right Vertex 5 
-         0.75f, 0.2f,  -0.25f,  1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
-         0.75f, 0.01f, -0.25f,  1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Bottom Right Back Vertex 4      
+    const GLenum format = channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    const size_t blockBytes = channels == 4 ? 16 : 8;
 
-         //Top Circle
-         //Triangle 1
-         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.45f, 0.2f, -0.25f, 0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Top Left Back Vertex 2 
-         0.43f, 0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   0.0f, 1.0f, // Top Left Vertex 1    
-         //Triangle 2
-         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.6f,  0.2f, -0.26f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f, // Top Center Back Vertex 3 
-         0.45f, 0.2f, -0.25f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,// Top Left Back Vertex 2 
-         //Triangle 3
-         0.6f,  0.2f, -0.2f,  -1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.75f, 0.2f, -0.25f, -1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Back Vertex 4 
-         0.6f,  0.2f, -0.26f, -1.0f, 0.0f, 0.0f,   0.0f, 1.0f, // Top Center Back Vertex 3 
-         //Triangle 4
-         0.6f,  0.2f, -0.2f,  1.0f, 0.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.77f, 0.2f, -0.2f,  1.0f, 0.0f, 0.0f,   1.0f, 1.0f, // Top Right Vertex 5 
-         0.75f, 0.2f, -0.25f, 1.0f, 0.0f, 0.0f,   0.0f, 1.0f,// Top Right Back Vertex 4 
-         //Triangle 5
-         0.6f,  0.2f, -0.2f,  0.0f, -1.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.75f, 0.2f, -0.15f, 0.0f, -1.0f, 0.0f,   1.0f, 1.0f, // Top Right Front Vertex 6 
-         0.77f, 0.2f, -0.2f, 0.0f,  -1.0f, 0.0f,   0.0f, 1.0f, // Top Right Vertex 5 
-         //Triangle 6
-         0.6f,  0.2f, -0.2f,  0.0f, 1.0f, 0.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.6f,  0.2f, -0.14f, 0.0f, 1.0f, 0.0f,   1.0f, 1.0f, // Top Center Front Vertex 7 
-         0.75f, 0.2f, -0.15f, 0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // Top Right Front Vertex 6 
-         //Triangle 7
-         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.45f, 0.2f, -0.15f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f, // Top Left Front Vertex 8 
-         0.6f,  0.2f, -0.14f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f, // Top Center Front Vertex 7 
-         //Triangle 8
-         0.6f,  0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Center Top Vertex 9 
-         0.43f, 0.2f, -0.2f,  0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Top Left Vertex 1  
-         0.45f, 0.2f, -0.15f, 0.0f, 0.0f, -1.0f,   0.0f, 1.0f,// Top Left Front Vertex 8
+    vector<TextureLevel> levels;
+    vector<unsigned char> levelData;
+    int levelWidth = width, levelHeight = height;
+    for (;;)
+    {
+        TextureLevel entry;
+        entry.width = levelWidth;
+        entry.height = levelHeight;
+        entry.offset = levelData.size();
+        entry.size = size_t((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockBytes;
+        levels.push_back(entry);
+
+        levelData.resize(levelData.size() + size_t(entry.size));
+        UCompressImage(level.data(), levelWidth, levelHeight, format, levelData.data() + entry.offset);
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+
+        // Average 2x2 texels into the next level (odd sizes repeat the last row or column)
+        const int nextWidth = std::max(1, levelWidth / 2), nextHeight = std::max(1, levelHeight / 2);
+        vector<unsigned char> next(size_t(nextWidth) * nextHeight * 4);
+        for (int y = 0; y < nextHeight; ++y)
+            for (int x = 0; x < nextWidth; ++x)
+            {
+                const int x0 = 2 * x, x1 = std::min(2 * x + 1, levelWidth - 1);
+                const int y0 = 2 * y, y1 = std::min(2 * y + 1, levelHeight - 1);
+                for (int c = 0; c < 4; ++c)
+                {
+                    const int sum = level[(size_t(y0) * levelWidth + x0) * 4 + c] + level[(size_t(y0) * levelWidth + x1) * 4 + c] +
+                        level[(size_t(y1) * levelWidth + x0) * 4 + c] + level[(size_t(y1) * levelWidth + x1) * 4 + c];
+                    next[(size_t(y) * nextWidth + x) * 4 + c] = uint8_t((sum + 2) / 4);
+                }
+            }
+        level.swap(next);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
 
-        //Plane
-         //Triangle 1 Back Triangle
-        -2.0f, 0.0f,  2.0f,  0.0f, 0.0f, -1.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 1 GREEN
-        -2.0f, 0.0f, -2.0f,  0.0f, 0.0f, -1.0f,   1.0f, 1.0f, // Bottom Left Front Vertex 2 GREEN
-         2.0f, 0.0f, -2.0f,  0.0f, 0.0f, -1.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 3 GREEN
-         //Triangle 2 Front Triangle
-        -2.0f, 0.0f,  2.0f,  0.0f, 0.0f,  1.0f,   1.0f, 0.0f, // Bottom Right Back Vertex 1 GREEN
-         2.0f, 0.0f, -2.0f,  0.0f, 0.0f,  1.0f,   1.0f, 1.0f, // Bottom Right Front Vertex 3 GREEN
-         2.0f, 0.0f,  2.0f,  0.0f, 0.0f,  1.0f,   0.0f, 1.0f, // Bottom Right Front Vertex 4 GREEN
+    TextureCacheHeader header;
+    memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TEXTURE_CACHE_VERSION;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.levelCount = uint32_t(levels.size());
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+
+    const size_t tableSize = levels.size() * sizeof(TextureLevel);
+    file.resize(sizeof(header) + tableSize + levelData.size());
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), levels.data(), tableSize);
+    memcpy(file.data() + sizeof(header) + tableSize, levelData.data(), levelData.size());
 
+    return true;
+}
 
-    };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
+// Validates a texture cache file against its source image and fills in the load's format and levels.
+// Returns false for a corrupt, outdated or foreign file.
+bool UParseTextureCache(const unsigned char* data, size_t size, uint64_t sourceSize, int64_t sourceTime, TextureLoad& load, size_t& levelDataOffset)
+{
+    TextureCacheHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+    if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != TEXTURE_CACHE_VERSION)
+        return false;
+    if (header.format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && header.format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        return false;
+    if (header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+        return false;
+    if (header.levelCount == 0 || header.levelCount > 32 || size < sizeof(header) + header.levelCount * sizeof(TextureLevel))
+        return false;
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+    levelDataOffset = sizeof(header) + header.levelCount * sizeof(TextureLevel);
+    load.levels.resize(header.levelCount);
+    memcpy(load.levels.data(), data + sizeof(header), header.levelCount * sizeof(TextureLevel));
+    for (const TextureLevel& entry : load.levels)
+        if (entry.offset > size - levelDataOffset || entry.size > size - levelDataOffset - entry.offset)
+            return false;
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    load.compressedFormat = header.format;
+    load.width = int(header.width);
+    load.height = int(header.height);
+    load.channels = int(header.channels);
+    return true;
+}
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+void UDestroyTexture(GLTexture& texture)
+{
+    texture.reset();
+}
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+// Implements the UCreateShaders function
+// preamble is compiled in front of both sources (e.g. a #version line and feature defines)
+// label names the program in the resource registry. On failure the program is deleted again.
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program, GLUniformLocations& uniforms, const string& label, const char* preamble)
+{
+    const int64_t startNs = UProfileNow();
+    const uint64_t key = UProgramCacheKey(preamble, vtxShaderSource, fragShaderSource);
+
+    // Create a Shader program object.
+    program.create(label);
+    const GLuint programId = program;
+
+    // Prefer the cached binary; the driver may reject it (e.g. after an update), then compile from source
+    if (gUseProgramCache && ULoadProgramBinary(key, programId))
+    {
+        ++gProgramCacheHits;
+        LogMessage(LOG_INFO) << "Shader program " << std::hex << key << std::dec << " loaded from cache in " << (UProfileNow() - startNs) / 1.0e6 << " ms";
+    }
+    else
+    {
+        // A rejected binary leaves the program unlinked, so it can still be built from source
+        if (!UCompileShaderProgram(preamble, vtxShaderSource, fragShaderSource, programId))
+        {
+            program.reset();
+            return false;
+        }
+
+        ++gProgramCacheMisses;
+        LogMessage(LOG_INFO) << "Shader program " << std::hex << key << std::dec << " compiled in " << (UProfileNow() - startNs) / 1.0e6 << " ms";
+
+        if (gUseProgramCache)
+            USaveProgramBinary(key, programId);
+    }
+
+    // The driver's copy of the linked program, as far as the GL tells
+    GLint binaryLength = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    USetResourceSize(RESOURCE_PROGRAM, programId, size_t(std::max(binaryLength, 0)));
+
+    glUseProgram(programId);    // Uses the shader program
+
+    // Resolve the uniform locations once so rendering never has to look them up by name
+    uniforms.uvScale = glGetUniformLocation(programId, "uvScale");
+
+    // Attach the shared FrameData block (if the program uses it) to its buffer binding point
+    GLuint frameDataIndex = glGetUniformBlockIndex(programId, "FrameData");
+    if (frameDataIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(programId, frameDataIndex, FRAME_DATA_BINDING);
+
+    // Same for the clustered lighting buffers, the per-draw data and the texture table
+    const struct { const char* name; GLuint binding; } storageBlocks[] = {
+        { "PointLights", LIGHT_BUFFER_BINDING }, { "LightClusters", CLUSTER_RANGE_BUFFER_BINDING }, { "LightIndices", LIGHT_INDEX_BUFFER_BINDING },
+        { "Objects", OBJECT_BUFFER_BINDING }, { "TextureSlots", TEXTURE_SLOT_BUFFER_BINDING } };
+    for (const auto& block : storageBlocks)
+    {
+        GLuint blockIndex = glGetProgramResourceIndex(programId, GL_SHADER_STORAGE_BLOCK, block.name);
+        if (blockIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(programId, blockIndex, block.binding);
+    }
+
+    return true;
 }
 
 
-void UDestroyMesh(GLMesh& mesh)
+void UDestroyShaderProgram(GLProgram& program)
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(1, &mesh.vbo);
+    program.reset();
 }
 
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Returns the material shader variant for a combination of MaterialFeature flags, compiling it on first use
+// (or loading it from the shader cache). Returns nullptr if the variant does not compile.
+const GLMaterialProgram* UGetMaterialProgram(unsigned int features)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    GLMaterialProgram& variant = gMaterialPrograms[features];
+    if (!variant.built)
     {
-        flipImageVertically(image, width, height, channels);
+        variant.built = true;
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        string preamble = "#version 440 core\n";
+        preamble += string("#define TEXTURED ") + (features & MATERIAL_TEXTURED ? "true" : "false") + "\n";
+        preamble += string("#define SPECULAR ") + (features & MATERIAL_SPECULAR ? "true" : "false") + "\n";
+        preamble += string("#define INSTANCED ") + (features & MATERIAL_INSTANCED ? "true" : "false") + "\n";
+        preamble += string("#define PACKED_VERTICES ") + (gPackVertices ? "true" : "false") + "\n";
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        // How a texture slot is sampled: through its bindless handle, or its layer of the texture array
+        if (gTextureTable.bindless)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            preamble.insert(preamble.find('\n') + 1, "#extension GL_ARB_bindless_texture : require\n"); // Right after #version
+            preamble += "#define SAMPLE_TEXTURE(slot, uv) texture(sampler2D(textureSlots[slot].handle), uv)\n"
+                "#define TEXTURE_SIZE(slot) textureSize(sampler2D(textureSlots[slot].handle), 0)\n";
         }
+        else
+            preamble += "#define SAMPLE_TEXTURE(slot, uv) texture(uTextureArray, vec3(uv, float(textureSlots[slot].layer)))\n"
+                "#define TEXTURE_SIZE(slot) textureSize(uTextureArray, 0).xy\n";
 
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-        glBindTexture(GL_TEXTURE_2D, 1);
-
-        return true;
+        if (UCreateShaderProgram(materialVertexShaderSource, materialFragmentShaderSource, variant.programId, variant.uniforms,
+            "material variant " + to_string(features), preamble.c_str()))
+        {
+            // The texture array (if used) is bound to texture unit 0
+            glUniform1i(glGetUniformLocation(variant.programId, "uTextureArray"), 0);
+        }
+        else
+            LogMessage(LOG_ERROR) << "Failed to build material variant " << features;
     }
 
-    // Error loading the image
-    return false;
+    return variant.programId ? &variant : nullptr;
 }
 
 
-void UDestroyTexture(GLuint textureId)
+// Normal matrix of a model matrix: keeps normals perpendicular under non-uniform scaling
+glm::mat3 UNormalMatrix(const glm::mat4& model)
 {
-    glGenTextures(1, &textureId);
+    return glm::transpose(glm::inverse(glm::mat3(model)));
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Compiles and links the program from source, printing compilation errors (if any)
+bool UCompileShaderProgram(const char* preamble, const char* vtxShaderSource, const char* fragShaderSource, GLuint programId)
 {
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
 
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
     // Create the vertex and fragment shader objects
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
     GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    // Retrive the shader source, behind the preamble
+    const char* vertexSources[] = { preamble, vtxShaderSource };
+    const char* fragmentSources[] = { preamble, fragShaderSource };
+    glShaderSource(vertexShaderId, 2, vertexSources, NULL);
+    glShaderSource(fragmentShaderId, 2, fragmentSources, NULL);
+
+    // The shader objects are only needed until the program is linked
+    auto deleteShaders = [vertexShaderId, fragmentShaderId]()
+    {
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+    };
 
     // Compile the vertex shader, and print compilation errors (if any)
     glCompileShader(vertexShaderId); // compile the vertex shader
@@ -1038,8 +8232,9 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        LogMessage(LOG_ERROR) << "SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog;
 
+        deleteShaders();
         return false;
     }
 
@@ -1049,8 +8244,9 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        LogMessage(LOG_ERROR) << "SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog;
 
+        deleteShaders();
         return false;
     }
 
@@ -1058,24 +8254,671 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     glAttachShader(programId, vertexShaderId);
     glAttachShader(programId, fragmentShaderId);
 
+    // Keep the linked binary retrievable for the shader cache
+    glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
     glLinkProgram(programId);   // links the shader program
+    glDetachShader(programId, vertexShaderId);
+    glDetachShader(programId, fragmentShaderId);
+    deleteShaders();
+
     // check for linking errors
     glGetProgramiv(programId, GL_LINK_STATUS, &success);
     if (!success)
     {
         glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        LogMessage(LOG_ERROR) << "SHADER::PROGRAM::LINKING_FAILED\n" << infoLog;
 
         return false;
     }
 
-    glUseProgram(programId);    // Uses the shader program
+    return true;
+}
+
+
+// Hashes (FNV-1a) the program sources together with the driver identification, so a cached binary is
+// only ever offered to the driver that produced it
+uint64_t UProgramCacheKey(const char* preamble, const char* vtxShaderSource, const char* fragShaderSource)
+{
+    const char* parts[] =
+    {
+        preamble,
+        vtxShaderSource,
+        fragShaderSource,
+        reinterpret_cast<const char*>(glGetString(GL_VENDOR)),
+        reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+        reinterpret_cast<const char*>(glGetString(GL_VERSION))
+    };
+
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* part : parts)
+    {
+        for (const char* c = part ? part : ""; *c; ++c)
+            hash = (hash ^ uint8_t(*c)) * 1099511628211ull;
+        hash = (hash ^ 0xFF) * 1099511628211ull; // Separator, so moving text between parts changes the hash
+    }
+
+    return hash;
+}
+
+
+// Path of the cache file for a program key
+string UProgramCachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return string(PROGRAM_CACHE_DIRECTORY) + "/" + name;
+}
+
+
+// Loads a cached program binary; returns false if there is none or the driver rejects it
+bool ULoadProgramBinary(uint64_t key, GLuint programId)
+{
+    MappedFile file = {};
+    if (!UMapFile(UProgramCachePath(key), file))
+        return false;
+
+    ProgramCacheHeader header;
+    bool valid = file.size >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, file.data, sizeof(header));
+        valid = memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) == 0 && header.version == PROGRAM_CACHE_VERSION &&
+            header.key == key && header.binarySize == file.size - sizeof(header);
+    }
+
+    GLint success = 0;
+    if (valid)
+    {
+        glProgramBinary(programId, header.binaryFormat, file.data + sizeof(header), GLsizei(header.binarySize));
+        glGetProgramiv(programId, GL_LINK_STATUS, &success);
+        if (!success)
+            LogMessage(LOG_WARNING) << "Cached shader program " << std::hex << key << std::dec << " rejected by the driver; compiling from source";
+    }
+
+    UUnmapFile(file);
+    return success != 0;
+}
+
+
+// Saves the binary of a linked program to the shader cache (best effort: failures only cost a recompile)
+void USaveProgramBinary(uint64_t key, GLuint programId)
+{
+    GLint length = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ProgramCacheHeader header;
+    vector<unsigned char> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(programId, length, &length, &binaryFormat, binary.data());
+
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_CACHE_VERSION;
+    header.binaryFormat = binaryFormat;
+    header.key = key;
+    header.binarySize = uint64_t(length);
+
+#ifdef _WIN32
+    _mkdir(PROGRAM_CACHE_DIRECTORY);
+#else
+    mkdir(PROGRAM_CACHE_DIRECTORY, 0755);
+#endif
+
+    // Write to a temporary file first, so an interrupted run never leaves a partial binary behind
+    const string path = UProgramCachePath(key);
+    const string tempPath = path + ".tmp";
+    ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(binary.data()), length);
+    out.close();
+    if (out)
+    {
+        remove(path.c_str());
+        rename(tempPath.c_str(), path.c_str());
+    }
+    else
+        remove(tempPath.c_str());
+}
+
+
+// Starts the log thread. It is stopped (after printing what is left) when the program exits.
+void ULogStart()
+{
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+        gLogger.records[i].sequence.store(i, std::memory_order_relaxed);
+    gLogger.head.store(0, std::memory_order_relaxed);
+    gLogger.tail = 0;
+    gLogger.running = true;
+    gLogger.thread = std::thread([]()
+    {
+        while (gLogger.running.load(std::memory_order_acquire))
+            if (!ULogDrain())
+                std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+        ULogDrain();
+    });
+    atexit(ULogStop);
+}
+
+
+// Stops the log thread once it has printed every queued message
+void ULogStop()
+{
+    if (!gLogger.thread.joinable())
+        return;
+    gLogger.running.store(false, std::memory_order_release);
+    gLogger.thread.join();
+}
+
+
+// Prints the published messages at the front of the queue, and reports messages lost to a full queue.
+// Only called by the log thread. Returns false if there was nothing to print.
+bool ULogDrain()
+{
+    static const char* const levelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+    bool printed = false;
+    for (;;)
+    {
+        LogRecord& record = gLogger.records[gLogger.tail & (LOG_QUEUE_SIZE - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != gLogger.tail + 1)
+            break;  // Empty, or the writer of the next message is still formatting it
+
+        std::ostream& out = record.level >= LOG_WARNING ? cerr : cout;
+        out << levelNames[record.level] << ": ";
+        out.write(record.text, record.length);
+        if (record.suppressed > 0)
+            out << " (" << record.suppressed << " similar messages suppressed)";
+        out << '\n';
+
+        // Hand the slot back to the writers for its next lap around the ring
+        record.sequence.store(gLogger.tail + LOG_QUEUE_SIZE, std::memory_order_release);
+        ++gLogger.tail;
+        printed = true;
+    }
+
+    uint64_t dropped = gLogger.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        cerr << "WARNING: " << dropped << " log messages dropped (log queue full)\n";
+        printed = true;
+    }
+
+    if (printed)
+        cout.flush();
+    return printed;
+}
+
+
+// Claims a queue slot for a message unless the level is filtered out or the call site's rate limit holds it
+// back. A full queue drops the message and counts it; the writer never waits for the log thread.
+LogMessage::LogMessage(LogLevel level, LogRateLimit* limit)
+    : stream(&buffer), record(nullptr), position(0)
+{
+    if (level < gLogLevel)
+        return;
+
+    uint32_t suppressed = 0;
+    if (limit)
+    {
+        int64_t now = UProfileNow();
+        int64_t next = limit->nextNs.load(std::memory_order_relaxed);
+        if (now < next || !limit->nextNs.compare_exchange_strong(next, now + LOG_RATE_LIMIT_NS, std::memory_order_relaxed))
+        {
+            limit->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        suppressed = limit->suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    uint64_t head = gLogger.head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        LogRecord& slot = gLogger.records[head & (LOG_QUEUE_SIZE - 1)];
+        int64_t lap = int64_t(slot.sequence.load(std::memory_order_acquire) - head);
+        if (lap == 0)
+        {
+            // The slot is free for this position: claim it (on failure head holds the new front)
+            if (gLogger.head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+            {
+                record = &slot;
+                position = head;
+                break;
+            }
+        }
+        else if (lap < 0)
+        {
+            // The log thread has not printed this slot's previous message yet: the queue is full
+            gLogger.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+            head = gLogger.head.load(std::memory_order_relaxed);
+    }
+
+    record->level = level;
+    record->suppressed = suppressed;
+    buffer.reset(record->text, LOG_MESSAGE_SIZE);
+}
+
+
+// Publishes the formatted message to the log thread
+LogMessage::~LogMessage()
+{
+    if (!record)
+        return;
+
+    record->length = buffer.length();
+    if (stream.bad() && record->length >= 3)
+        memcpy(record->text + record->length - 3, "...", 3);   // Cut off at LOG_MESSAGE_SIZE
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+
+// Converts a --log-level argument into its level
+bool UParseLogLevel(const string& name, LogLevel& level)
+{
+    static const char* const names[] = { "debug", "info", "warning", "error" };
+    for (int i = 0; i <= LOG_ERROR; ++i)
+        if (name == names[i])
+        {
+            level = LogLevel(i);
+            return true;
+        }
+    return false;
+}
+
+
+// Parses a --vsync mode: off, on or adaptive
+bool UParseVsyncMode(const string& name, VsyncMode& mode)
+{
+    static const char* const names[] = { "off", "on", "adaptive" };
+    for (int i = 0; i <= VSYNC_ADAPTIVE; ++i)
+        if (name == names[i])
+        {
+            mode = VsyncMode(i);
+            return true;
+        }
+    return false;
+}
+
+
+// Parses a whole decimal integer argument; rejects empty text, trailing characters and out-of-range values
+bool UParseInt(const string& text, int& value)
+{
+    errno = 0;
+    char* end = nullptr;
+    const long parsed = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+        return false;
+    value = int(parsed);
+    return true;
+}
+
 
+// Parses a whole decimal number argument; rejects empty text, trailing characters, overflow, infinities and NaN
+bool UParseDouble(const string& text, double& value)
+{
+    errno = 0;
+    char* end = nullptr;
+    const double parsed = strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(parsed))
+        return false;
+    value = parsed;
+    return true;
+}
+
+
+// Current time on the profiler's (steady_clock) timeline, in nanoseconds
+int64_t UProfileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Stores an event in the profiler's ring buffer, overwriting the oldest one when it is full
+void UProfileRecord(const char* name, int64_t startNs, int64_t durationNs, uint32_t track)
+{
+    const uint64_t position = gProfileEventCount.fetch_add(1);
+    ProfileSlot& slot = gProfileEvents[position & (PROFILE_RING_SIZE - 1)];
+
+    // Withdraw the overwritten event before changing its fields
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.durationNs.store(durationNs, std::memory_order_relaxed);
+    slot.track.store(track, std::memory_order_relaxed);
+    slot.sequence.store(position + 1, std::memory_order_release);
+}
+
+
+// Number of the calling thread on the profiler's CPU tracks
+uint32_t UProfileThread()
+{
+    static thread_local uint32_t thread = gProfileThreadCount.fetch_add(1);
+    return thread;
+}
+
+
+// Maps GL_TIMESTAMP values onto the steady_clock timeline of the CPU scopes
+void UCalibrateGpuClock()
+{
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    gGpuClockOffsetNs = UProfileNow() - gpuNow;
+}
+
+
+void UCreateProfiler()
+{
+    for (GpuProfileFrame& frame : gGpuProfileFrames)
+    {
+        glGenQueries(PROFILE_MAX_GPU_SCOPES * 2, frame.queries);
+        frame.nScopes = 0;
+    }
+    UCalibrateGpuClock();
+}
+
+
+void UDestroyProfiler()
+{
+    for (GpuProfileFrame& frame : gGpuProfileFrames)
+        glDeleteQueries(PROFILE_MAX_GPU_SCOPES * 2, frame.queries);
+}
+
+
+// Starts a profiler frame: collects the GPU scopes of two frames ago, whose query objects are about to be
+// reused. Results that are not ready yet are dropped instead of waited for, so the CPU never stalls.
+void UProfileBeginFrame()
+{
+    GpuProfileFrame& frame = gGpuProfileFrames[++gProfileFrame % 2];
+    if (frame.nScopes > 0)
+    {
+        // Timestamps complete in order: if the last one is available, all of them are
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(frame.queries[frame.nScopes * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            for (int scope = 0; scope < frame.nScopes; ++scope)
+            {
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(frame.queries[scope * 2], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(frame.queries[scope * 2 + 1], GL_QUERY_RESULT, &end);
+                UProfileRecord(frame.names[scope], int64_t(begin) + gGpuClockOffsetNs, int64_t(end - begin), PROFILE_GPU_TRACK);
+            }
+        }
+        else
+        {
+            ++gGpuProfileFramesDropped;
+        }
+    }
+    frame.nScopes = 0;
+
+    // Re-align the GPU clock now and then, as it may drift against the CPU clock
+    if (gProfileFrame % 256 == 0)
+        UCalibrateGpuClock();
+}
+
+
+// Opens a profiled scope; gpu scopes also time the GL commands issued until UProfileEnd
+ProfileMark UProfileBegin(const char* name, bool gpu)
+{
+    ProfileMark mark = { name, UProfileNow(), -1 };
+
+    // Only the thread owning the GL context opens GPU scopes; CPU scopes may be opened on any thread
+    if (gpu)
+    {
+        GpuProfileFrame& frame = gGpuProfileFrames[gProfileFrame % 2];
+        if (frame.nScopes < PROFILE_MAX_GPU_SCOPES)
+        {
+            mark.gpuScope = frame.nScopes++;
+            frame.names[mark.gpuScope] = name;
+            glQueryCounter(frame.queries[mark.gpuScope * 2], GL_TIMESTAMP);
+        }
+    }
+
+    return mark;
+}
+
+
+void UProfileEnd(const ProfileMark& mark)
+{
+    if (mark.gpuScope >= 0)
+        glQueryCounter(gGpuProfileFrames[gProfileFrame % 2].queries[mark.gpuScope * 2 + 1], GL_TIMESTAMP);
+
+    UProfileRecord(mark.name, mark.startNs, UProfileNow() - mark.startNs, UProfileThread());
+}
+
+
+// Writes the events in the profiler's ring buffer as Chrome trace-event JSON (chrome://tracing, Perfetto)
+bool UWriteChromeTrace(const string& path)
+{
+    ofstream trace(path);
+    if (!trace)
+    {
+        LogMessage(LOG_ERROR) << "Failed to write " << path;
+        return false;
+    }
+
+    const uint64_t count = gProfileEventCount.load();
+    const uint64_t first = count > PROFILE_RING_SIZE ? count - PROFILE_RING_SIZE : 0;
+
+    // Copy the events out first. A slot another thread has claimed but not written yet, or overwrote while
+    // it was copied, no longer carries its position's sequence and is left out.
+    vector<ProfileEvent> events;
+    events.reserve(size_t(count - first));
+    for (uint64_t i = first; i < count; ++i)
+    {
+        const ProfileSlot& slot = gProfileEvents[i & (PROFILE_RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+            continue;
+        const ProfileEvent event = { slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+            slot.durationNs.load(std::memory_order_relaxed), slot.track.load(std::memory_order_relaxed) };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == i + 1)
+            events.push_back(event);
+    }
+
+    // Timestamps are written in microseconds relative to the oldest event
+    int64_t originNs = INT64_MAX;
+    for (const ProfileEvent& event : events)
+        originNs = std::min(originNs, event.startNs);
+
+    trace << "{\"traceEvents\":[\n";
+    trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << PROFILE_GPU_TRACK << ",\"args\":{\"name\":\"GPU\"}}";
+    for (uint32_t thread = 0; thread < gProfileThreadCount.load(); ++thread)
+        trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":\"CPU " << thread << "\"}}";
+
+    for (const ProfileEvent& event : events)
+    {
+        trace << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track
+            << ",\"ts\":" << (event.startNs - originNs) / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+    }
+    trace << "\n]}\n";
+
+    LogMessage(LOG_INFO) << "Profiler trace (" << events.size() << " events, " << gGpuProfileFramesDropped
+        << " GPU frames dropped) written to " << path;
     return true;
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+// Creates a framebuffer with RGBA8 color and 24-bit depth renderbuffers for offscreen rendering
+void UCreateRenderTarget(GLsizei width, GLsizei height, GLRenderTarget& target)
+{
+    // Both formats take four bytes per pixel (depth is padded)
+    target.color.create("offscreen color");
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    USetResourceSize(RESOURCE_RENDERBUFFER, target.color, size_t(width) * height * 4);
+
+    target.depth.create("offscreen depth");
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    USetResourceSize(RESOURCE_RENDERBUFFER, target.depth, size_t(width) * height * 4);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    target.fbo.create("offscreen target");
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        LogMessage(LOG_ERROR) << "FRAMEBUFFER::INCOMPLETE";
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void UDestroyRenderTarget(GLRenderTarget& target)
+{
+    target.fbo.reset();
+    target.color.reset();
+    target.depth.reset();
+}
+
+
+template <GLResourceKind Kind>
+GLHandle<Kind>& GLHandle<Kind>::operator=(GLHandle&& other)
+{
+    if (this != &other)
+    {
+        reset();
+        name = other.name;
+        other.name = 0;
+    }
+    return *this;
+}
+
+
+template <GLResourceKind Kind>
+void GLHandle<Kind>::create(const string& label)
+{
+    reset();
+    name = UCreateResource(Kind, label);
+}
+
+
+template <GLResourceKind Kind>
+void GLHandle<Kind>::reset()
+{
+    if (name)
+        UDeleteResource(Kind, name);
+    name = 0;
+}
+
+
+// Names of different kinds may be equal: the registry keys objects by both
+uint64_t UResourceKey(GLResourceKind kind, GLuint name)
+{
+    return (uint64_t(kind) << 32) | name;
+}
+
+
+// Creates a GL object of the kind and registers it under the label, without storage yet
+GLuint UCreateResource(GLResourceKind kind, const string& label)
+{
+    GLuint name = 0;
+    switch (kind)
+    {
+    case RESOURCE_BUFFER:       glGenBuffers(1, &name); break;
+    case RESOURCE_TEXTURE:      glGenTextures(1, &name); break;
+    case RESOURCE_PROGRAM:      name = glCreateProgram(); break;
+    case RESOURCE_VERTEX_ARRAY: glGenVertexArrays(1, &name); break;
+    case RESOURCE_FRAMEBUFFER:  glGenFramebuffers(1, &name); break;
+    case RESOURCE_RENDERBUFFER: glGenRenderbuffers(1, &name); break;
+    default: break;
+    }
+    if (!name)
+        return 0;
+
+    GLResource& resource = gResources.objects[UResourceKey(kind, name)];
+    resource.kind = kind;
+    resource.label = label;
+    resource.bytes = 0;
+    ++gResources.count[kind];
+    return name;
+}
+
+
+// Deletes a GL object created by UCreateResource and takes its memory off the totals
+void UDeleteResource(GLResourceKind kind, GLuint name)
+{
+    switch (kind)
+    {
+    case RESOURCE_BUFFER:       glDeleteBuffers(1, &name); break;
+    case RESOURCE_TEXTURE:      glDeleteTextures(1, &name); break;
+    case RESOURCE_PROGRAM:      glDeleteProgram(name); break;
+    case RESOURCE_VERTEX_ARRAY: glDeleteVertexArrays(1, &name); break;
+    case RESOURCE_FRAMEBUFFER:  glDeleteFramebuffers(1, &name); break;
+    case RESOURCE_RENDERBUFFER: glDeleteRenderbuffers(1, &name); break;
+    default: break;
+    }
+
+    std::unordered_map<uint64_t, GLResource>::iterator found = gResources.objects.find(UResourceKey(kind, name));
+    if (found == gResources.objects.end())
+        return;
+    gResources.bytes[kind] -= found->second.bytes;
+    gResources.totalBytes -= found->second.bytes;
+    --gResources.count[kind];
+    gResources.objects.erase(found);
+}
+
+
+// Records the memory of an object's storage (replacing what was recorded before), and the high-water marks
+void USetResourceSize(GLResourceKind kind, GLuint name, size_t bytes)
 {
-    glDeleteProgram(programId);
+    std::unordered_map<uint64_t, GLResource>::iterator found = gResources.objects.find(UResourceKey(kind, name));
+    if (found == gResources.objects.end())
+        return;
+
+    GLResource& resource = found->second;
+    gResources.bytes[kind] += bytes - resource.bytes;
+    gResources.totalBytes += bytes - resource.bytes;
+    resource.bytes = bytes;
+    gResources.peakBytes[kind] = std::max(gResources.peakBytes[kind], gResources.bytes[kind]);
+    gResources.peakTotalBytes = std::max(gResources.peakTotalBytes, gResources.totalBytes);
+}
+
+
+const char* UResourceKindName(GLResourceKind kind)
+{
+    switch (kind)
+    {
+    case RESOURCE_BUFFER:       return "buffer";
+    case RESOURCE_TEXTURE:      return "texture";
+    case RESOURCE_PROGRAM:      return "program";
+    case RESOURCE_VERTEX_ARRAY: return "vertex array";
+    case RESOURCE_FRAMEBUFFER:  return "framebuffer";
+    case RESOURCE_RENDERBUFFER: return "renderbuffer";
+    default:                    return "object";
+    }
+}
+
+
+// Logs the live objects and memory of each kind, with the high-water marks
+void ULogResources(LogLevel level)
+{
+    LogMessage message(level);
+    message << "GPU resources: " << gResources.objects.size() << " objects, " << gResources.totalBytes / 1024 << " KB (peak "
+        << gResources.peakTotalBytes / 1024 << " KB)";
+    for (int kind = 0; kind < RESOURCE_KIND_COUNT; ++kind)
+        if (gResources.count[kind] > 0 || gResources.peakBytes[kind] > 0)
+            message << "; " << UResourceKindName(GLResourceKind(kind)) << "s: " << gResources.count[kind] << ", "
+                << gResources.bytes[kind] / 1024 << " KB (peak " << gResources.peakBytes[kind] / 1024 << " KB)";
+}
+
+
+// Shutdown report: the high-water marks, and every object still registered (each one a leak). Returns their number.
+size_t UReportLiveResources()
+{
+    LogMessage(LOG_INFO) << "GPU memory high-water mark: " << gResources.peakTotalBytes / 1024 << " KB";
+    for (const std::pair<const uint64_t, GLResource>& entry : gResources.objects)
+    {
+        const GLResource& resource = entry.second;
+        LogMessage(LOG_WARNING) << "Leaked GL " << UResourceKindName(resource.kind) << " " << GLuint(entry.first) << " \""
+            << resource.label << "\" (" << resource.bytes / 1024 << " KB)";
+    }
+    return gResources.objects.size();
 }